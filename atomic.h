@@ -15,7 +15,10 @@
 extern "C" {
 #endif
 
-/* atomic add */
+/* atomic add
+ * The FL2_atomic64 and FL2_atomicPtr operations are sequentially consistent. FL2_atomic64_cas()
+ * returns nonzero on success, and FL2_atomic64_add() returns the new value. FL2_atomicPtr_load()
+ * may return void*, so cast the result to the member type. */
 
 #if !defined(FL2_SINGLETHREAD) && defined(_WIN32)
 
@@ -42,6 +45,16 @@ typedef LONG volatile FL2_atomic;
 #define FL2_atomic_add(n, a) InterlockedAdd(&n, a)
 #define FL2_nonAtomic_increment(n) (++n)
 
+typedef LONGLONG volatile FL2_atomic64;
+#define FL2_atomic64_load(n) InterlockedCompareExchange64(&n, 0, 0)
+#define FL2_atomic64_cas(n, expected, desired) (InterlockedCompareExchange64(&n, desired, expected) == (expected))
+#define FL2_atomic64_add(n, a) InterlockedAdd64(&n, a)
+#define FL2_atomic64_store(n, v) InterlockedExchange64(&n, v)
+
+#define FL2_ATOMIC_PTR(T) T volatile
+#define FL2_atomicPtr_load(p) InterlockedCompareExchangePointer((PVOID volatile*)&(p), NULL, NULL)
+#define FL2_atomicPtr_store(p, v) InterlockedExchangePointer((PVOID volatile*)&(p), (PVOID)(v))
+
 #elif !defined(FL2_SINGLETHREAD) && defined(__GNUC__)
 
 typedef long FL2_atomic;
@@ -50,6 +63,16 @@ typedef long FL2_atomic;
 #define FL2_atomic_add(n, a) __sync_fetch_and_add(&n, a)
 #define FL2_nonAtomic_increment(n) (n++)
 
+typedef long long FL2_atomic64;
+#define FL2_atomic64_load(n) __atomic_load_n(&n, __ATOMIC_SEQ_CST)
+#define FL2_atomic64_cas(n, expected, desired) __sync_bool_compare_and_swap(&n, expected, desired)
+#define FL2_atomic64_add(n, a) __sync_add_and_fetch(&n, a)
+#define FL2_atomic64_store(n, v) __atomic_store_n(&n, v, __ATOMIC_SEQ_CST)
+
+#define FL2_ATOMIC_PTR(T) T
+#define FL2_atomicPtr_load(p) __atomic_load_n(&(p), __ATOMIC_SEQ_CST)
+#define FL2_atomicPtr_store(p, v) __atomic_store_n(&(p), v, __ATOMIC_SEQ_CST)
+
 #elif !defined(FL2_SINGLETHREAD) && defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_ATOMICS__) /* C11 */
 
 #include <stdatomic.h>
@@ -60,6 +83,24 @@ typedef _Atomic long FL2_atomic;
 #define FL2_atomic_add(n, a) atomic_fetch_add(&n, a)
 #define FL2_nonAtomic_increment(n) (n++)
 
+typedef _Atomic long long FL2_atomic64;
+static inline int FL2_atomic64_cas_(FL2_atomic64 *n, long long expected, long long desired)
+{
+    return atomic_compare_exchange_strong(n, &expected, desired);
+}
+static inline long long FL2_atomic64_add_(FL2_atomic64 *n, long long a)
+{
+    return atomic_fetch_add(n, a) + a;
+}
+#define FL2_atomic64_load(n) atomic_load(&n)
+#define FL2_atomic64_cas(n, expected, desired) FL2_atomic64_cas_(&n, expected, desired)
+#define FL2_atomic64_add(n, a) FL2_atomic64_add_(&n, a)
+#define FL2_atomic64_store(n, v) atomic_store(&n, v)
+
+#define FL2_ATOMIC_PTR(T) _Atomic(T)
+#define FL2_atomicPtr_load(p) atomic_load(&(p))
+#define FL2_atomicPtr_store(p, v) atomic_store(&(p), v)
+
 #else  /* No atomics */
 
 #	ifndef FL2_SINGLETHREAD
@@ -72,6 +113,16 @@ typedef long FL2_atomic;
 #define FL2_atomic_add(n, a) (n += (a))
 #define FL2_nonAtomic_increment(n) (n++)
 
+typedef long long FL2_atomic64;
+#define FL2_atomic64_load(n) (n)
+#define FL2_atomic64_cas(n, expected, desired) ((n) == (expected) ? ((n) = (desired), 1) : 0)
+#define FL2_atomic64_add(n, a) (n += (a))
+#define FL2_atomic64_store(n, v) (n = (v))
+
+#define FL2_ATOMIC_PTR(T) T
+#define FL2_atomicPtr_load(p) (p)
+#define FL2_atomicPtr_store(p, v) ((p) = (v))
+
 #endif /* FL2_SINGLETHREAD */
 
 
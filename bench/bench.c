@@ -38,6 +38,8 @@ static void benchmark(FL2_CCtx* fcs, FL2_DCtx* dctx, char* srcBuffer, size_t src
     coolTime = UTIL_getTime();
     printf( "\r%79s\r", "");
     size_t cSize = 0;
+    char* index = NULL;
+    size_t indexSize = 0;
     while (!cCompleted || !dCompleted) {
 
         /* overheat protection */
@@ -62,11 +64,21 @@ static void benchmark(FL2_CCtx* fcs, FL2_DCtx* dctx, char* srcBuffer, size_t src
                 cSize = FL2_compressCCtx(fcs, compressedBuffer, maxCompressedSize, srcBuffer, srcSize, 0);
                 if (FL2_isError(cSize)) {
                     printf("FL2_compressCCtx() error : %s  \r\n", FL2_getErrorName(cSize));
+                    free(index);
                     return;
                 }
                 nbLoops++;
             } while (UTIL_clockSpanMicro(clockStart) < clockLoop);
             U64 const loopDuration = UTIL_clockSpanMicro(clockStart);
+            /* Checkpoint index, if enabled */
+            indexSize = FL2_getCCtxCheckpointIndex(fcs, NULL, 0);
+            if (indexSize) {
+                free(index);
+                index = malloc(indexSize);
+                if (index == NULL)
+                    return;
+                FL2_getCCtxCheckpointIndex(fcs, index, indexSize);
+            }
             if (loopDuration < fastestC*nbLoops)
                 fastestC = loopDuration / nbLoops;
             totalCTime += loopDuration;
@@ -88,12 +100,18 @@ static void benchmark(FL2_CCtx* fcs, FL2_DCtx* dctx, char* srcBuffer, size_t src
             U32 nbLoops = 0;
             UTIL_time_t const clockStart = UTIL_getTime();
             do {
-                size_t const regenSize = FL2_decompressDCtx(dctx,
-                    resultBuffer, srcSize,
-                    compressedBuffer, cSize);
+                size_t const regenSize = indexSize
+                    ? FL2_decompressDCtxIndexed(dctx,
+                        resultBuffer, srcSize,
+                        compressedBuffer, cSize,
+                        index, indexSize)
+                    : FL2_decompressDCtx(dctx,
+                        resultBuffer, srcSize,
+                        compressedBuffer, cSize);
                 if (FL2_isError(regenSize)) {
                     printf("FL2_decompressDCtx() failed on size %u : %s  \r\n",
                         (unsigned)cSize, FL2_getErrorName(regenSize));
+                    free(index);
                     return;
                 }
                 nbLoops++;
@@ -110,7 +128,8 @@ static void benchmark(FL2_CCtx* fcs, FL2_DCtx* dctx, char* srcBuffer, size_t src
         }
 
 #endif
-        double ratio = (double)srcSize / (double)cSize;
+        /* The index is part of the compressed size when checkpoints are used */
+        double ratio = (double)srcSize / (double)(cSize + indexSize);
         markNb = (markNb + 1) % NB_MARKS;
         {   int const ratioAccuracy = (ratio < 10.) ? 3 : 2;
         double const compressionSpeed = (double)srcSize / fastestC;
@@ -123,6 +142,9 @@ static void benchmark(FL2_CCtx* fcs, FL2_DCtx* dctx, char* srcBuffer, size_t src
             decompressionSpeed);
         }
     }
+    if (indexSize)
+        printf("\r\ncheckpoint index : %u bytes\r\n", (U32)indexSize);
+    free(index);
 }
 
 static int parse_params(FL2_CCtx* fcs, int argc, char** argv)
@@ -175,6 +197,12 @@ static int parse_params(FL2_CCtx* fcs, int argc, char** argv)
         else if (strcmp(param, "b") == 0) {
             FL2_CCtx_setParameter(fcs, FL2_p_bufferResize, value);
         }
+        else if (strcmp(param, "lc") == 0) {
+            FL2_CCtx_setParameter(fcs, FL2_p_literalCtxBits, value);
+        }
+        else if (strcmp(param, "lp") == 0) {
+            FL2_CCtx_setParameter(fcs, FL2_p_literalPosBits, value);
+        }
         else if (strcmp(param, "a") == 0) {
             FL2_CCtx_setParameter(fcs, FL2_p_strategy, value);
         }
@@ -184,6 +212,18 @@ static int parse_params(FL2_CCtx* fcs, int argc, char** argv)
         else if (strcmp(param, "x") == 0) {
             FL2_CCtx_setParameter(fcs, FL2_p_highCompression, value);
         }
+        else if (strcmp(param, "pl") == 0) {
+            FL2_CCtx_setParameter(fcs, FL2_p_pipelineBlocks, value);
+        }
+        else if (strcmp(param, "gb") == 0) {
+            FL2_CCtx_setParameter(fcs, FL2_p_groupMemoryBudget, value);
+        }
+        else if (strcmp(param, "ci") == 0) {
+            FL2_CCtx_setParameter(fcs, FL2_p_checkpointLog, value);
+        }
+        else if (strcmp(param, "cl") == 0) {
+            FL2_CCtx_setParameter(fcs, FL2_p_checkpointLookback, value);
+        }
         else if (strcmp(param, "e") == 0) {
             end_level = value;
         }
@@ -221,17 +261,22 @@ int FL2LIB_CALL main(int argc, char** argv)
     }
     unsigned threads = 1;
     unsigned dthreads = ~0U;
+    unsigned probBits = ~0U;
     for (int i = 2; i < argc; ++i) {
         if (argv[i][0] == '-' && argv[i][1] == 'T')
             threads = atoi(argv[i] + 2);
         if (argv[i][0] == '-' && argv[i][1] == 'D')
             dthreads = atoi(argv[i] + 2);
+        if (argv[i][0] == '-' && argv[i][1] == 'W')
+            probBits = atoi(argv[i] + 2);
     }
     if (dthreads == ~0U)
         dthreads = threads;
     FL2_CCtx* fcs = FL2_createCCtxMt(threads);
     FL2_DCtx* dctx = FL2_createDCtxMt(dthreads);
-    if (fcs == NULL)
+    if (fcs == NULL || dctx == NULL)
+        return 1;
+    if (probBits != ~0U && FL2_isError(FL2_setDCtxProbBits(dctx, probBits)))
         return 1;
     int end_level = parse_params(fcs, argc, argv);
     int level = (int)FL2_CCtx_getParameter(fcs, FL2_p_compressionLevel);
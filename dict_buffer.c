@@ -17,13 +17,15 @@
 
 /* DICT_buffer functions */
 
-int DICT_construct(DICT_buffer * const buf, int const async)
+int DICT_construct(DICT_buffer * const buf, unsigned const nb_buffers)
 {
-    buf->data[0] = NULL;
-    buf->data[1] = NULL;
+    for (size_t u = 0; u < DICT_MAX_BUFFERS; ++u)
+        buf->data[u] = NULL;
+    buf->ring.data = NULL;
+    buf->ring.size = 0;
     buf->size = 0;
 
-    buf->async = (async != 0);
+    buf->count = MAX(1, MIN(nb_buffers, DICT_MAX_BUFFERS));
 
 #ifndef NO_XXHASH
     buf->xxh = NULL;
@@ -32,25 +34,52 @@ int DICT_construct(DICT_buffer * const buf, int const async)
     return 0;
 }
 
-int DICT_init(DICT_buffer * const buf, size_t const dict_size, size_t const overlap, unsigned const reset_multiplier, int const do_hash)
+/* Map a ring large enough that the windows of every buffer in use never wrap onto each other
+ * or onto the retained data before the oldest. Each shift advances the window by less than the
+ * aligned dictionary size. Windows are kept in the middle view of the mapping. */
+static int DICT_initRing(DICT_buffer * const buf, size_t const step, size_t const retain)
 {
-    /* Allocate if not yet allocated or existing dict too small */
-    if (buf->data[0] == NULL || dict_size > buf->size) {
-        /* Free any existing buffers */
-        DICT_destruct(buf);
+    if (step > ((size_t)-1 >> 2) / buf->count || retain > ((size_t)-1 >> 2)
+        || FL2_isError(FL2_mapRing(&buf->ring, step * buf->count + retain)))
+        return 1;
+
+    for (size_t u = 0; u < buf->count; ++u)
+        buf->data[u] = buf->ring.data + buf->ring.size;
 
-        buf->data[0] = malloc(dict_size);
+    return 0;
+}
 
-        buf->data[1] = NULL;
-        if (buf->async)
-            buf->data[1] = malloc(dict_size);
+int DICT_init(DICT_buffer * const buf, size_t const dict_size, size_t const overlap, unsigned const reset_multiplier, int const do_hash,
+    int const mirror, size_t const history)
+{
+    size_t const step = (dict_size + ALIGNMENT_SIZE - 1) & ALIGNMENT_MASK;
+    size_t const retain = (history + ALIGNMENT_SIZE - 1) & ALIGNMENT_MASK;
+
+    /* Allocate if not yet allocated, existing dict too small, or the mode changed.
+     * If a mirrored ring cannot be mapped, separate buffers are used. */
+    if (buf->data[0] == NULL || dict_size > buf->size
+        || (mirror != 0 && (buf->ring.data == NULL || buf->ring.size < step * buf->count + retain))
+        || (mirror == 0 && buf->ring.data != NULL)) {
+        /* Free any existing buffers */
+        DICT_destruct(buf);
 
-        if (buf->data[0] == NULL || (buf->async && buf->data[1] == NULL)) {
-            DICT_destruct(buf);
-            return 1;
+        if (!mirror || DICT_initRing(buf, step, retain) != 0) {
+            for (size_t u = 0; u < buf->count; ++u) {
+                buf->data[u] = malloc(dict_size);
+                if (buf->data[u] == NULL) {
+                    DICT_destruct(buf);
+                    return 1;
+                }
+            }
         }
     }
     buf->index = 0;
+    buf->queued = 0;
+    buf->busy = 0;
+    for (size_t u = 0; u < DICT_MAX_BUFFERS; ++u)
+        buf->pos[u] = 0;
+    buf->block_pos = 0;
+    buf->retain = (buf->ring.data != NULL) ? buf->ring.size - step * buf->count : 0;
     buf->overlap = overlap;
     buf->start = 0;
     buf->end = 0;
@@ -82,10 +111,12 @@ int DICT_init(DICT_buffer * const buf, size_t const dict_size, size_t const over
 
 void DICT_destruct(DICT_buffer * const buf)
 {
-    free(buf->data[0]);
-    free(buf->data[1]);
-    buf->data[0] = NULL;
-    buf->data[1] = NULL;
+    for (size_t u = 0; u < DICT_MAX_BUFFERS; ++u) {
+        if (buf->ring.data == NULL)
+            free(buf->data[u]);
+        buf->data[u] = NULL;
+    }
+    FL2_unmapRing(&buf->ring);
     buf->size = 0;
 #ifndef NO_XXHASH
     XXH32_freeState(buf->xxh);
@@ -130,6 +161,28 @@ void DICT_put(DICT_buffer * const buf, FL2_inBuffer * const input)
     buf->end += to_read;
 }
 
+/* Read from a sequence of segments and write to the dict until it is full or the segments run out */
+void DICT_putV(DICT_buffer * const buf, FL2_inVector * const input)
+{
+    BYTE* const dst = buf->data[buf->index];
+
+    while (input->index < input->nbSegs) {
+        const FL2_inSegment* const seg = input->segs + input->index;
+        size_t const to_read = MIN(buf->size - buf->end, seg->size - input->pos);
+
+        memcpy(dst + buf->end, (const BYTE*)seg->src + input->pos, to_read);
+
+        input->pos += to_read;
+        buf->end += to_read;
+
+        if (input->pos < seg->size)
+            break;
+
+        ++input->index;
+        input->pos = 0;
+    }
+}
+
 size_t DICT_availSpace(const DICT_buffer * const buf)
 {
     return buf->size - buf->end;
@@ -138,15 +191,34 @@ size_t DICT_availSpace(const DICT_buffer * const buf)
 /* Get the size of uncompressed data. start is set to end after compression */
 int DICT_hasUnprocessed(const DICT_buffer * const buf)
 {
-    return buf->start < buf->end;
+    return buf->queued != 0 || buf->start < buf->end;
 }
 
-/* Get the buffer, overlap and end for compression */
+/* Get the buffer, overlap and end for compression. Queued buffers are returned first. */
 void DICT_getBlock(DICT_buffer * const buf, FL2_dataBlock * const block)
 {
+    buf->busy = 1;
+
+    if (buf->queued != 0) {
+        size_t const i = (buf->index + buf->count - buf->queued) % buf->count;
+
+        block->data = buf->data[i];
+        block->start = buf->queue_start[i];
+        block->end = buf->size;
+        buf->block_pos = buf->pos[i];
+
+#ifndef NO_XXHASH
+        if (buf->xxh != NULL)
+            XXH32_update(buf->xxh, block->data + block->start, block->end - block->start);
+#endif
+        --buf->queued;
+        return;
+    }
+
     block->data = buf->data[buf->index];
     block->start = buf->start;
     block->end = buf->end;
+    buf->block_pos = buf->pos[buf->index];
 
 #ifndef NO_XXHASH
     if (buf->xxh != NULL)
@@ -157,6 +229,17 @@ void DICT_getBlock(DICT_buffer * const buf, FL2_dataBlock * const block)
     buf->start = buf->end;
 }
 
+size_t DICT_blockPos(const DICT_buffer * const buf)
+{
+    return buf->block_pos;
+}
+
+/* Get the number of bytes preceding the data of a block in use that remain unmodified */
+size_t DICT_retained(const DICT_buffer * const buf)
+{
+    return buf->retain;
+}
+
 /* Shift occurs when all is processed and end is beyond the overlap size */
 int DICT_needShift(DICT_buffer * const buf)
 {
@@ -169,11 +252,19 @@ int DICT_needShift(DICT_buffer * const buf)
 
 int DICT_async(const DICT_buffer * const buf)
 {
-    return (int)buf->async;
+    return buf->count > 1;
+}
+
+/* Get the position in the middle view of the ring that is `offset` bytes after the current window */
+static BYTE* DICT_ringAdvance(const DICT_buffer * const buf, size_t const offset)
+{
+    BYTE* const middle = buf->ring.data + buf->ring.size;
+    size_t const pos = (size_t)(buf->data[buf->index] - middle) + offset;
+    return middle + pos % buf->ring.size;
 }
 
-/* Shift the overlap amount to the start of either the only dict buffer or the alternate one
- * if it exists */
+/* Shift the overlap amount to the start of either the only dict buffer or the next one
+ * in the ring if it exists. In mirrored mode the next window begins at the overlap. */
 void DICT_shift(DICT_buffer * const buf)
 {
     if (buf->start < buf->end)
@@ -187,21 +278,30 @@ void DICT_shift(DICT_buffer * const buf)
     }
 
     if (overlap == 0) {
-        /* No overlap means a simple buffer switch */
+        size_t const next = (buf->index + 1) % buf->count;
+        /* No overlap means a simple buffer switch. A mirrored window moves past the old data. */
+        if (buf->ring.data != NULL)
+            buf->data[next] = DICT_ringAdvance(buf, (buf->end + ALIGNMENT_SIZE - 1) & ALIGNMENT_MASK);
         buf->start = 0;
         buf->end = 0;
-        buf->index ^= buf->async;
+        buf->index = next;
+        buf->pos[next] = 0;
         buf->total = 0;
     }
     else if (buf->end >= overlap + ALIGNMENT_SIZE) {
         size_t const from = (buf->end - overlap) & ALIGNMENT_MASK;
         const BYTE *const src = buf->data[buf->index];
-        /* Copy to the alternate if one exists */
-        BYTE *const dst = buf->data[buf->index ^ buf->async];
+        /* Copy to the next buffer if one exists */
+        size_t const next = (buf->index + 1) % buf->count;
+        BYTE *const dst = buf->data[next];
 
         overlap = buf->end - from;
 
-        if (overlap <= from || dst != src) {
+        if (buf->ring.data != NULL) {
+            DEBUGLOG(5, "Advance ring window : %u bytes", (unsigned)from);
+            buf->data[next] = DICT_ringAdvance(buf, from);
+        }
+        else if (overlap <= from || dst != src) {
             DEBUGLOG(5, "Copy overlap data : %u bytes from %u", (unsigned)overlap, (unsigned)from);
             memcpy(dst, src + from, overlap);
         }
@@ -209,14 +309,35 @@ void DICT_shift(DICT_buffer * const buf)
             DEBUGLOG(5, "Move overlap data : %u bytes from %u", (unsigned)overlap, (unsigned)from);
             memmove(dst, src + from, overlap);
         }
+        buf->pos[next] = buf->pos[buf->index] + from;
         /* New data will be written after the overlap */
         buf->start = overlap;
         buf->end = overlap;
         /* Switch buffers */
-        buf->index ^= buf->async;
+        buf->index = next;
     }
 }
 
+/* A full buffer can be queued if the next buffer in the ring is not in use */
+int DICT_canQueue(const DICT_buffer * const buf)
+{
+    return buf->end == buf->size && buf->start < buf->end
+        && 1 + buf->queued + buf->busy < buf->count;
+}
+
+/* Queue the full current buffer for compression and shift to the next one */
+void DICT_queue(DICT_buffer * const buf)
+{
+    DEBUGLOG(5, "Queueing dict buffer %u", (unsigned)buf->index);
+
+    buf->queue_start[buf->index] = buf->start;
+    buf->total += buf->end - buf->start;
+    buf->start = buf->end;
+    ++buf->queued;
+
+    DICT_shift(buf);
+}
+
 #ifndef NO_XXHASH
 XXH32_hash_t DICT_getDigest(const DICT_buffer * const buf)
 {
@@ -226,5 +347,7 @@ XXH32_hash_t DICT_getDigest(const DICT_buffer * const buf)
 
 size_t DICT_memUsage(const DICT_buffer * const buf)
 {
-    return (1 + buf->async) * buf->size;
+    if (buf->ring.data != NULL)
+        return buf->ring.size;
+    return buf->count * buf->size;
 }
@@ -11,6 +11,7 @@
 #include "fast-lzma2.h"
 #include "mem.h"
 #include "data_block.h"
+#include "fl2_mmap.h"
 #ifndef NO_XXHASH
 #  include "xxhash.h"
 #endif
@@ -22,15 +23,28 @@
 extern "C" {
 #endif
 
+#define DICT_MAX_BUFFERS FL2_DICT_BUFFERS_MAX
+
 /* DICT_buffer structure.
- * Maintains one or two dictionary buffers. In a dual dict configuration (asyc==1), when the
- * current buffer is full, the overlap region will be copied to the other buffer and it
- * becomes the destination for input while the first is compressed. This is useful when I/O
- * is much slower than compression. */
+ * Maintains a ring of one or more dictionary buffers. With more than one, when the current
+ * buffer is full, the overlap region will be copied to the next buffer and it becomes the
+ * destination for input while the first is compressed. This is useful when I/O is much slower
+ * than compression. With three or more, full buffers can be queued while the compressor is
+ * busy or its output is not yet read, so input is accepted until every buffer is in use.
+ * In mirrored mode the buffers are windows into one ring mapping. A shift advances the
+ * window to the start of the overlap instead of copying it, and data preceding the window of
+ * the oldest buffer in use can be retained for matches beyond the block start. */
 typedef struct {
-    BYTE* data[2];
-    size_t index;
-    size_t async;
+    BYTE* data[DICT_MAX_BUFFERS];
+    FL2_ringMapping ring; /* ring.data != NULL in mirrored mode */
+    size_t count;  /* number of buffers in the ring */
+    size_t index;  /* buffer receiving input */
+    size_t queued; /* number of full buffers preceding index waiting for compression */
+    size_t busy;   /* 1 if the buffer preceding the queue was passed to the compressor */
+    size_t queue_start[DICT_MAX_BUFFERS]; /* start of new data in each queued buffer */
+    size_t pos[DICT_MAX_BUFFERS]; /* stream position of each buffer since the last dict reset */
+    size_t block_pos; /* stream position of the last block from DICT_getBlock() */
+    size_t retain; /* bytes preserved before the window of a block in use */
     size_t overlap;
     size_t start;  /* start = 0 (first block) or overlap */
     size_t end;    /* never < overlap */
@@ -42,9 +56,10 @@ typedef struct {
 #endif
 } DICT_buffer;
 
-int DICT_construct(DICT_buffer *const buf, int const async);
+int DICT_construct(DICT_buffer *const buf, unsigned const nb_buffers);
 
-int DICT_init(DICT_buffer *const buf, size_t const dict_size, size_t const overlap, unsigned const reset_multiplier, int const do_hash);
+int DICT_init(DICT_buffer *const buf, size_t const dict_size, size_t const overlap, unsigned const reset_multiplier, int const do_hash,
+    int const mirror, size_t const history);
 
 void DICT_destruct(DICT_buffer *const buf);
 
@@ -56,18 +71,28 @@ int DICT_update(DICT_buffer *const buf, size_t const added_size);
 
 void DICT_put(DICT_buffer *const buf, FL2_inBuffer* const input);
 
+void DICT_putV(DICT_buffer *const buf, FL2_inVector* const input);
+
 size_t DICT_availSpace(const DICT_buffer *const buf);
 
 int DICT_hasUnprocessed(const DICT_buffer *const buf);
 
 void DICT_getBlock(DICT_buffer *const buf, FL2_dataBlock *const block);
 
+size_t DICT_blockPos(const DICT_buffer *const buf);
+
+size_t DICT_retained(const DICT_buffer *const buf);
+
 int DICT_needShift(DICT_buffer *const buf);
 
 int DICT_async(const DICT_buffer *const buf);
 
 void DICT_shift(DICT_buffer *const buf);
 
+int DICT_canQueue(const DICT_buffer *const buf);
+
+void DICT_queue(DICT_buffer *const buf);
+
 #ifndef NO_XXHASH
 XXH32_hash_t DICT_getDigest(const DICT_buffer *const buf);
 #endif
@@ -68,6 +68,7 @@ FL2LIB_API const char* FL2LIB_CALL FL2_versionString(void);
 
 
 #define FL2_MAXTHREADS 200
+#define FL2_DICT_BUFFERS_MAX 8
 
 
 /***************************************
@@ -136,6 +137,21 @@ FL2LIB_API int         FL2LIB_CALL FL2_maxHighCLevel(void);           /*!< maxim
 *  Explicit memory management
 ***************************************/
 
+/*= Shared thread pool
+ *  By default each multithreaded context creates its own threads. Contexts attached to a shared
+ *  pool instead queue their jobs on the pool's threads, which serve the contexts with waiting
+ *  jobs in turn. Create the pool once with as many threads as there are cores, and attach any
+ *  number of contexts to it with FL2_setCCtxThreadPool(), FL2_setDCtxThreadPool() and
+ *  FL2_setDStreamThreadPool(). A context's own thread count still determines how its work is
+ *  divided. The extra thread of a dual-buffered CStream, and the one used for DStream timeouts,
+ *  remain private to each context because they wait for the pool's jobs.
+ *  FL2_freeThreadPool() may be called while contexts are attached. The threads exit once the
+ *  pool is freed and all attached contexts are freed or detached.
+ *  Returns NULL if the library is compiled for single-threaded operation. */
+typedef struct FL2_threadPool_s FL2_threadPool;
+FL2LIB_API FL2_threadPool* FL2LIB_CALL FL2_createThreadPool(unsigned nbThreads);
+FL2LIB_API void            FL2LIB_CALL FL2_freeThreadPool(FL2_threadPool* pool);
+
 /*= Compression context
  *  When compressing many times, it is recommended to allocate a context just once,
  *  and re-use it for each successive compression operation. This will make workload
@@ -149,6 +165,13 @@ FL2LIB_API void      FL2LIB_CALL FL2_freeCCtx(FL2_CCtx* cctx);
 
 FL2LIB_API unsigned FL2LIB_CALL FL2_getCCtxThreadCount(const FL2_CCtx* cctx);
 
+/*! FL2_setCCtxThreadPool() :
+ *  Runs the context's jobs on the threads of `pool`, with at most `maxThreads` of them at once in
+ *  addition to the calling thread. Zero means the context's thread count less one. Pass NULL to
+ *  return to private threads. Has no effect on a single-threaded context.
+ *  Returns 0, or an error if a stream is in progress or allocation failed. */
+FL2LIB_API size_t FL2LIB_CALL FL2_setCCtxThreadPool(FL2_CCtx* cctx, FL2_threadPool* pool, unsigned maxThreads);
+
 /*! FL2_compressCCtx() :
  *  Same as FL2_compress(), but requires an allocated FL2_CCtx (see FL2_createCCtx()). */
 FL2LIB_API size_t FL2LIB_CALL FL2_compressCCtx(FL2_CCtx* cctx,
@@ -156,12 +179,44 @@ FL2LIB_API size_t FL2LIB_CALL FL2_compressCCtx(FL2_CCtx* cctx,
     const void* src, size_t srcSize,
     int compressionLevel);
 
+/*! FL2_compressFile() :
+ *  Compresses the whole file open for reading as `srcFd` and writes the stream to `dstFd`.
+ *  The source is memory-mapped and compressed in place, so input is never copied. Pages of
+ *  the next block are requested ahead of use and pages behind the current block are released,
+ *  which keeps resident memory near the dictionary size regardless of file size.
+ *  Output is written from the encoder's buffers as each block completes.
+ *  The FL2_p_groupMemoryBudget parameter does not apply.
+ *  @return : number of bytes written to `dstFd`, or an error code. FL2_error_io is returned if
+ *            the source can't be mapped or a write fails. */
+FL2LIB_API size_t FL2LIB_CALL FL2_compressFile(FL2_CCtx* cctx,
+    int dstFd, int srcFd,
+    int compressionLevel);
+
 /*! FL2_getCCtxDictProp() :
  *  Get the dictionary size property.
  *  Intended for use with the FL2_p_omitProperties parameter for creating a
  *  7-zip or XZ compatible LZMA2 stream. */
 FL2LIB_API unsigned char FL2LIB_CALL FL2_getCCtxDictProp(FL2_CCtx* cctx);
 
+/*! FL2_getCCtxCheckpointIndex() :
+ *  Copies the checkpoint index of the last FL2_compressCCtx() or FL2_compressFile() call into dst.
+ *  See FL2_p_checkpointLog. The index is not part of the stream; store it alongside and pass it
+ *  to FL2_decompressDCtxIndexed().
+ *  @return : size of the index, which is 0 if no checkpoints were written, or an error code if
+ *            dstCapacity is too small. Call with dst == NULL and dstCapacity == 0 to get the size. */
+FL2LIB_API size_t FL2LIB_CALL FL2_getCCtxCheckpointIndex(const FL2_CCtx* cctx, void* dst, size_t dstCapacity);
+
+/*! FL2_getCCtxFrameIndex() :
+ *  Copies the frame index of the last frame compressed by cctx into dst. The index lists the
+ *  compressed and uncompressed position of every dictionary reset and of the end marker, so
+ *  readers can size the output, assign blocks to threads and seek without parsing the stream.
+ *  The index is not part of the stream, which decodes as before without it; store it alongside.
+ *  Written by FL2_compressCCtx(), FL2_compressFile() and streaming compression. A stream's index
+ *  is complete once FL2_endStream() has written the end marker.
+ *  @return : size of the index, or an error code if dstCapacity is too small or the stream is
+ *            not ended. Call with dst == NULL and dstCapacity == 0 to get the size. */
+FL2LIB_API size_t FL2LIB_CALL FL2_getCCtxFrameIndex(const FL2_CCtx* cctx, void* dst, size_t dstCapacity);
+
 
 /****************************
 *  Decompression
@@ -184,6 +239,20 @@ FL2LIB_API size_t    FL2LIB_CALL FL2_freeDCtx(FL2_DCtx* dctx);
 
 FL2LIB_API unsigned FL2LIB_CALL FL2_getDCtxThreadCount(const FL2_DCtx* dctx);
 
+/*! FL2_setDCtxThreadPool() :
+ *  Same as FL2_setCCtxThreadPool() for a decompression context.
+ *  Returns 0, or an error if allocation failed. */
+FL2LIB_API size_t FL2LIB_CALL FL2_setDCtxThreadPool(FL2_DCtx* dctx, FL2_threadPool* pool, unsigned maxThreads);
+
+
+/*! FL2_setDCtxProbBits() :
+ *  Sets the width in bits of the decoder's probability counters: 16, 32 (the default), or 0 for
+ *  automatic selection. 16-bit counters halve the size of the probability table, which may
+ *  reduce cache pressure when lc + lp is large or many contexts decode concurrently. 32-bit
+ *  counters can be faster on some CPUs. Automatic selection uses 16 bits if the 32-bit table
+ *  would exceed 32 KiB, i.e. when lc + lp == 4. Output is identical in all modes.
+ *  Returns 0, or an error if bits is not 0, 16 or 32. */
+FL2LIB_API size_t FL2LIB_CALL FL2_setDCtxProbBits(FL2_DCtx* dctx, unsigned bits);
 
 /*! FL2_initDCtx() :
  *  Use only when a property byte is not present at input byte 0. No init is necessary otherwise.
@@ -196,6 +265,155 @@ FL2LIB_API size_t FL2LIB_CALL FL2_decompressDCtx(FL2_DCtx* cctx,
     void* dst, size_t dstCapacity,
     const void* src, size_t srcSize);
 
+/*! FL2_decompressDCtxIndexed() :
+ *  Same as FL2_decompressDCtx(), but uses a checkpoint index from FL2_getCCtxCheckpointIndex()
+ *  to divide blocks between threads as well as at dictionary resets. The look-back data of each
+ *  checkpoint used is copied from the index into dst before decoding begins. Checkpoints that
+ *  don't match the stream, or whose look-back reaches into the previous checkpoint's block, are
+ *  skipped. The index must come from compression of the same data; if the stream has an xxhash
+ *  the result is verified. Decoding is serial if dctx has one thread or index is NULL.
+ *  The index may instead be a frame index from FL2_getCCtxFrameIndex(), in which case the
+ *  dictionary reset blocks are assigned to threads directly, without parsing chunk headers. */
+FL2LIB_API size_t FL2LIB_CALL FL2_decompressDCtxIndexed(FL2_DCtx* dctx,
+    void* dst, size_t dstCapacity,
+    const void* src, size_t srcSize,
+    const void* index, size_t indexSize);
+
+/*! FL2_decompressFile() :
+ *  Decompresses the whole stream in the file open for reading as `srcFd` into the file open
+ *  for reading and writing as `dstFd`. The source is memory-mapped, and the destination is
+ *  resized to the decompressed size and mapped as well. In a multithreaded context each
+ *  dictionary reset block is decoded by a pool thread straight into its region of the mapped
+ *  output, so neither input nor output is copied. The stream must start with its property
+ *  byte, so FL2_initDCtx() is not supported with this function.
+ *  If decompression fails after the destination is resized, it is truncated to zero length.
+ *  @return : decompressed size, or an error code. FL2_error_io is returned if either file
+ *            can't be resized or mapped. */
+FL2LIB_API size_t FL2LIB_CALL FL2_decompressFile(FL2_DCtx* dctx, int dstFd, int srcFd);
+
+/*! FL2_decompressDCtxBatch() :
+ *  Decompresses nbFrames independent frames, each complete in memory and starting with its
+ *  property byte. Frame n is read from srcs[n] (srcSizes[n] bytes) and written to dsts[n]
+ *  (dstCapacities[n] bytes). results[n] receives the decompressed size of frame n, or an error code.
+ *  The decoder state of dctx is reused for every frame, so this is much cheaper than one call per
+ *  frame when frames are small. If dctx was created with more than one thread, frames are
+ *  distributed across its threads, each decoding whole frames.
+ *  Returns 0 if all frames were decompressed, or the error code of the first failed frame. */
+FL2LIB_API size_t FL2LIB_CALL FL2_decompressDCtxBatch(FL2_DCtx* dctx,
+    void* const* dsts, const size_t* dstCapacities,
+    const void* const* srcs, const size_t* srcSizes,
+    size_t* results, size_t nbFrames);
+
+/*! FL2_decompressRange() :
+ *  Decompresses up to dstCapacity bytes of a frame's content starting at content position offset.
+ *  Decoding begins at the last dictionary reset at or before offset, so the cost depends on the
+ *  distance from that reset rather than on the offset itself (see FL2_p_resetInterval). Output
+ *  before offset is discarded. The frame must be complete in memory. The xxhash, if present, is
+ *  not verified because it covers the whole frame.
+ *  Returns the number of bytes written, which is less than dstCapacity only if the frame ends
+ *  first, or an error code. */
+FL2LIB_API size_t FL2LIB_CALL FL2_decompressRange(FL2_DCtx* dctx,
+    void* dst, size_t dstCapacity,
+    const void* src, size_t srcSize,
+    unsigned long long offset);
+
+/*! FL2_decompressRangeIndexed() :
+ *  Same as FL2_decompressRange(), but finds the dictionary reset in a frame index from
+ *  FL2_getCCtxFrameIndex() instead of parsing the chunk headers before it. */
+FL2LIB_API size_t FL2LIB_CALL FL2_decompressRangeIndexed(FL2_DCtx* dctx,
+    void* dst, size_t dstCapacity,
+    const void* src, size_t srcSize,
+    unsigned long long offset,
+    const void* index, size_t indexSize);
+
+/*! FL2_findDecompressedSizeIndexed() :
+ *  Returns the decompressed size recorded in a frame index from FL2_getCCtxFrameIndex(), or
+ *  FL2_CONTENTSIZE_ERROR if the index is invalid. The same caution as for
+ *  FL2_findDecompressedSize() applies to untrusted input. */
+FL2LIB_API unsigned long long FL2LIB_CALL FL2_findDecompressedSizeIndexed(const void* index, size_t indexSize);
+
+typedef struct {
+    unsigned long long packPos;     /**< position of the block's first chunk, excluding the property byte */
+    unsigned long long packSize;
+    unsigned long long unpackPos;
+    unsigned long long unpackSize;
+} FL2_blockInfo;
+
+/*! FL2_getIndexBlocks() :
+ *  Lists the dictionary reset blocks of a frame index from FL2_getCCtxFrameIndex(). Each block
+ *  decodes independently. Up to maxBlocks entries are written to blocks, which may be NULL.
+ *  The end marker follows the last block.
+ *  @return : the number of blocks in the frame, or an error code if the index is invalid. */
+FL2LIB_API size_t FL2LIB_CALL FL2_getIndexBlocks(const void* index, size_t indexSize,
+    FL2_blockInfo* blocks, size_t maxBlocks);
+
+/****************************
+*  Seekable container
+****************************/
+
+/* A seekable container is the LE32 magic number FL2_SEEKABLE_HEADER_MAGIC, then a series of
+ * independent frames, each a complete stream with its property byte, end marker and xxhash if
+ * enabled, followed by a seek table: for each frame the LE32 compressed and LE32 decompressed
+ * size, then the LE32 frame count and the LE32 magic number FL2_SEEKABLE_MAGIC.
+ * A container is NOT a stream. Its first byte is an invalid property byte, so FL2_decompress(),
+ * FL2_findDecompressedSize() and the stream decoder reject it rather than returning only the
+ * first frame. Read it with FL2_initSeekable() and FL2_readSeekable(). */
+#define FL2_SEEKABLE_HEADER_MAGIC 0x32534CFFU
+#define FL2_SEEKABLE_MAGIC 0x53324C46U
+#define FL2_SEEKABLE_FRAME_MAX (1U << 30)
+#define FL2_SEEKABLE_FRAME_DEFAULT (1U << 22)
+#define FL2_SEEKABLE_CACHE_DEFAULT 4
+
+/*! FL2_seekableBound() :
+ *  Maximum size of a container holding srcSize bytes in frames of frameSize (0 = default). */
+FL2LIB_API size_t FL2LIB_CALL FL2_seekableBound(size_t srcSize, size_t frameSize);
+
+/*! FL2_compressSeekable() :
+ *  Compresses src into a seekable container of frames holding frameSize bytes each, or
+ *  FL2_SEEKABLE_FRAME_DEFAULT if frameSize is 0. Each frame is compressed by FL2_compressCCtx()
+ *  with the current parameters of cctx. Smaller frames give faster random access and a lower
+ *  compression ratio.
+ *  @return : compressed size, or an error code */
+FL2LIB_API size_t FL2LIB_CALL FL2_compressSeekable(FL2_CCtx* cctx,
+    void* dst, size_t dstCapacity,
+    const void* src, size_t srcSize,
+    size_t frameSize);
+
+typedef struct FL2_seekable_s FL2_seekable;
+
+/*! FL2_createSeekable() :
+ *  Creates a reader which decodes frames with nbThreads threads (0 = all cores) and keeps the
+ *  last cacheFrames decoded frames (0 = FL2_SEEKABLE_CACHE_DEFAULT) for reuse by later reads.
+ *  A reader must not be used by more than one thread at a time. */
+FL2LIB_API FL2_seekable* FL2LIB_CALL FL2_createSeekable(unsigned nbThreads, unsigned cacheFrames);
+FL2LIB_API size_t FL2LIB_CALL FL2_freeSeekable(FL2_seekable* fs);
+
+/*! FL2_initSeekable() :
+ *  Opens the container in src, which must remain valid and unchanged until the reader is freed
+ *  or opened again. Only the seek table is read.
+ *  @return : 0, or an error code if the seek table is missing or invalid. */
+FL2LIB_API size_t FL2LIB_CALL FL2_initSeekable(FL2_seekable* fs, const void* src, size_t srcSize);
+
+/*! FL2_initSeekableFile() :
+ *  Opens the container in the file open for reading as fd, which is memory-mapped until the
+ *  reader is freed or opened again. Only the pages of frames read are loaded.
+ *  @return : 0, or an error code. */
+FL2LIB_API size_t FL2LIB_CALL FL2_initSeekableFile(FL2_seekable* fs, int fd);
+
+/*! FL2_getSeekableContentSize() :
+ *  Total decompressed size of the open container. */
+FL2LIB_API unsigned long long FL2LIB_CALL FL2_getSeekableContentSize(const FL2_seekable* fs);
+
+/*! FL2_readSeekable() :
+ *  Decompresses size bytes starting at content position offset into dst. Only the frames
+ *  overlapping the range are decoded, and frames in the cache are not decoded again. Whole
+ *  frames inside the range are decoded straight into dst, bypassing the cache.
+ *  @return : the number of bytes written, which is less than size only at the end of the
+ *            content, or an error code. */
+FL2LIB_API size_t FL2LIB_CALL FL2_readSeekable(FL2_seekable* fs,
+    void* dst, size_t size,
+    unsigned long long offset);
+
 /****************************
 *  Streaming
 ****************************/
@@ -212,6 +430,18 @@ typedef struct {
     size_t pos;         /**< position where writing stopped. Will be updated. Necessarily 0 <= pos <= size */
 } FL2_outBuffer;
 
+typedef struct {
+    const void* src;    /**< start of segment */
+    size_t size;        /**< size of segment */
+} FL2_inSegment;
+
+typedef struct {
+    const FL2_inSegment* segs;  /**< array of input segments */
+    size_t nbSegs;      /**< number of segments */
+    size_t index;       /**< segment where reading stopped. Will be updated. Necessarily 0 <= index <= nbSegs */
+    size_t pos;         /**< position where reading stopped in segs[index]. Will be updated. */
+} FL2_inVector;
+
 /*** Push/pull structs ***/
 
 typedef struct {
@@ -236,6 +466,10 @@ typedef struct {
  *  Call FL2_createCStreamMt() with a nonzero dualBuffer parameter to use two input dictionary buffers.
  *  The stream will not block on FL2_compressStream() and continues to accept data while compression is
  *  underway, until both buffers are full. Useful when I/O is slow.
+ *  A dualBuffer value from 3 to FL2_DICT_BUFFERS_MAX creates a ring of that many buffers. Full buffers
+ *  are queued while the previous block is compressed and its output read, so input keeps flowing
+ *  until all buffers are in use. Each buffer is the dictionary size, and the total is included in
+ *  the FL2_estimateCStreamSize() functions.
  *  To compress with a single thread with dual buffering, call FL2_createCStreamMt with nbThreads=1.
  *
  *  Use FL2_initCStream() on the FL2_CStream object to start a new compression operation.
@@ -295,6 +529,15 @@ FL2LIB_API size_t FL2LIB_CALL FL2_setCStreamTimeout(FL2_CStream * fcs, unsigned
  *  Returns 1 to indicate compressed data must be read (or output is full), or 0 otherwise. */
 FL2LIB_API size_t FL2LIB_CALL FL2_compressStream(FL2_CStream* fcs, FL2_outBuffer *output, FL2_inBuffer* input);
 
+/*! FL2_compressStreamV() :
+ *  Same as FL2_compressStream(), but reads from a sequence of discontiguous segments. All segments
+ *  are copied into the dictionary buffer in one call, or as many as fit before the compressor must
+ *  be waited on, which avoids per-call overhead when appending many small buffers. Empty segments
+ *  are allowed. On return, input->index and input->pos give the next byte to be read, and
+ *  input->index == input->nbSegs when all input was consumed. Returns FL2_error_srcSize_wrong
+ *  if input->index or input->pos lies outside the segments. */
+FL2LIB_API size_t FL2LIB_CALL FL2_compressStreamV(FL2_CStream* fcs, FL2_outBuffer *output, FL2_inVector* input);
+
 /*! FL2_copyCStreamOutput() :
  *  Copies compressed data to the output buffer until the buffer is full or all available data is copied.
  *  If asynchronous compression is in progress, the function returns 0 without waiting.
@@ -387,14 +630,40 @@ FL2LIB_API FL2_DStream* FL2LIB_CALL FL2_createDStream(void);
 FL2LIB_API FL2_DStream* FL2LIB_CALL FL2_createDStreamMt(unsigned nbThreads);
 FL2LIB_API size_t FL2LIB_CALL FL2_freeDStream(FL2_DStream* fds);
 
+/*! FL2_setDStreamThreadPool() :
+ *  Runs MT block decoding on the threads of `pool`, with at most `maxThreads` blocks decoded at
+ *  once. Zero means the stream's thread count. Pass NULL to return to private threads. Has no
+ *  effect on a single-threaded stream.
+ *  Returns 0, or an error if blocks are being decoded or allocation failed. */
+FL2LIB_API size_t FL2LIB_CALL FL2_setDStreamThreadPool(FL2_DStream* fds, FL2_threadPool* pool, unsigned maxThreads);
+
 /*! FL2_setDStreamMemoryLimitMt() :
  *  Set a total size limit for multithreaded decoder input and output buffers. MT decoder memory
- *  usage is unknown until the input is parsed. If the limit is exceeded, the decoder switches to
- *  using a single thread.
+ *  usage is unknown until the input is parsed. When the limit is reached, the decoder reduces the
+ *  number of blocks decoded concurrently, and raises it again as buffers are released. If even one
+ *  block does not fit, the decoder switches to using a single thread for the rest of the stream.
  *  MT decoding memory usage is typically dictionary_size * 4 * nbThreads for the output
- *  buffers plus the size of the compressed input for that amount of output. */
+ *  buffers plus the size of the compressed input for that amount of output.
+ *  Output buffers are kept for reuse by later blocks and streams, and count toward the limit
+ *  until the stream is freed or the limit is lowered. The limit may be changed between calls to
+ *  FL2_decompressStream(), e.g. to share a memory budget among several streams. */
 FL2LIB_API void FL2LIB_CALL FL2_setDStreamMemoryLimitMt(FL2_DStream* fds, size_t limit);
 
+typedef struct {
+    size_t memoryUsed;      /**< memory held for MT input and output buffers, including buffers kept for reuse */
+    size_t memoryLimit;     /**< limit set by FL2_setDStreamMemoryLimitMt() */
+    unsigned nbThreads;     /**< decoder threads */
+    unsigned activeJobs;    /**< blocks being decoded or waiting to be written out */
+    unsigned jobLimit;      /**< blocks allowed in progress at the current memory usage */
+    unsigned maxJobs;       /**< blocks allowed in progress without memory pressure */
+    unsigned singleThread;  /**< nonzero if the stream is decoded by a single thread */
+} FL2_DStreamMemory;
+
+/*! FL2_getDStreamMemoryUsage() :
+ *  Reports the memory usage and concurrency of the decoder. Call only between calls to
+ *  FL2_decompressStream(), and after FL2_waitDStream() if a timeout occurred. */
+FL2LIB_API void FL2LIB_CALL FL2_getDStreamMemoryUsage(const FL2_DStream* fds, FL2_DStreamMemory* usage);
+
 /*! FL2_setDStreamTimeout() :
  *  Sets a timeout in milliseconds. Zero disables the timeout. If a nonzero timout is set,
  *  FL2_decompressStream() may return a timeout code before decompression of the available data
@@ -404,6 +673,41 @@ FL2LIB_API void FL2LIB_CALL FL2_setDStreamMemoryLimitMt(FL2_DStream* fds, size_t
  *  decompression progress. */
 FL2LIB_API size_t FL2LIB_CALL FL2_setDStreamTimeout(FL2_DStream * fds, unsigned timeout);
 
+/*! FL2_setDStreamProbBits() :
+ *  Same as FL2_setDCtxProbBits() for a DStream. Returns 0, or an error if bits is invalid or the
+ *  stream object is still in use. */
+FL2LIB_API size_t FL2LIB_CALL FL2_setDStreamProbBits(FL2_DStream * fds, unsigned bits);
+
+/*! FL2_setDStreamResidentOutput() :
+ *  Enables or disables resident output mode, which takes effect on the next stream initialization.
+ *  In this mode the single-threaded decoder uses the caller's output buffer as its dictionary,
+ *  eliminating the copy from an internal dictionary. The caller must pass the same buffer (dst and
+ *  size) on every call for the stream, must not modify decoded data, and may reset pos to zero
+ *  only after the buffer is filled (i.e. use it as a ring buffer). The buffer is used directly
+ *  only if its size is at least the dictionary size; otherwise normal decoding is used.
+ *  The MT decoder decodes each block in place if the buffer has room for it after the data
+ *  still pending, and uses its own buffers for the others. Decoder threads may write beyond pos
+ *  until the stream is finished, reinitialized or freed, so the buffer must stay valid until then.
+ *  Returns 0, or an error if the stream object is still in use. */
+FL2LIB_API size_t FL2LIB_CALL FL2_setDStreamResidentOutput(FL2_DStream * fds, unsigned resident);
+
+/*! FL2_setDStreamResidentInput() :
+ *  Enables or disables resident input mode, which takes effect on the next stream initialization.
+ *  In this mode the MT decoder reads compressed data directly from the caller's input buffers
+ *  instead of copying it. Only a few bytes where buffers join, and inputs smaller than 64 KiB,
+ *  are copied. Input consumed by FL2_decompressStream() must stay valid and unchanged until
+ *  FL2_getDStreamInputReleased() reports it released.
+ *  Not applicable to single-threaded decoding, which never retains input.
+ *  Returns 0, or an error if the stream object is still in use. */
+FL2LIB_API size_t FL2LIB_CALL FL2_setDStreamResidentInput(FL2_DStream * fds, unsigned resident);
+
+/*! FL2_getDStreamInputReleased() :
+ *  Returns the number of bytes of input consumed since stream initialization that the decoder
+ *  no longer references. Input consumed before this point may be reused or freed. This is the
+ *  total consumed unless resident input mode is enabled. Call only between calls to
+ *  FL2_decompressStream(), and after FL2_waitDStream() if a timeout occurred. */
+FL2LIB_API unsigned long long FL2LIB_CALL FL2_getDStreamInputReleased(const FL2_DStream * fds);
+
 /*! FL2_waitDStream() :
  *  Waits for decompression to end after a timeout has occurred. This function returns after the
  *  timeout set using FL2_setDStreamTimeout() has elapsed, or when decompression of available input is
@@ -462,6 +766,13 @@ FL2LIB_API size_t FL2LIB_CALL FL2_decompressStream(FL2_DStream* fds, FL2_outBuff
 #define FL2_RESET_INTERVAL_MAX 16  /* small enough to fit FL2_DICTSIZE_MAX * FL2_RESET_INTERVAL_MAX in 32-bit size_t */
 #define FL2_BUFFER_RESIZE_MIN 0
 #define FL2_BUFFER_RESIZE_MAX 4
+#define FL2_GROUP_BUDGET_MAX ((size_t)-1 >> 20)  /* MiB */
+#define FL2_FLUSH_WINDOWLOG_MIN 12
+#define FL2_FLUSH_WINDOWLOG_MAX FL2_DICTLOG_MAX
+#define FL2_CHECKPOINTLOG_MIN 16
+#define FL2_CHECKPOINTLOG_MAX FL2_DICTLOG_MAX
+#define FL2_CHECKPOINT_LOOKBACK_MIN 16
+#define FL2_CHECKPOINT_LOOKBACK_MAX (1U << 24)
 #define FL2_BUFFER_RESIZE_DEFAULT 2
 #define FL2_CHAINLOG_MIN       4
 #define FL2_CHAINLOG_MAX       14
@@ -563,6 +874,64 @@ typedef enum {
                              * after the stream terminator. The value will be checked on decompression.
                              * 0 = do not calculate; 1 = calculate (default) */
 #endif
+    /* Parameters below have fixed values which don't depend on NO_XXHASH */
+    FL2_p_pipelineBlocks = FL2_p_omitProperties + 2,
+                            /* For input larger than the dictionary passed to FL2_compressCCtx() using
+                             * more than one thread. Builds the match table for the next block while
+                             * the current block is encoded, so threads do not idle while the encoders
+                             * finish. Requires a second match table; see FL2_estimateCCtxSize_usingCCtx().
+                             * Output differs slightly because one less thread encodes each block.
+                             * Not supported by FL2_CStream_setParameter().
+                             * Default = 0 */
+    FL2_p_groupMemoryBudget,/* For input larger than dictionarySize * resetInterval passed to FL2_compressCCtx()
+                             * using more than one thread. The data between dictionary resets is
+                             * independent, so several such groups are compressed at once, each on one
+                             * thread with its own match table. The value is the memory budget in MiB
+                             * for all groups in progress, which limits how many run concurrently.
+                             * Scales better than splitting each block between threads on many cores.
+                             * 0 = disabled (default) */
+    FL2_p_flushWindowLog,   /* Low-latency flushing for streaming compression. When FL2_flushStream() or
+                             * FL2_endStream() compresses less than (1 << value) bytes of new data, the
+                             * match table is built over only the preceding (1 << value) bytes plus the
+                             * new data, not the whole block overlap. The stream continues in the same
+                             * dictionary but matches in the flushed data are limited to that window.
+                             * Reduces the cost of frequent small flushes, e.g. one per message.
+                             * Range is FL2_FLUSH_WINDOWLOG_MIN to FL2_FLUSH_WINDOWLOG_MAX.
+                             * 0 = disabled (default) */
+    FL2_p_mirroredDictionary, /* Streaming compression only. Allocate the dictionary buffers as windows
+                             * into one memory region mapped twice in succession, so the block overlap
+                             * is retained by moving the window instead of being copied. Takes effect
+                             * at the next FL2_initCStream(). Where the mapping is not available
+                             * (currently anything but Linux), separate buffers are used.
+                             * 0 = disabled (default) */
+    FL2_p_slidingWindow,    /* Streaming compression only. Keep the data preceding each block in a
+                             * mirrored dictionary (see FL2_p_mirroredDictionary) and index it, so
+                             * matches near the start of a block can reach a full dictionary size back
+                             * instead of only the overlap. Raises the ratio at block boundaries.
+                             * Costs about one extra dictionary size less the overlap, plus an index of
+                             * up to 16 MiB. Has no effect if the mapping is unavailable or with
+                             * FL2_p_overlapFraction = 0.
+                             * 0 = disabled (default) */
+    FL2_p_checkpointLog,    /* For multithreaded decompression of blocks without a dictionary reset.
+                             * FL2_compressCCtx() and FL2_compressFile() reset the encoder state at the
+                             * first chunk after every (1 << value) bytes of each block, and matches from
+                             * there on reach at most FL2_p_checkpointLookback bytes before the chunk.
+                             * The positions and look-back data are recorded in a side index, returned
+                             * by FL2_getCCtxCheckpointIndex(), which FL2_decompressDCtxIndexed() uses
+                             * to split blocks between threads. The stream itself is unchanged in format.
+                             * Costs more ratio than FL2_p_resetInterval with the same piece size, since
+                             * the look-back is all that matches after a checkpoint may use, and the index
+                             * adds to that. Use it only where the stream must stay one dictionary block,
+                             * and compare against FL2_p_resetInterval first (see README.md).
+                             * Ignored by streaming compression.
+                             * Range is FL2_CHECKPOINTLOG_MIN to FL2_CHECKPOINTLOG_MAX.
+                             * 0 = disabled (default) */
+    FL2_p_checkpointLookback, /* Bytes preceding each checkpoint which matches may use. Stored in the
+                             * index, so larger values improve the ratio but enlarge the index.
+                             * Should be smaller than the checkpoint interval, or the decoder can only
+                             * use some of the checkpoints.
+                             * Range is FL2_CHECKPOINT_LOOKBACK_MIN to FL2_CHECKPOINT_LOOKBACK_MAX.
+                             * Default = 65536 */
 #ifdef RMF_REFERENCE
     FL2_p_useReferenceMF    /* Use the reference matchfinder for development purposes. SLOW. */
 #endif
@@ -18,6 +18,8 @@
 #include "fl2_errors.h"
 #include "fl2_internal.h"
 #include "lzma2_enc.h"
+#include "fl2_threading.h"
+#include "fl2_pool.h"
 
 
 /*-****************************************
@@ -36,6 +38,28 @@ FL2LIB_API size_t FL2LIB_CALL FL2_compressBound(size_t srcSize)
 	return LZMA2_compressBound(srcSize);
 }
 
+/*-****************************************
+*  Shared thread pool
+******************************************/
+FL2LIB_API FL2_threadPool* FL2LIB_CALL FL2_createThreadPool(unsigned nbThreads)
+{
+#ifndef FL2_SINGLETHREAD
+    return FL2POOL_createShared(FL2_checkNbThreads(nbThreads));
+#else
+    (void)nbThreads;
+    return NULL;
+#endif
+}
+
+FL2LIB_API void FL2LIB_CALL FL2_freeThreadPool(FL2_threadPool* pool)
+{
+#ifndef FL2_SINGLETHREAD
+    FL2POOL_releaseShared(pool);
+#else
+    (void)pool;
+#endif
+}
+
 /*-****************************************
 *  FL2 Error Management
 ******************************************/
@@ -99,6 +123,7 @@ FL2LIB_API const char* FL2LIB_CALL FL2_getErrorString(FL2_ErrorCode code)
     case PREFIX(canceled): return "Processing was canceled by a call to FL2_cancelCStream() or FL2_cancelDStream()";
     case PREFIX(buffer): return "Streaming progress halted due to buffer(s) full/empty";
     case PREFIX(timedOut): return "Wait timed out. Timeouts should be handled before errors using FL2_isTimedOut()";
+    case PREFIX(io): return "File read, write or mapping failed";
         /* following error codes are not stable and may be removed or changed in a future version */
     case PREFIX(maxCode):
     default: return notErrorCode;
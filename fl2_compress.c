@@ -21,6 +21,10 @@
 #include "fl2_pool.h"
 #include "radix_mf.h"
 #include "lzma2_enc.h"
+#include "fl2_mmap.h"
+#ifndef NO_XXHASH
+#  include "xxhash.h"
+#endif
 
 #define FL2_MAX_LOOPS 10U
 
@@ -135,6 +139,14 @@ static void FL2_fillParameters(FL2_CCtx* const cctx, const FL2_compressionParame
 #endif
 }
 
+/* dualBuffer 0 and 1 mean one or two buffers as before. Larger values set the ring size. */
+static unsigned FL2_dictBufferCount(int const dualBuffer)
+{
+    if (dualBuffer <= 0)
+        return 1;
+    return MAX(2, MIN((unsigned)dualBuffer, FL2_DICT_BUFFERS_MAX));
+}
+
 static FL2_CCtx* FL2_createCCtx_internal(unsigned nbThreads, int const dualBuffer)
 {
     nbThreads = FL2_checkNbThreads(nbThreads);
@@ -156,6 +168,8 @@ static FL2_CCtx* FL2_createCCtx_internal(unsigned nbThreads, int const dualBuffe
     cctx->matchTable = NULL;
 
 #ifndef FL2_SINGLETHREAD
+    cctx->pipeTable = NULL;
+    cctx->groups = NULL;
     cctx->compressThread = NULL;
     cctx->factory = FL2POOL_create(nbThreads - 1);
     if (nbThreads > 1 && cctx->factory == NULL) {
@@ -178,10 +192,11 @@ static FL2_CCtx* FL2_createCCtx_internal(unsigned nbThreads, int const dualBuffe
         cctx->jobs[u].cctx = cctx;
     }
 
-    DICT_construct(&cctx->buf, dualBuffer);
+    DICT_construct(&cctx->buf, FL2_dictBufferCount(dualBuffer));
 
     FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, FL2_CLEVEL_DEFAULT);
     cctx->params.cParams.reset_interval = 4;
+    cctx->params.checkpointLookback = (size_t)1 << 16;
 
     return cctx;
 }
@@ -212,9 +227,20 @@ FL2LIB_API void FL2LIB_CALL FL2_freeCCtx(FL2_CCtx* cctx)
 #ifndef FL2_SINGLETHREAD
     FL2POOL_free(cctx->factory);
     FL2POOL_free(cctx->compressThread);
+    RMF_freeMatchTable(cctx->pipeTable);
+    if (cctx->groups != NULL) {
+        for (unsigned u = 0; u < cctx->jobCount; ++u) {
+            FL2_freeCCtx(cctx->groups[u].cctx);
+            free(cctx->groups[u].outBuf);
+        }
+        free(cctx->groups);
+    }
 #endif
 
     RMF_freeMatchTable(cctx->matchTable);
+    LZMA2_freeHistory(cctx->history);
+    free(cctx->cpIndex);
+    free(cctx->frameIndex);
     free(cctx);
 }
 
@@ -223,6 +249,20 @@ FL2LIB_API unsigned FL2LIB_CALL FL2_getCCtxThreadCount(const FL2_CCtx* cctx)
     return cctx->jobCount;
 }
 
+FL2LIB_API size_t FL2LIB_CALL FL2_setCCtxThreadPool(FL2_CCtx* cctx, FL2_threadPool* pool, unsigned maxThreads)
+{
+    if (cctx->lockParams)
+        return FL2_ERROR(stage_wrong);
+#ifndef FL2_SINGLETHREAD
+    /* The calling thread does the first job */
+    if (FL2POOL_rebind(&cctx->factory, pool, cctx->jobCount - 1, maxThreads))
+        return FL2_ERROR(memory_allocation);
+#else
+    (void)pool, (void)maxThreads;
+#endif
+    return FL2_error_no_error;
+}
+
 /* FL2_buildRadixTable() : FL2POOL_function type */
 static void FL2_buildRadixTable(void* const jobDescription, ptrdiff_t const n)
 {
@@ -240,7 +280,8 @@ static void FL2_compressRadixChunk(void* const jobDescription, ptrdiff_t const n
         cctx->jobs[n].block,
         &cctx->params.cParams,
         -1,
-        &cctx->progressIn, &cctx->progressOut, &cctx->canceled);
+        &cctx->progressIn, &cctx->progressOut, &cctx->canceled,
+        cctx->jobs[n].outBuf, cctx->jobs[n].outCapacity, cctx->curHistory);
 }
 
 static int FL2_initEncoders(FL2_CCtx* const cctx)
@@ -261,20 +302,19 @@ static void FL2_initProgress(FL2_CCtx* const cctx)
     cctx->canceled = 0;
 }
 
-/* FL2_compressCurBlock_blocking() :
- * Compress cctx->curBlock and wait until complete.
- * Write streamProp as the first byte if >= 0
+/* FL2_sliceCurBlock() :
+ * Divide cctx->curBlock into slices for up to maxThreads encoders.
+ * Return the number of slices.
  */
-static size_t FL2_compressCurBlock_blocking(FL2_CCtx* const cctx, int const streamProp)
+static size_t FL2_sliceCurBlock(FL2_CCtx* const cctx, size_t const maxThreads)
 {
     size_t const encodeSize = (cctx->curBlock.end - cctx->curBlock.start);
 #ifndef FL2_SINGLETHREAD
-    size_t mfThreads = cctx->curBlock.end / RMF_MIN_BYTES_PER_THREAD;
-    size_t nbThreads = MIN(cctx->jobCount, encodeSize / ENC_MIN_BYTES_PER_THREAD);
+    size_t nbThreads = MIN(maxThreads, encodeSize / ENC_MIN_BYTES_PER_THREAD);
     nbThreads += !nbThreads;
 #else
-    size_t mfThreads = 1;
-    size_t nbThreads = 1;
+    size_t const nbThreads = 1;
+    (void)maxThreads;
 #endif
 
     DEBUGLOG(5, "FL2_compressCurBlock : %u threads, %u start, %u bytes", (U32)nbThreads, (U32)cctx->curBlock.start, (U32)encodeSize);
@@ -293,6 +333,45 @@ static size_t FL2_compressCurBlock_blocking(FL2_CCtx* const cctx, int const stre
     }
     cctx->jobs[nbThreads - 1].block.end = cctx->curBlock.end;
 
+    /* Each slice is encoded straight into the caller's buffer at the sum of the worst cases of the
+     * slices before it, if its own worst case fits after that. The output is compacted when written.
+     * Slices beyond the capacity are staged in the match table. */
+    size_t outPos = 0;
+    for (size_t u = 0; u < nbThreads; ++u) {
+        size_t const bound = LZMA2_compressBound(cctx->jobs[u].block.end - cctx->jobs[u].block.start);
+        cctx->jobs[u].outBuf = NULL;
+        cctx->jobs[u].outCapacity = 0;
+        if (cctx->outDirect != NULL && cctx->outDirectCapacity - outPos >= bound) {
+            cctx->jobs[u].outBuf = cctx->outDirect + outPos;
+            cctx->jobs[u].outCapacity = bound;
+            outPos += bound;
+        }
+        else {
+            outPos = cctx->outDirectCapacity;
+        }
+    }
+    /* The last slice written directly can use the remaining capacity */
+    for (size_t u = nbThreads; u > 0; --u) {
+        if (cctx->jobs[u - 1].outBuf != NULL) {
+            cctx->jobs[u - 1].outCapacity = cctx->outDirectCapacity - (size_t)(cctx->jobs[u - 1].outBuf - cctx->outDirect);
+            break;
+        }
+    }
+
+    return nbThreads;
+}
+
+/* FL2_buildCurTable() :
+ * Build the match table for cctx->curBlock using all threads.
+ */
+static size_t FL2_buildCurTable(FL2_CCtx* const cctx)
+{
+#ifndef FL2_SINGLETHREAD
+    size_t mfThreads = cctx->curBlock.end / RMF_MIN_BYTES_PER_THREAD;
+#else
+    size_t const mfThreads = 1;
+#endif
+
     /* initialize to length 2 */
     RMF_initTable(cctx->matchTable, cctx->curBlock.data, cctx->curBlock.end);
 
@@ -311,8 +390,8 @@ static size_t FL2_compressCurBlock_blocking(FL2_CCtx* const cctx, int const stre
     int err = RMF_buildTable(cctx->matchTable, 0, mfThreads > 1, cctx->curBlock);
 
 #ifndef FL2_SINGLETHREAD
-
     FL2POOL_waitAll(cctx->factory, 0);
+#endif
 
     if (err)
         return FL2_ERROR(canceled);
@@ -323,41 +402,116 @@ static size_t FL2_compressCurBlock_blocking(FL2_CCtx* const cctx, int const stre
         return FL2_ERROR(internal);
 #endif
 
-    FL2POOL_addRange(cctx->factory, FL2_compressRadixChunk, cctx, 1, nbThreads);
+    return FL2_error_no_error;
+}
 
-    cctx->jobs[0].cSize = LZMA2_encode(cctx->jobs[0].enc, cctx->matchTable,
-        cctx->jobs[0].block,
-        &cctx->params.cParams, streamProp,
-        &cctx->progressIn, &cctx->progressOut, &cctx->canceled);
+static size_t FL2_checkEncoderResults(FL2_CCtx* const cctx, size_t const nbThreads)
+{
+    for (size_t u = 0; u < nbThreads; ++u)
+        if (FL2_isError(cctx->jobs[u].cSize))
+            return cctx->jobs[u].cSize;
 
-    FL2POOL_waitAll(cctx->factory, 0);
+    cctx->threadCount = nbThreads;
 
-#else /* FL2_SINGLETHREAD */
+    return FL2_error_no_error;
+}
 
-    if (err)
-        return FL2_ERROR(canceled);
+/* FL2_encodeCurBlock() :
+ * Encode cctx->curBlock from its completed match table using all threads.
+ * Write streamProp as the first byte if >= 0
+ */
+static size_t FL2_encodeCurBlock(FL2_CCtx* const cctx, int const streamProp)
+{
+    size_t const nbThreads = FL2_sliceCurBlock(cctx, cctx->jobCount);
 
-#ifdef RMF_CHECK_INTEGRITY
-    err = RMF_integrityCheck(cctx->matchTable, cctx->curBlock.data, cctx->curBlock.start, cctx->curBlock.end, cctx->params.rParams.depth);
-    if (err)
-        return FL2_ERROR(internal);
+#ifndef FL2_SINGLETHREAD
+    FL2POOL_addRange(cctx->factory, FL2_compressRadixChunk, cctx, 1, nbThreads);
 #endif
+
     cctx->jobs[0].cSize = LZMA2_encode(cctx->jobs[0].enc, cctx->matchTable,
         cctx->jobs[0].block,
         &cctx->params.cParams, streamProp,
-        &cctx->progressIn, &cctx->progressOut, &cctx->canceled);
+        &cctx->progressIn, &cctx->progressOut, &cctx->canceled,
+        cctx->jobs[0].outBuf, cctx->jobs[0].outCapacity, cctx->curHistory);
 
+#ifndef FL2_SINGLETHREAD
+    FL2POOL_waitAll(cctx->factory, 0);
 #endif
 
-    for (size_t u = 0; u < nbThreads; ++u)
-        if (FL2_isError(cctx->jobs[u].cSize))
-            return cctx->jobs[u].cSize;
+    return FL2_checkEncoderResults(cctx, nbThreads);
+}
 
-    cctx->threadCount = nbThreads;
+/* FL2_compressCurBlock_blocking() :
+ * Compress cctx->curBlock and wait until complete.
+ * Write streamProp as the first byte if >= 0
+ */
+static size_t FL2_compressCurBlock_blocking(FL2_CCtx* const cctx, int const streamProp)
+{
+    CHECK_F(FL2_buildCurTable(cctx));
+    return FL2_encodeCurBlock(cctx, streamProp);
+}
 
-    return FL2_error_no_error;
+#ifndef FL2_SINGLETHREAD
+
+typedef struct
+{
+    FL2_CCtx* cctx;
+    FL2_matchTable* nextTable;
+    FL2_dataBlock nextBlock;
+    size_t encThreads;
+    int streamProp;
+} FL2_pipelineJob;
+
+/* FL2_pipelineStage() : FL2POOL_function type
+ * Jobs below encThreads encode slices of cctx->curBlock. The rest help build the match table
+ * for the next block, using builder n - encThreads + 1 because the calling thread uses builder 0.
+ */
+static void FL2_pipelineStage(void* const jobDescription, ptrdiff_t const n)
+{
+    FL2_pipelineJob* const job = (FL2_pipelineJob*)jobDescription;
+    FL2_CCtx* const cctx = job->cctx;
+
+    if ((size_t)n < job->encThreads)
+        cctx->jobs[n].cSize = LZMA2_encode(cctx->jobs[n].enc, cctx->matchTable,
+            cctx->jobs[n].block,
+            &cctx->params.cParams,
+            n ? -1 : job->streamProp,
+            &cctx->progressIn, &cctx->progressOut, &cctx->canceled,
+            cctx->jobs[n].outBuf, cctx->jobs[n].outCapacity, cctx->curHistory);
+    else
+        RMF_buildTable(job->nextTable, n - job->encThreads + 1, 1, job->nextBlock);
 }
 
+/* FL2_encodeCurBlockPipelined() :
+ * Encode cctx->curBlock on the pool threads while the calling thread, joined by any pool
+ * thread that finishes encoding, builds the match table for job->nextBlock.
+ */
+static size_t FL2_encodeCurBlockPipelined(FL2_CCtx* const cctx, FL2_pipelineJob* const job)
+{
+    /* One thread fewer than usual for encoding, so the build always has a thread */
+    job->encThreads = FL2_sliceCurBlock(cctx, cctx->jobCount - 1);
+
+    size_t mfThreads = job->nextBlock.end / RMF_MIN_BYTES_PER_THREAD;
+    mfThreads = MIN(RMF_threadCount(job->nextTable), mfThreads);
+    mfThreads += !mfThreads;
+
+    RMF_initProgress(job->nextTable);
+    RMF_initTable(job->nextTable, job->nextBlock.data, job->nextBlock.end);
+
+    FL2POOL_addRange(cctx->factory, FL2_pipelineStage, job, 0, job->encThreads + mfThreads - 1);
+
+    int const err = RMF_buildTable(job->nextTable, 0, mfThreads > 1, job->nextBlock);
+
+    FL2POOL_waitAll(cctx->factory, 0);
+
+    if (err)
+        return FL2_ERROR(canceled);
+
+    return FL2_checkEncoderResults(cctx, job->encThreads);
+}
+
+#endif /* FL2_SINGLETHREAD */
+
 /* FL2_compressCurBlock_async() : FL2POOL_function type */
 static void FL2_compressCurBlock_async(void* const jobDescription, ptrdiff_t const n)
 {
@@ -366,19 +520,12 @@ static void FL2_compressCurBlock_async(void* const jobDescription, ptrdiff_t con
     cctx->asyncRes = FL2_compressCurBlock_blocking(cctx, (int)n);
 }
 
-/* FL2_compressCurBlock() :
- * Update total input size.
- * Clear the compressed data buffers.
- * Init progress info.
- * Start compression of cctx->curBlock, and wait for completion if no async compression thread exists.
+/* FL2_initCurBlock() :
+ * Update the largest dictionary size used, clear the compressed data buffers and
+ * set the progress weights for cctx->curBlock.
  */
-static size_t FL2_compressCurBlock(FL2_CCtx* const cctx, int const streamProp)
+static void FL2_initCurBlock(FL2_CCtx* const cctx)
 {
-    FL2_initProgress(cctx);
-
-    if (cctx->curBlock.start == cctx->curBlock.end)
-        return FL2_error_no_error;
-
     /* update largest dict size used */
     cctx->dictMax = MAX(cctx->dictMax, cctx->curBlock.end);
 
@@ -408,6 +555,22 @@ static size_t FL2_compressCurBlock(FL2_CCtx* const cctx, int const streamProp)
 
     cctx->rmfWeight = rmfWeight;
     cctx->encWeight = encWeight;
+}
+
+/* FL2_compressCurBlock() :
+ * Update total input size.
+ * Clear the compressed data buffers.
+ * Init progress info.
+ * Start compression of cctx->curBlock, and wait for completion if no async compression thread exists.
+ */
+static size_t FL2_compressCurBlock(FL2_CCtx* const cctx, int const streamProp)
+{
+    FL2_initProgress(cctx);
+
+    if (cctx->curBlock.start == cctx->curBlock.end)
+        return FL2_error_no_error;
+
+    FL2_initCurBlock(cctx);
 
 #ifndef FL2_SINGLETHREAD
     if(cctx->compressThread != NULL)
@@ -439,6 +602,12 @@ static void FL2_preBeginFrame(FL2_CCtx* const cctx, size_t const dictReduce)
         RMF_freeMatchTable(cctx->matchTable);
         cctx->matchTable = NULL;
     }
+#ifndef FL2_SINGLETHREAD
+    if (cctx->pipeTable && !RMF_compatibleParameters(cctx->pipeTable, &cctx->params.rParams, dictReduce)) {
+        RMF_freeMatchTable(cctx->pipeTable);
+        cctx->pipeTable = NULL;
+    }
+#endif
 }
 
 static size_t FL2_beginFrame(FL2_CCtx* const cctx, size_t const dictReduce)
@@ -456,6 +625,24 @@ static size_t FL2_beginFrame(FL2_CCtx* const cctx, size_t const dictReduce)
         RMF_applyParameters(cctx->matchTable, &cctx->params.rParams, dictReduce);
     }
 
+#ifndef FL2_SINGLETHREAD
+    /* A second table is only useful for in-memory input larger than one block */
+    if (cctx->params.pipeline && cctx->jobCount > 1 && dictReduce > cctx->params.rParams.dictionary_size) {
+        if (cctx->pipeTable == NULL) {
+            cctx->pipeTable = RMF_createMatchTable(&cctx->params.rParams, dictReduce, cctx->jobCount);
+            if (cctx->pipeTable == NULL)
+                return FL2_ERROR(memory_allocation);
+        }
+        else {
+            RMF_applyParameters(cctx->pipeTable, &cctx->params.rParams, dictReduce);
+        }
+    }
+    else {
+        RMF_freeMatchTable(cctx->pipeTable);
+        cctx->pipeTable = NULL;
+    }
+#endif
+
     cctx->dictMax = 0;
     cctx->streamTotal = 0;
     cctx->streamCsize = 0;
@@ -468,6 +655,14 @@ static size_t FL2_beginFrame(FL2_CCtx* const cctx, size_t const dictReduce)
     cctx->outPos = 0;
     cctx->curBlock.start = 0;
     cctx->curBlock.end = 0;
+    cctx->curHistory = NULL;
+    cctx->prevBlock.start = 0;
+    cctx->prevBlock.end = 0;
+    cctx->outDirect = NULL;
+    cctx->params.cParams.checkpoint_interval = 0;
+    cctx->cpIndexSize = 0;
+    cctx->frameIndexSize = 0;
+    cctx->streamOut = 0;
     cctx->lockParams = 1;
 
     return FL2_error_no_error;
@@ -477,16 +672,103 @@ static void FL2_endFrame(FL2_CCtx* const cctx)
 {
     cctx->dictMax = 0;
     cctx->asyncRes = 0;
+    cctx->outDirect = NULL;
     cctx->lockParams = 0;
 }
 
+/* Make room for size more bytes in a side index */
+static size_t FL2_reserveIndex(BYTE** const index, size_t const indexSize, size_t* const capacity, size_t const size)
+{
+    if (*capacity - indexSize < size) {
+        size_t const newCapacity = MAX(*capacity * 2, indexSize + size);
+        BYTE* const buf = realloc(*index, newCapacity);
+        if (buf == NULL)
+            return FL2_ERROR(memory_allocation);
+        *index = buf;
+        *capacity = newCapacity;
+    }
+    return FL2_error_no_error;
+}
+
+/* Append one entry to the checkpoint index */
+static size_t FL2_addCheckpointEntry(FL2_CCtx* const cctx, size_t const packPos, size_t const unpackPos,
+    const BYTE* const lookbackData, size_t const lookback)
+{
+    size_t const headerSize = cctx->cpIndexSize ? 0 : FL2_CHECKPOINT_MAGIC_SIZE;
+    size_t const size = headerSize + FL2_CHECKPOINT_ENTRY_SIZE + lookback;
+
+    CHECK_F(FL2_reserveIndex(&cctx->cpIndex, cctx->cpIndexSize, &cctx->cpIndexCapacity, size));
+
+    BYTE* dst = cctx->cpIndex + cctx->cpIndexSize;
+    if (headerSize != 0) {
+        MEM_writeLE32(dst, FL2_CHECKPOINT_MAGIC);
+        dst += FL2_CHECKPOINT_MAGIC_SIZE;
+    }
+    MEM_writeLE64(dst, packPos);
+    MEM_writeLE64(dst + 8, unpackPos);
+    MEM_writeLE32(dst + 16, (U32)lookback);
+    memcpy(dst + FL2_CHECKPOINT_ENTRY_SIZE, lookbackData, lookback);
+    cctx->cpIndexSize += size;
+
+    return FL2_error_no_error;
+}
+
+/* Append one entry to the frame index. Positions exclude the property byte. */
+static size_t FL2_addFrameIndexEntry(FL2_CCtx* const cctx, U64 const packPos, U64 const unpackPos)
+{
+    size_t const headerSize = cctx->frameIndexSize ? 0 : FL2_FRAME_INDEX_MAGIC_SIZE;
+    size_t const size = headerSize + FL2_FRAME_INDEX_ENTRY_SIZE;
+
+    CHECK_F(FL2_reserveIndex(&cctx->frameIndex, cctx->frameIndexSize, &cctx->frameIndexCapacity, size));
+
+    BYTE* dst = cctx->frameIndex + cctx->frameIndexSize;
+    if (headerSize != 0) {
+        MEM_writeLE32(dst, FL2_FRAME_INDEX_MAGIC);
+        dst += FL2_FRAME_INDEX_MAGIC_SIZE;
+    }
+    MEM_writeLE64(dst, packPos);
+    MEM_writeLE64(dst + 8, unpackPos);
+    cctx->frameIndexSize += size;
+
+    return FL2_error_no_error;
+}
+
+/* Index the checkpoints written by enc while encoding block, which is located in src.
+ * packBase is the position of the encoder output relative to the first chunk.
+ */
+static size_t FL2_indexCheckpoints(FL2_CCtx* const cctx, const LZMA2_ECtx* const enc,
+    FL2_dataBlock const block, const BYTE* const src, size_t const packBase)
+{
+    const LZMA2_checkpoint* cp;
+    size_t const count = LZMA2_getCheckpoints(enc, &cp);
+
+    for (size_t u = 0; u < count; ++u)
+        CHECK_F(FL2_addCheckpointEntry(cctx, packBase + cp[u].out_pos, (size_t)(block.data - src) + cp[u].pos,
+            block.data + cp[u].pos - cp[u].lookback, cp[u].lookback));
+
+    return FL2_error_no_error;
+}
+
+/* Destination and input advice when compressing a mapped file */
+typedef struct
+{
+    const FL2_mapping* map;
+    int fd;
+#ifndef NO_XXHASH
+    XXH32_state_t* xxh;
+#endif
+    size_t written;
+} FL2_fileOut;
+
 /* Compress a memory buffer which may be larger than the dictionary.
  * The property byte is written first unless the omit flag is set.
+ * If fout is not NULL, src is its mapping and output is written to its file instead of dst.
  * Return: compressed size.
  */
 static size_t FL2_compressBuffer(FL2_CCtx* const cctx,
     const void* const src, size_t srcSize,
-    void* const dst, size_t dstCapacity)
+    void* const dst, size_t dstCapacity,
+    FL2_fileOut* const fout)
 {
     if (srcSize == 0)
         return 0;
@@ -495,53 +777,404 @@ static size_t FL2_compressBuffer(FL2_CCtx* const cctx,
     size_t const dictionarySize = cctx->params.rParams.dictionary_size;
     size_t const blockOverlap = OVERLAP_FROM_DICT_SIZE(dictionarySize, cctx->params.rParams.overlap_fraction);
     int streamProp = cctx->params.omitProp ? -1 : FL2_getProp(cctx, MIN(srcSize, dictionarySize));
+    /* Checkpoint pack positions exclude the property byte */
+    size_t const propSize = (streamProp >= 0);
+
+    cctx->params.cParams.checkpoint_interval = cctx->params.checkpointLog ? (size_t)1 << cctx->params.checkpointLog : 0;
+    cctx->params.cParams.checkpoint_lookback = cctx->params.checkpointLookback;
 
     cctx->curBlock.data = src;
     cctx->curBlock.start = 0;
+    cctx->curBlock.end = MIN(srcSize, dictionarySize);
+
+    size_t blockTotal = cctx->curBlock.end;
 
-    size_t blockTotal = 0;
+    if (fout != NULL)
+        FL2_adviseWillNeed(fout->map, 0, cctx->curBlock.end);
+
+#ifndef FL2_SINGLETHREAD
+    /* The pipeline table exists only if pipelining is enabled, multithreaded and the input exceeds one block */
+    FL2_pipelineJob job;
+    job.cctx = cctx;
+    job.nextTable = cctx->pipeTable;
+    if (job.nextTable != NULL) {
+        FL2_initProgress(cctx);
+        FL2_initCurBlock(cctx);
+        CHECK_F(FL2_buildCurTable(cctx));
+    }
+#endif
 
-    do {
-        cctx->curBlock.end = cctx->curBlock.start + MIN(srcSize, dictionarySize - cctx->curBlock.start);
-        blockTotal += cctx->curBlock.end - cctx->curBlock.start;
+    for (;;) {
+        FL2_dataBlock nextBlock = cctx->curBlock;
 
-        CHECK_F(FL2_compressCurBlock(cctx, streamProp));
+        srcSize -= cctx->curBlock.end - cctx->curBlock.start;
+        if (srcSize != 0) {
+            if (cctx->params.cParams.reset_interval
+                && blockTotal + MIN(dictionarySize - blockOverlap, srcSize) > dictionarySize * cctx->params.cParams.reset_interval) {
+                /* periodically reset the dictionary for mt decompression */
+                DEBUGLOG(4, "Resetting dictionary after %u bytes", (unsigned)blockTotal);
+                nextBlock.start = 0;
+                blockTotal = 0;
+            }
+            else {
+                nextBlock.start = blockOverlap;
+            }
+            nextBlock.data += cctx->curBlock.end - nextBlock.start;
+            nextBlock.end = nextBlock.start + MIN(srcSize, dictionarySize - nextBlock.start);
+            blockTotal += nextBlock.end - nextBlock.start;
+            /* Page in the next block's new data while this one compresses */
+            if (fout != NULL)
+                FL2_adviseWillNeed(fout->map,
+                    nextBlock.data + nextBlock.start - fout->map->data,
+                    nextBlock.data + nextBlock.end - fout->map->data);
+        }
+
+        cctx->outDirect = (fout == NULL) ? dstBuf : NULL;
+        cctx->outDirectCapacity = (fout == NULL) ? dstCapacity : 0;
+
+#ifndef FL2_SINGLETHREAD
+        if (job.nextTable != NULL) {
+            if (srcSize != 0) {
+                job.nextBlock = nextBlock;
+                job.streamProp = streamProp;
+                CHECK_F(FL2_encodeCurBlockPipelined(cctx, &job));
+            }
+            else {
+                CHECK_F(FL2_encodeCurBlock(cctx, streamProp));
+            }
+        }
+        else
+#endif
+        {
+            CHECK_F(FL2_compressCurBlock(cctx, streamProp));
+        }
 
         streamProp = -1;
 
         for (size_t u = 0; u < cctx->threadCount; ++u) {
             DEBUGLOG(5, "Write thread %u : %u bytes", (U32)u, (U32)cctx->jobs[u].cSize);
 
+            size_t const outPos = (fout != NULL) ? fout->written : (size_t)(dstBuf - (const BYTE*)dst);
+            CHECK_F(FL2_indexCheckpoints(cctx, cctx->jobs[u].enc, cctx->jobs[u].block, src, outPos - propSize));
+            /* The first block's chunks follow the property byte */
+            if (u == 0 && cctx->curBlock.start == 0)
+                CHECK_F(FL2_addFrameIndexEntry(cctx, outPos ? outPos - propSize : 0, (size_t)(cctx->curBlock.data - (const BYTE*)src)));
+
+            if (fout != NULL) {
+                CHECK_F(FL2_writeFile(fout->fd,
+                    RMF_getTableAsOutputBuffer(cctx->matchTable, cctx->jobs[u].block.start),
+                    cctx->jobs[u].cSize));
+                fout->written += cctx->jobs[u].cSize;
+                continue;
+            }
+
             if (dstCapacity < cctx->jobs[u].cSize) 
                 return FL2_ERROR(dstSize_tooSmall);
 
-            const BYTE* const outBuf = RMF_getTableAsOutputBuffer(cctx->matchTable, cctx->jobs[u].block.start);
-            memcpy(dstBuf, outBuf, cctx->jobs[u].cSize);
+            /* Output encoded directly into dst is moved down over the unused worst-case space */
+            if (cctx->jobs[u].outBuf == NULL) {
+                const BYTE* const outBuf = RMF_getTableAsOutputBuffer(cctx->matchTable, cctx->jobs[u].block.start);
+                memcpy(dstBuf, outBuf, cctx->jobs[u].cSize);
+            }
+            else if (cctx->jobs[u].outBuf != dstBuf) {
+                memmove(dstBuf, cctx->jobs[u].outBuf, cctx->jobs[u].cSize);
+            }
 
             dstBuf += cctx->jobs[u].cSize;
             dstCapacity -= cctx->jobs[u].cSize;
         }
-        srcSize -= cctx->curBlock.end - cctx->curBlock.start;
-        if (cctx->params.cParams.reset_interval
-            && blockTotal + MIN(dictionarySize - blockOverlap, srcSize) > dictionarySize * cctx->params.cParams.reset_interval) {
-            /* periodically reset the dictionary for mt decompression */
-            DEBUGLOG(4, "Resetting dictionary after %u bytes", (unsigned)blockTotal);
-            cctx->curBlock.start = 0;
-            blockTotal = 0;
+        if (fout != NULL) {
+#ifndef NO_XXHASH
+            if (fout->xxh != NULL)
+                XXH32_update(fout->xxh, cctx->curBlock.data + cctx->curBlock.start, cctx->curBlock.end - cctx->curBlock.start);
+#endif
+            /* Data preceding the next block's overlap is finished with */
+            FL2_adviseDontNeed(fout->map, 0, nextBlock.data - fout->map->data);
         }
-        else {
-            cctx->curBlock.start = blockOverlap;
+        if (srcSize == 0)
+            break;
+
+        cctx->curBlock = nextBlock;
+
+#ifndef FL2_SINGLETHREAD
+        if (job.nextTable != NULL) {
+            /* The next block's table is built. The current one is free for the block after. */
+            FL2_matchTable* const tbl = cctx->matchTable;
+            cctx->matchTable = job.nextTable;
+            cctx->pipeTable = tbl;
+            job.nextTable = tbl;
+            FL2_initProgress(cctx);
+            FL2_initCurBlock(cctx);
         }
-        cctx->curBlock.data += cctx->curBlock.end - cctx->curBlock.start;
-    } while (srcSize != 0);
+#endif
+    }
+    cctx->outDirect = NULL;
+
+    if (fout != NULL)
+        return fout->written;
+
     return dstBuf - (const BYTE*)dst;
 }
 
+#ifndef FL2_SINGLETHREAD
+
+/* FL2_groupSlotMemory() :
+ * Memory used by one concurrent reset group: a single-threaded match table and encoder,
+ * and a buffer for the group's output.
+ */
+static size_t FL2_groupSlotMemory(const FL2_CCtx* const cctx, size_t const groupSize)
+{
+    return RMF_memoryUsage(cctx->params.rParams.dictionary_size, cctx->params.rParams.match_buffer_resize, 1)
+        + LZMA2_encMemoryUsage(cctx->params.cParams.second_dict_bits, cctx->params.cParams.strategy, 1)
+        + LZMA2_compressBound(groupSize);
+}
+
+static size_t FL2_groupSize(const FL2_CCtx* const cctx)
+{
+    return cctx->params.rParams.dictionary_size * cctx->params.cParams.reset_interval;
+}
+
+/* FL2_groupSlotCount() :
+ * Return the number of reset groups to compress concurrently within the memory budget,
+ * or 0 if group compression is disabled or not possible.
+ */
+static size_t FL2_groupSlotCount(const FL2_CCtx* const cctx, size_t const srcSize)
+{
+    size_t const groupSize = FL2_groupSize(cctx);
+
+    if (cctx->params.groupBudget == 0 || groupSize == 0 || srcSize <= groupSize)
+        return 0;
+
+    size_t nbSlots = MIN(cctx->jobCount, (srcSize + groupSize - 1) / groupSize);
+    nbSlots = MIN(nbSlots, (cctx->params.groupBudget << 20) / FL2_groupSlotMemory(cctx, groupSize));
+
+    return (nbSlots > 1) ? nbSlots : 0;
+}
+
+static size_t FL2_initGroupSlots(FL2_CCtx* const cctx, size_t const nbSlots, size_t const groupSize)
+{
+    if (cctx->groups == NULL) {
+        cctx->groups = calloc(cctx->jobCount, sizeof(FL2_groupSlot));
+        if (cctx->groups == NULL)
+            return FL2_ERROR(memory_allocation);
+    }
+    for (size_t u = 0; u < nbSlots; ++u) {
+        FL2_groupSlot* const slot = cctx->groups + u;
+        if (slot->cctx == NULL) {
+            slot->cctx = FL2_createCCtx_internal(1, 0);
+            if (slot->cctx == NULL)
+                return FL2_ERROR(memory_allocation);
+        }
+        /* Slot 0 writes directly to dst */
+        size_t const outSize = u ? LZMA2_compressBound(groupSize) : 0;
+        if (slot->outSize < outSize) {
+            free(slot->outBuf);
+            slot->outSize = 0;
+            slot->outBuf = malloc(outSize);
+            if (slot->outBuf == NULL)
+                return FL2_ERROR(memory_allocation);
+            slot->outSize = outSize;
+        }
+        slot->cctx->params = cctx->params;
+        /* Groups are raw chunk sequences which the caller joins into one stream */
+        slot->cctx->params.omitProp = 1;
+        slot->cctx->params.pipeline = 0;
+        slot->cctx->params.groupBudget = 0;
+    }
+    return FL2_error_no_error;
+}
+
+typedef struct
+{
+    FL2_CCtx* cctx;
+    const BYTE* src;
+    size_t srcSize;
+    size_t groupSize;
+    BYTE* dst;
+    size_t dstCapacity;
+} FL2_groupJob;
+
+/* FL2_compressGroup() : FL2POOL_function type
+ * Compress the n-th reset group of the current round. Group 0 is written directly to dst.
+ */
+static void FL2_compressGroup(void* const jobDescription, ptrdiff_t const n)
+{
+    FL2_groupJob* const job = (FL2_groupJob*)jobDescription;
+    FL2_groupSlot* const slot = job->cctx->groups + n;
+    FL2_CCtx* const gctx = slot->cctx;
+    size_t const offset = n * job->groupSize;
+    size_t const size = MIN(job->groupSize, job->srcSize - offset);
+
+    FL2_preBeginFrame(gctx, size);
+    slot->cSize = FL2_beginFrame(gctx, size);
+    if (!FL2_isError(slot->cSize))
+        slot->cSize = FL2_compressBuffer(gctx, job->src + offset, size,
+            n ? slot->outBuf : job->dst,
+            n ? slot->outSize : job->dstCapacity,
+            NULL);
+    FL2_endFrame(gctx);
+}
+
+/* Append the checkpoint index of a group, offset by the group's positions in the stream */
+static size_t FL2_mergeCheckpointIndex(FL2_CCtx* const cctx, const FL2_CCtx* const gctx,
+    size_t const packBase, size_t const unpackBase)
+{
+    if (gctx->cpIndexSize == 0)
+        return FL2_error_no_error;
+
+    const BYTE* const end = gctx->cpIndex + gctx->cpIndexSize;
+    const BYTE* entry = gctx->cpIndex + FL2_CHECKPOINT_MAGIC_SIZE;
+
+    while (entry < end) {
+        size_t const lookback = MEM_readLE32(entry + 16);
+        CHECK_F(FL2_addCheckpointEntry(cctx, packBase + (size_t)MEM_readLE64(entry), unpackBase + (size_t)MEM_readLE64(entry + 8),
+            entry + FL2_CHECKPOINT_ENTRY_SIZE, lookback));
+        entry += FL2_CHECKPOINT_ENTRY_SIZE + lookback;
+    }
+    return FL2_error_no_error;
+}
+
+/* Append the dictionary resets of a group, offset by the group's positions in the stream */
+static size_t FL2_mergeFrameIndex(FL2_CCtx* const cctx, const FL2_CCtx* const gctx,
+    size_t const packBase, size_t const unpackBase)
+{
+    if (gctx->frameIndexSize == 0)
+        return FL2_error_no_error;
+
+    const BYTE* const end = gctx->frameIndex + gctx->frameIndexSize;
+
+    for (const BYTE* entry = gctx->frameIndex + FL2_FRAME_INDEX_MAGIC_SIZE; entry < end; entry += FL2_FRAME_INDEX_ENTRY_SIZE)
+        CHECK_F(FL2_addFrameIndexEntry(cctx, packBase + MEM_readLE64(entry), unpackBase + MEM_readLE64(entry + 8)));
+
+    return FL2_error_no_error;
+}
+
+/* Compress a memory buffer as a sequence of independent reset groups, up to nbSlots at a time.
+ * Each group is compressed by one thread with its own context, and the output is joined in order.
+ * Return: compressed size.
+ */
+static size_t FL2_compressGroups(FL2_CCtx* const cctx, size_t const nbSlots,
+    const void* const src, size_t srcSize,
+    void* const dst, size_t dstCapacity)
+{
+    size_t const groupSize = FL2_groupSize(cctx);
+    BYTE* dstBuf = dst;
+
+    DEBUGLOG(4, "FL2_compressGroups : %u slots, group size %u", (unsigned)nbSlots, (unsigned)groupSize);
+
+    CHECK_F(FL2_initGroupSlots(cctx, nbSlots, groupSize));
+
+    size_t const propSize = !cctx->params.omitProp;
+    if (propSize) {
+        *dstBuf++ = FL2_getProp(cctx, MIN(srcSize, cctx->params.rParams.dictionary_size));
+        --dstCapacity;
+    }
+
+    FL2_groupJob job;
+    job.cctx = cctx;
+    job.src = src;
+    job.groupSize = groupSize;
+
+    while (srcSize != 0) {
+        size_t const nbGroups = MIN(nbSlots, (srcSize + groupSize - 1) / groupSize);
+
+        job.srcSize = srcSize;
+        job.dst = dstBuf;
+        job.dstCapacity = dstCapacity;
+
+        FL2POOL_addRange(cctx->factory, FL2_compressGroup, &job, 1, nbGroups);
+        FL2_compressGroup(&job, 0);
+        FL2POOL_waitAll(cctx->factory, 0);
+
+        for (size_t u = 0; u < nbGroups; ++u) {
+            size_t const cSize = cctx->groups[u].cSize;
+            if (FL2_isError(cSize))
+                return cSize;
+            if (u != 0) {
+                if (dstCapacity < cSize)
+                    return FL2_ERROR(dstSize_tooSmall);
+                memcpy(dstBuf, cctx->groups[u].outBuf, cSize);
+            }
+            CHECK_F(FL2_mergeCheckpointIndex(cctx, cctx->groups[u].cctx,
+                (size_t)(dstBuf - (BYTE*)dst) - propSize,
+                (size_t)(job.src - (const BYTE*)src) + u * groupSize));
+            CHECK_F(FL2_mergeFrameIndex(cctx, cctx->groups[u].cctx,
+                (size_t)(dstBuf - (BYTE*)dst) - propSize,
+                (size_t)(job.src - (const BYTE*)src) + u * groupSize));
+            dstBuf += cSize;
+            dstCapacity -= cSize;
+        }
+
+        size_t const done = MIN(srcSize, nbGroups * groupSize);
+        job.src += done;
+        srcSize -= done;
+    }
+    return dstBuf - (BYTE*)dst;
+}
+
+#endif /* FL2_SINGLETHREAD */
+
+/* Compress src into dst as one complete stream. The caller ends the frame, including on error. */
+static size_t FL2_compressMemory(FL2_CCtx* const cctx,
+    void* const dst, size_t const dstCapacity,
+    const void* const src, size_t const srcSize)
+{
+    size_t cSize;
+#ifndef FL2_SINGLETHREAD
+    size_t const nbSlots = FL2_groupSlotCount(cctx, srcSize);
+    if (nbSlots != 0) {
+        cSize = FL2_compressGroups(cctx, nbSlots, src, srcSize, dst, dstCapacity);
+    }
+    else
+#endif
+    {
+        FL2_preBeginFrame(cctx, srcSize);
+        CHECK_F(FL2_beginFrame(cctx, srcSize));
+
+        cSize = FL2_compressBuffer(cctx, src, srcSize, dst, dstCapacity, NULL);
+    }
+
+    if (FL2_isError(cSize))
+        return cSize;
+
+    /* The last frame index entry locates the end marker */
+    CHECK_F(FL2_addFrameIndexEntry(cctx, cSize - (cSize != 0 && !cctx->params.omitProp), srcSize));
+
+    BYTE* dstBuf = dst;
+    BYTE* const end = dstBuf + dstCapacity;
+
+    dstBuf += cSize;
+    if(dstBuf >= end)
+        return FL2_ERROR(dstSize_tooSmall);
+
+    if (cSize == 0)
+        *dstBuf++ = FL2_getProp(cctx, 0);
+
+    *dstBuf++ = LZMA2_END_MARKER;
+
+#ifndef NO_XXHASH
+    if (cctx->params.doXXH && !cctx->params.omitProp) {
+        XXH32_canonical_t canonical;
+        DEBUGLOG(5, "Writing hash");
+        if(end - dstBuf < XXHASH_SIZEOF)
+            return FL2_ERROR(dstSize_tooSmall);
+        XXH32_canonicalFromHash(&canonical, XXH32(src, srcSize, 0));
+        memcpy(dstBuf, &canonical, XXHASH_SIZEOF);
+        dstBuf += XXHASH_SIZEOF;
+    }
+#endif
+
+    return dstBuf - (BYTE*)dst;
+}
+
 FL2LIB_API size_t FL2LIB_CALL FL2_compressCCtx(FL2_CCtx* cctx,
     void* dst, size_t dstCapacity,
     const void* src, size_t srcSize,
     int compressionLevel)
 {
+    cctx->cpIndexSize = 0;
+    cctx->frameIndexSize = 0;
+
     if (dstCapacity < 2U - cctx->params.omitProp) /* empty LZMA2 stream is byte sequence {0, 0} */
         return FL2_ERROR(dstSize_tooSmall);
 
@@ -557,41 +1190,100 @@ FL2LIB_API size_t FL2LIB_CALL FL2_compressCCtx(FL2_CCtx* cctx,
     cctx->timeout = 0;
 #endif
 
-    FL2_preBeginFrame(cctx, srcSize);
-    CHECK_F(FL2_beginFrame(cctx, srcSize));
+    size_t const res = FL2_compressMemory(cctx, dst, dstCapacity, src, srcSize);
+
+    FL2_endFrame(cctx);
+    /* The indexes of a failed frame are incomplete */
+    if (FL2_isError(res)) {
+        cctx->cpIndexSize = 0;
+        cctx->frameIndexSize = 0;
+    }
+
+    return res;
+}
+
+static size_t FL2_compressMapping(FL2_CCtx* const cctx, FL2_fileOut* const fout)
+{
+    const FL2_mapping* const map = fout->map;
 
-    size_t const cSize = FL2_compressBuffer(cctx, src, srcSize, dst, dstCapacity);
+    FL2_preBeginFrame(cctx, map->size);
+    CHECK_F(FL2_beginFrame(cctx, map->size));
 
+    size_t const cSize = FL2_compressBuffer(cctx, map->data, map->size, NULL, 0, fout);
     if (FL2_isError(cSize))
         return cSize;
 
-    BYTE* dstBuf = dst;
-    BYTE* const end = dstBuf + dstCapacity;
+    CHECK_F(FL2_addFrameIndexEntry(cctx, cSize - (cSize != 0 && !cctx->params.omitProp), map->size));
 
-    dstBuf += cSize;
-    if(dstBuf >= end)
-        return FL2_ERROR(dstSize_tooSmall);
+    BYTE trailer[6]; /* prop, end marker, xxhash */
+    size_t pos = 0;
 
     if (cSize == 0)
-        *dstBuf++ = FL2_getProp(cctx, 0);
+        trailer[pos++] = FL2_getProp(cctx, 0);
 
-    *dstBuf++ = LZMA2_END_MARKER;
+    trailer[pos++] = LZMA2_END_MARKER;
 
 #ifndef NO_XXHASH
-    if (cctx->params.doXXH && !cctx->params.omitProp) {
+    if (fout->xxh != NULL) {
         XXH32_canonical_t canonical;
         DEBUGLOG(5, "Writing hash");
-        if(end - dstBuf < XXHASH_SIZEOF)
-            return FL2_ERROR(dstSize_tooSmall);
-        XXH32_canonicalFromHash(&canonical, XXH32(src, srcSize, 0));
-        memcpy(dstBuf, &canonical, XXHASH_SIZEOF);
-        dstBuf += XXHASH_SIZEOF;
+        XXH32_canonicalFromHash(&canonical, XXH32_digest(fout->xxh));
+        memcpy(trailer + pos, &canonical, XXHASH_SIZEOF);
+        pos += XXHASH_SIZEOF;
     }
 #endif
-    
+    CHECK_F(FL2_writeFile(fout->fd, trailer, pos));
+
+    return cSize + pos;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_compressFile(FL2_CCtx* cctx,
+    int dstFd, int srcFd,
+    int compressionLevel)
+{
+    if (compressionLevel > 0)
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, compressionLevel);
+
+#ifndef FL2_SINGLETHREAD
+    FL2POOL_free(cctx->compressThread);
+    cctx->compressThread = NULL;
+    cctx->timeout = 0;
+#endif
+
+    FL2_mapping map;
+    CHECK_F(FL2_mapFile(&map, srcFd));
+
+    DEBUGLOG(4, "FL2_compressFile : level %u, %u src", cctx->params.compressionLevel, (U32)map.size);
+
+    FL2_fileOut fout;
+    fout.map = &map;
+    fout.fd = dstFd;
+    fout.written = 0;
+#ifndef NO_XXHASH
+    fout.xxh = NULL;
+    if (cctx->params.doXXH && !cctx->params.omitProp) {
+        fout.xxh = XXH32_createState();
+        if (fout.xxh == NULL) {
+            FL2_unmapFile(&map);
+            return FL2_ERROR(memory_allocation);
+        }
+        XXH32_reset(fout.xxh, 0);
+    }
+#endif
+
+    size_t const res = FL2_compressMapping(cctx, &fout);
+
     FL2_endFrame(cctx);
+    if (FL2_isError(res)) {
+        cctx->cpIndexSize = 0;
+        cctx->frameIndexSize = 0;
+    }
+#ifndef NO_XXHASH
+    XXH32_freeState(fout.xxh);
+#endif
+    FL2_unmapFile(&map);
 
-    return dstBuf - (BYTE*)dst;
+    return res;
 }
 
 FL2LIB_API size_t FL2LIB_CALL FL2_compressMt(void* dst, size_t dstCapacity,
@@ -622,6 +1314,31 @@ FL2LIB_API BYTE FL2LIB_CALL FL2_getCCtxDictProp(FL2_CCtx* cctx)
     return LZMA2_getDictSizeProp(cctx->dictMax ? cctx->dictMax : cctx->params.rParams.dictionary_size);
 }
 
+/* Copy a side index into dst, or return its size if dst is NULL and dstCapacity is 0 */
+static size_t FL2_copyIndex(const BYTE* const index, size_t const indexSize, void* const dst, size_t const dstCapacity)
+{
+    if (dst == NULL && dstCapacity == 0)
+        return indexSize;
+    if (dstCapacity < indexSize)
+        return FL2_ERROR(dstSize_tooSmall);
+    if (indexSize != 0)
+        memcpy(dst, index, indexSize);
+    return indexSize;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_getCCtxCheckpointIndex(const FL2_CCtx* cctx, void* dst, size_t dstCapacity)
+{
+    return FL2_copyIndex(cctx->cpIndex, cctx->cpIndexSize, dst, dstCapacity);
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_getCCtxFrameIndex(const FL2_CCtx* cctx, void* dst, size_t dstCapacity)
+{
+    /* A stream's index is complete once the end marker is written */
+    if (cctx->lockParams)
+        return FL2_ERROR(stage_wrong);
+    return FL2_copyIndex(cctx->frameIndex, cctx->frameIndexSize, dst, dstCapacity);
+}
+
 #define MAXCHECK(val,max) do {            \
     if ((val)>(max)) {     \
         return FL2_ERROR(parameter_outOfBound);  \
@@ -745,6 +1462,40 @@ FL2LIB_API size_t FL2LIB_CALL FL2_CCtx_setParameter(FL2_CCtx* cctx, FL2_cParamet
     case FL2_p_omitProperties:
         cctx->params.omitProp = value != 0;
         break;
+
+    case FL2_p_pipelineBlocks:
+        cctx->params.pipeline = value != 0;
+        break;
+
+    case FL2_p_groupMemoryBudget:
+        MAXCHECK(value, FL2_GROUP_BUDGET_MAX);
+        cctx->params.groupBudget = value;
+        break;
+
+    case FL2_p_flushWindowLog:
+        if (value != 0)
+            CLAMPCHECK(value, FL2_FLUSH_WINDOWLOG_MIN, FL2_FLUSH_WINDOWLOG_MAX);
+        cctx->params.flushWindowLog = (unsigned)value;
+        break;
+
+    case FL2_p_mirroredDictionary:
+        cctx->params.mirrorDict = value != 0;
+        break;
+
+    case FL2_p_slidingWindow:
+        cctx->params.slidingWindow = value != 0;
+        break;
+
+    case FL2_p_checkpointLog:
+        if (value != 0)
+            CLAMPCHECK(value, FL2_CHECKPOINTLOG_MIN, FL2_CHECKPOINTLOG_MAX);
+        cctx->params.checkpointLog = (unsigned)value;
+        break;
+
+    case FL2_p_checkpointLookback:
+        CLAMPCHECK(value, FL2_CHECKPOINT_LOOKBACK_MIN, FL2_CHECKPOINT_LOOKBACK_MAX);
+        cctx->params.checkpointLookback = value;
+        break;
 #ifdef RMF_REFERENCE
     case FL2_p_useReferenceMF:
         cctx->params.rParams.use_ref_mf = value != 0;
@@ -818,6 +1569,27 @@ FL2LIB_API size_t FL2LIB_CALL FL2_CCtx_getParameter(FL2_CCtx* cctx, FL2_cParamet
 
     case FL2_p_omitProperties:
         return cctx->params.omitProp;
+
+    case FL2_p_pipelineBlocks:
+        return cctx->params.pipeline;
+
+    case FL2_p_groupMemoryBudget:
+        return cctx->params.groupBudget;
+
+    case FL2_p_flushWindowLog:
+        return cctx->params.flushWindowLog;
+
+    case FL2_p_mirroredDictionary:
+        return cctx->params.mirrorDict;
+
+    case FL2_p_slidingWindow:
+        return cctx->params.slidingWindow;
+
+    case FL2_p_checkpointLog:
+        return cctx->params.checkpointLog;
+
+    case FL2_p_checkpointLookback:
+        return cctx->params.checkpointLookback;
 #ifdef RMF_REFERENCE
     case FL2_p_useReferenceMF:
         return cctx->params.rParams.use_ref_mf;
@@ -828,11 +1600,16 @@ FL2LIB_API size_t FL2LIB_CALL FL2_CCtx_getParameter(FL2_CCtx* cctx, FL2_cParamet
 
 FL2LIB_API size_t FL2LIB_CALL FL2_CStream_setParameter(FL2_CStream* fcs, FL2_cParameter param, size_t value)
 {
+    /* Streams encode each block as soon as its match table is built */
+    if (param == FL2_p_pipelineBlocks)
+        return FL2_ERROR(parameter_unsupported);
     return FL2_CCtx_setParameter(fcs, param, value);
 }
 
 FL2LIB_API size_t FL2LIB_CALL FL2_CStream_getParameter(FL2_CStream* fcs, FL2_cParameter param)
 {
+    if (param == FL2_p_pipelineBlocks)
+        return FL2_ERROR(parameter_unsupported);
     return FL2_CCtx_getParameter(fcs, param);
 }
 
@@ -877,9 +1654,28 @@ FL2LIB_API size_t FL2LIB_CALL FL2_initCStream(FL2_CStream* fcs, int compressionL
     int const doHash = (fcs->params.doXXH && !fcs->params.omitProp);
 #endif
     size_t dictOverlap = OVERLAP_FROM_DICT_SIZE(fcs->params.rParams.dictionary_size, fcs->params.rParams.overlap_fraction);
-    if (DICT_init(buf, dictSize, dictOverlap, fcs->params.cParams.reset_interval, doHash) != 0)
+    /* A sliding window needs the part of the dictionary that the overlap does not keep */
+    int const sliding = fcs->params.slidingWindow && dictOverlap != 0;
+    if (DICT_init(buf, dictSize, dictOverlap, fcs->params.cParams.reset_interval, doHash,
+            fcs->params.mirrorDict || sliding, sliding ? dictSize - dictOverlap : 0) != 0)
         return FL2_ERROR(memory_allocation);
 
+    if (sliding && DICT_retained(buf) != 0) {
+        if (fcs->history != NULL && !LZMA2_historyCompatible(fcs->history, dictSize)) {
+            LZMA2_freeHistory(fcs->history);
+            fcs->history = NULL;
+        }
+        if (fcs->history == NULL) {
+            fcs->history = LZMA2_createHistory(dictSize);
+            if (fcs->history == NULL)
+                return FL2_ERROR(memory_allocation);
+        }
+    }
+    else {
+        LZMA2_freeHistory(fcs->history);
+        fcs->history = NULL;
+    }
+
     CHECK_F(FL2_beginFrame(fcs, 0));
 
     return 0;
@@ -905,7 +1701,56 @@ FL2LIB_API size_t FL2LIB_CALL FL2_setCStreamTimeout(FL2_CStream * fcs, unsigned
     return FL2_error_no_error;
 }
 
-static size_t FL2_compressStream_internal(FL2_CStream* const fcs, int const ending)
+/* Narrow the current block to a window of recent data before a small flushed tail.
+ * The match table is then built over window + tail bytes instead of the whole overlap.
+ */
+static void FL2_windowFlushBlock(FL2_CStream* const fcs)
+{
+    size_t const window = (size_t)1 << fcs->params.flushWindowLog;
+    FL2_dataBlock* const block = &fcs->curBlock;
+
+    if (block->start <= window || block->end - block->start >= window)
+        return;
+
+    /* The decoder dictionary covers the whole block */
+    fcs->dictMax = MAX(fcs->dictMax, block->end);
+
+    size_t const skip = block->start - window;
+    DEBUGLOG(4, "Flushing %u bytes with a %u byte window", (U32)(block->end - block->start), (U32)window);
+    block->data += skip;
+    block->start = window;
+    block->end -= skip;
+}
+
+/* Set up the sliding window history for fcs->curBlock. The previous block is indexed first.
+ * skip is the number of bytes FL2_windowFlushBlock() removed from the block start.
+ */
+static void FL2_setBlockHistory(FL2_CStream* const fcs, size_t const skip)
+{
+    LZMA2_history* const hist = fcs->history;
+    size_t const blockPos = DICT_blockPos(&fcs->buf) + skip;
+
+    fcs->curHistory = NULL;
+    if (hist == NULL)
+        return;
+
+    if (blockPos == 0) {
+        /* Dictionary reset */
+        LZMA2_historyReset(hist);
+    }
+    else if (fcs->prevBlock.start < fcs->prevBlock.end) {
+        LZMA2_historyInsert(hist, fcs->prevBlock.data, fcs->prevBlockPos, fcs->prevBlock.start, fcs->prevBlock.end);
+    }
+    fcs->prevBlock = fcs->curBlock;
+    fcs->prevBlockPos = blockPos;
+
+    LZMA2_historySetBlock(hist, blockPos,
+        MIN(blockPos, DICT_retained(&fcs->buf) + skip),
+        fcs->params.rParams.dictionary_size - 1);
+    fcs->curHistory = hist;
+}
+
+static size_t FL2_compressStream_internal(FL2_CStream* const fcs, int const ending, int const flushing)
 {
     CHECK_F(FL2_waitCStream(fcs));
 
@@ -930,6 +1775,17 @@ static size_t FL2_compressStream_internal(FL2_CStream* const fcs, int const endi
             fcs->wroteProp = 1;
         }
 
+        const BYTE* const blockData = fcs->curBlock.data;
+
+        if (flushing && fcs->params.flushWindowLog != 0)
+            FL2_windowFlushBlock(fcs);
+
+        FL2_setBlockHistory(fcs, (size_t)(fcs->curBlock.data - blockData));
+
+        /* All earlier output has been returned, so streamOut is the position of a dictionary reset */
+        if (fcs->curBlock.start == 0 && fcs->curBlock.end != 0)
+            CHECK_F(FL2_addFrameIndexEntry(fcs, fcs->streamOut - (fcs->streamOut != 0 && !fcs->params.omitProp), fcs->streamTotal));
+
         CHECK_F(FL2_compressCurBlock(fcs, streamProp));
     }
     return FL2_error_no_error;
@@ -952,6 +1808,7 @@ FL2LIB_API size_t FL2LIB_CALL FL2_copyCStreamOutput(FL2_CStream* fcs, FL2_outBuf
 
         memcpy(dstBuf, outBuf, toWrite);
         fcs->outPos += toWrite;
+        fcs->streamOut += toWrite;
         output->pos += toWrite;
 
         /* If the slice is not flushed, the output is full */
@@ -963,6 +1820,38 @@ FL2LIB_API size_t FL2LIB_CALL FL2_copyCStreamOutput(FL2_CStream* fcs, FL2_outBuf
     return 0;
 }
 
+static int FL2_compressorBusy(const FL2_CStream* const fcs)
+{
+#ifndef FL2_SINGLETHREAD
+    return FL2POOL_threadsBusy(fcs->compressThread) != 0;
+#else
+    (void)fcs;
+    return 0;
+#endif
+}
+
+/* Handle a full dictionary buffer. It is queued if the compressor is unavailable and the ring
+ * has a free buffer, otherwise compression of the oldest unprocessed buffer begins.
+ * Returns 1 if input must stop until compressed output is read, or 0.
+ */
+static size_t FL2_compressFullDict(FL2_CStream* const fcs)
+{
+    DICT_buffer * const buf = &fcs->buf;
+    int const outputPending = fcs->outThread < fcs->threadCount;
+
+    if ((outputPending || FL2_compressorBusy(fcs)) && DICT_canQueue(buf)) {
+        DICT_queue(buf);
+        return 0;
+    }
+    /* break if the compressor is not available */
+    if (outputPending)
+        return 1;
+
+    CHECK_F(FL2_compressStream_internal(fcs, 0, 0));
+
+    return 0;
+}
+
 static size_t FL2_compressStream_input(FL2_CStream* fcs, FL2_inBuffer* input)
 {
     CHECK_F(fcs->asyncRes);
@@ -983,11 +1872,41 @@ static size_t FL2_compressStream_input(FL2_CStream* fcs, FL2_inBuffer* input)
         DICT_put(buf, input);
         
         if (!DICT_availSpace(buf)) {
-            /* break if the compressor is not available */
-            if (fcs->outThread < fcs->threadCount)
+            size_t const res = FL2_compressFullDict(fcs);
+            CHECK_F(res);
+            if (res)
                 break;
+        }
+
+        CHECK_F(fcs->asyncRes);
+    }
+
+    return FL2_error_no_error;
+}
+
+/* Same as FL2_compressStream_input() but for a segment vector */
+static size_t FL2_compressStream_inputV(FL2_CStream* fcs, FL2_inVector* input)
+{
+    CHECK_F(fcs->asyncRes);
+
+    DICT_buffer * const buf = &fcs->buf;
 
-            CHECK_F(FL2_compressStream_internal(fcs, 0));
+    while (input->index < input->nbSegs) {
+        if (DICT_needShift(buf)) {
+            if(!DICT_async(buf))
+                CHECK_F(FL2_waitCStream(fcs));
+            DICT_shift(buf);
+        }
+
+        CHECK_F(fcs->asyncRes);
+
+        DICT_putV(buf, input);
+
+        if (!DICT_availSpace(buf)) {
+            size_t const res = FL2_compressFullDict(fcs);
+            CHECK_F(res);
+            if (res)
+                break;
         }
 
         CHECK_F(fcs->asyncRes);
@@ -1032,6 +1951,34 @@ FL2LIB_API size_t FL2LIB_CALL FL2_compressStream(FL2_CStream* fcs, FL2_outBuffer
     return fcs->outThread < fcs->threadCount;
 }
 
+FL2LIB_API size_t FL2LIB_CALL FL2_compressStreamV(FL2_CStream* fcs, FL2_outBuffer *output, FL2_inVector* input)
+{
+    if (!fcs->lockParams)
+        return FL2_ERROR(init_missing);
+
+    /* A bad resume position would make the dictionary copy read past the segment */
+    if (input->index > input->nbSegs
+        || (input->index < input->nbSegs && input->pos > input->segs[input->index].size))
+        return FL2_ERROR(srcSize_wrong);
+
+    size_t const prevIndex = input->index;
+    size_t const prevIn = input->pos;
+    size_t const prevOut = (output != NULL) ? output->pos : 0;
+
+    if (output != NULL && fcs->outThread < fcs->threadCount)
+        FL2_copyCStreamOutput(fcs, output);
+
+    CHECK_F(FL2_compressStream_inputV(fcs, input));
+
+    if(output != NULL && fcs->outThread < fcs->threadCount)
+        FL2_copyCStreamOutput(fcs, output);
+
+    CHECK_F(FL2_loopCheck(fcs, prevIndex == input->index && prevIn == input->pos
+        && (output == NULL || prevOut == output->pos)));
+
+    return fcs->outThread < fcs->threadCount;
+}
+
 FL2LIB_API size_t FL2LIB_CALL FL2_getDictionaryBuffer(FL2_CStream * fcs, FL2_dictBuffer * dict)
 {
     if (!fcs->lockParams)
@@ -1042,7 +1989,7 @@ FL2LIB_API size_t FL2LIB_CALL FL2_getDictionaryBuffer(FL2_CStream * fcs, FL2_dic
     DICT_buffer *buf = &fcs->buf;
 
     if (!DICT_availSpace(buf) && DICT_hasUnprocessed(buf))
-        CHECK_F(FL2_compressStream_internal(fcs, 0));
+        CHECK_F(FL2_compressFullDict(fcs));
 
     if (DICT_needShift(buf) && !DICT_async(buf))
         CHECK_F(FL2_waitCStream(fcs));
@@ -1055,7 +2002,7 @@ FL2LIB_API size_t FL2LIB_CALL FL2_getDictionaryBuffer(FL2_CStream * fcs, FL2_dic
 FL2LIB_API size_t FL2LIB_CALL FL2_updateDictionary(FL2_CStream * fcs, size_t addedSize)
 {
     if (DICT_update(&fcs->buf, addedSize))
-        CHECK_F(FL2_compressStream_internal(fcs, 0));
+        CHECK_F(FL2_compressFullDict(fcs));
 
     return fcs->outThread < fcs->threadCount;
 }
@@ -1072,6 +2019,7 @@ FL2LIB_API size_t FL2LIB_CALL FL2_getNextCompressedBuffer(FL2_CStream* fcs, FL2_
     if (fcs->outThread < fcs->threadCount) {
         cbuf->src = RMF_getTableAsOutputBuffer(fcs->matchTable, fcs->jobs[fcs->outThread].block.start) + fcs->outPos;
         cbuf->size = fcs->jobs[fcs->outThread].cSize - fcs->outPos;
+        fcs->streamOut += cbuf->size;
         ++fcs->outThread;
         fcs->outPos = 0;
     }
@@ -1127,6 +2075,19 @@ FL2LIB_API size_t FL2LIB_CALL FL2_remainingOutputSize(const FL2_CStream* fcs)
     return cSize;
 }
 
+/* Add the last frame index entry, which locates the end marker.
+ * Output of the last block may not have been returned yet.
+ */
+static size_t FL2_endFrameIndex(FL2_CStream* const fcs)
+{
+    U64 packEnd = fcs->streamOut - fcs->outPos;
+    for (size_t u = fcs->outThread; u < fcs->threadCount; ++u)
+        packEnd += fcs->jobs[u].cSize;
+    packEnd -= (packEnd != 0 && !fcs->params.omitProp);
+
+    return FL2_addFrameIndexEntry(fcs, packEnd, fcs->streamTotal + fcs->curBlock.end - fcs->curBlock.start);
+}
+
 /* Write the properties byte (if required), the hash and the end marker
  * into the output buffer.
  */
@@ -1180,9 +2141,10 @@ static size_t FL2_flushStream_internal(FL2_CStream* fcs, int const ending)
         (U32)(fcs->buf.end - fcs->buf.start),
         (U32)FL2_remainingOutputSize(fcs));
 
-    CHECK_F(FL2_compressStream_internal(fcs, ending));
+    CHECK_F(FL2_compressStream_internal(fcs, ending, 1));
 
-    return fcs->outThread < fcs->threadCount;
+    /* Queued buffers are compressed one per call */
+    return fcs->outThread < fcs->threadCount || DICT_hasUnprocessed(&fcs->buf);
 }
 
 FL2LIB_API size_t FL2LIB_CALL FL2_flushStream(FL2_CStream* fcs, FL2_outBuffer *output)
@@ -1200,7 +2162,7 @@ FL2LIB_API size_t FL2LIB_CALL FL2_flushStream(FL2_CStream* fcs, FL2_outBuffer *o
 
     if (output != NULL && res != 0) {
         FL2_copyCStreamOutput(fcs, output);
-        res = fcs->outThread < fcs->threadCount;
+        res = fcs->outThread < fcs->threadCount || DICT_hasUnprocessed(&fcs->buf);
     }
 
     CHECK_F(FL2_loopCheck(fcs, output != NULL && prevOut == output->pos));
@@ -1224,6 +2186,7 @@ FL2LIB_API size_t FL2LIB_CALL FL2_endStream(FL2_CStream* fcs, FL2_outBuffer *out
     CHECK_F(res);
 
     if (!fcs->endMarked && !DICT_hasUnprocessed(&fcs->buf)) {
+        CHECK_F(FL2_endFrameIndex(fcs));
         FL2_writeEnd(fcs);
         res = 1;
     }
@@ -1282,28 +2245,52 @@ FL2LIB_API size_t FL2LIB_CALL FL2_estimateCCtxSize_byParams(const FL2_compressio
         nbThreads);
 }
 
-FL2LIB_API size_t FL2LIB_CALL FL2_estimateCCtxSize_usingCCtx(const FL2_CCtx * cctx)
+static size_t FL2_estimateSize_usingCCtx(const FL2_CCtx* const cctx, int const pipeline)
 {
-    return FL2_memoryUsage_internal(cctx->params.rParams.dictionary_size,
+    size_t size = FL2_memoryUsage_internal(cctx->params.rParams.dictionary_size,
         cctx->params.rParams.match_buffer_resize,
         cctx->params.cParams.second_dict_bits,
         cctx->params.cParams.strategy,
         cctx->jobCount) + DICT_memUsage(&cctx->buf);
+    if (cctx->history != NULL)
+        size += LZMA2_historyMemoryUsage(cctx->params.rParams.dictionary_size);
+#ifndef FL2_SINGLETHREAD
+    if (pipeline && cctx->jobCount > 1) {
+        /* Pipelining adds a second match table */
+        if (cctx->params.pipeline)
+            size += RMF_memoryUsage(cctx->params.rParams.dictionary_size,
+                cctx->params.rParams.match_buffer_resize,
+                cctx->jobCount);
+        /* Concurrent reset groups use up to the budget in addition */
+        if (cctx->params.groupBudget && FL2_groupSize(cctx))
+            size += MIN(cctx->params.groupBudget << 20,
+                FL2_groupSlotMemory(cctx, FL2_groupSize(cctx)) * cctx->jobCount);
+    }
+#else
+    (void)pipeline;
+#endif
+    return size;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_estimateCCtxSize_usingCCtx(const FL2_CCtx * cctx)
+{
+    return FL2_estimateSize_usingCCtx(cctx, 1);
 }
 
 FL2LIB_API size_t FL2LIB_CALL FL2_estimateCStreamSize(int compressionLevel, unsigned nbThreads, int dualBuffer)
 {
     return FL2_estimateCCtxSize(compressionLevel, nbThreads)
-        + (FL2_defaultCParameters[compressionLevel].dictionarySize << (dualBuffer != 0));
+        + FL2_defaultCParameters[compressionLevel].dictionarySize * FL2_dictBufferCount(dualBuffer);
 }
 
 FL2LIB_API size_t FL2LIB_CALL FL2_estimateCStreamSize_byParams(const FL2_compressionParameters * params, unsigned nbThreads, int dualBuffer)
 {
     return FL2_estimateCCtxSize_byParams(params, nbThreads)
-        + (params->dictionarySize << (dualBuffer != 0));
+        + params->dictionarySize * FL2_dictBufferCount(dualBuffer);
 }
 
 FL2LIB_API size_t FL2LIB_CALL FL2_estimateCStreamSize_usingCStream(const FL2_CStream* fcs)
 {
-    return FL2_estimateCCtxSize_usingCCtx(fcs);
+    /* Pipelining is not used for streams */
+    return FL2_estimateSize_usingCCtx(fcs, 0);
 }
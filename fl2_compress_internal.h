@@ -44,15 +44,31 @@ typedef struct {
     BYTE doXXH;
 #endif
     BYTE omitProp;
+    BYTE pipeline;
+    size_t groupBudget;
+    unsigned flushWindowLog;
+    BYTE mirrorDict;
+    BYTE slidingWindow;
+    unsigned checkpointLog;
+    size_t checkpointLookback;
 } FL2_CCtx_params;
 
 typedef struct {
     FL2_CCtx* cctx;
     LZMA2_ECtx* enc;
     FL2_dataBlock block;
+    BYTE* outBuf; /* output written directly to the caller's buffer, or NULL for the match table */
+    size_t outCapacity;
     size_t cSize;
 } FL2_job;
 
+typedef struct {
+    FL2_CCtx* cctx;
+    BYTE* outBuf;
+    size_t outSize;
+    size_t cSize;
+} FL2_groupSlot;
+
 struct FL2_CCtx_s {
     DICT_buffer buf;
     FL2_CCtx_params params;
@@ -61,6 +77,8 @@ struct FL2_CCtx_s {
     FL2POOL_ctx* compressThread;
 #endif
     FL2_dataBlock curBlock;
+    BYTE* outDirect;
+    size_t outDirectCapacity;
     size_t asyncRes;
     size_t threadCount;
     size_t outThread;
@@ -69,7 +87,20 @@ struct FL2_CCtx_s {
     U64 streamTotal;
     U64 streamCsize;
     FL2_matchTable* matchTable;
+    LZMA2_history* history;             /* streaming sliding window index, or NULL */
+    const LZMA2_history* curHistory;    /* history for curBlock, or NULL */
+    FL2_dataBlock prevBlock;            /* last block compressed, added to history with the next */
+    size_t prevBlockPos;
+    BYTE* cpIndex;                      /* checkpoint index of the last in-memory or file compression */
+    size_t cpIndexSize;
+    size_t cpIndexCapacity;
+    BYTE* frameIndex;                   /* dictionary reset positions of the last frame */
+    size_t frameIndexSize;
+    size_t frameIndexCapacity;
+    U64 streamOut;                      /* compressed bytes returned by the stream */
 #ifndef FL2_SINGLETHREAD
+    FL2_matchTable* pipeTable;
+    FL2_groupSlot* groups;
     U32 timeout;
 #endif
     U32 rmfWeight;
@@ -19,6 +19,7 @@
 #include "fl2_threading.h"
 #include "fl2_pool.h"
 #include "atomic.h"
+#include "fl2_mmap.h"
 #ifndef NO_XXHASH
 #  include "xxhash.h"
 #endif
@@ -26,6 +27,12 @@
 
 #define LZMA2_PROP_UNINITIALIZED 0xFF
 
+/* Smallest output buffer allocated by the MT stream decoder */
+#define FL2_OUTBUF_CLASS_MIN ((size_t)1 << 16)
+
+/* Smaller resident inputs are copied */
+#define FL2_RESIDENT_INPUT_MIN ((size_t)1 << 16)
+
 
 FL2LIB_API unsigned long long FL2LIB_CALL FL2_findDecompressedSize(const void *src, size_t srcSize)
 {
@@ -37,6 +44,56 @@ FL2LIB_API size_t FL2LIB_CALL FL2_getDictSizeFromProp(unsigned char prop)
     return LZMA2_getDictSizeFromProp(prop);
 }
 
+/* Validate a frame index and return its number of entries, which is one more than the
+ * number of blocks. Entries must start at 0 and increase. */
+static size_t FL2_checkFrameIndex(const void* const index, size_t const indexSize)
+{
+    if (index == NULL || indexSize < FL2_FRAME_INDEX_MAGIC_SIZE + FL2_FRAME_INDEX_ENTRY_SIZE
+        || MEM_readLE32(index) != FL2_FRAME_INDEX_MAGIC
+        || (indexSize - FL2_FRAME_INDEX_MAGIC_SIZE) % FL2_FRAME_INDEX_ENTRY_SIZE != 0)
+        return FL2_ERROR(corruption_detected);
+
+    const BYTE* const entries = (const BYTE*)index + FL2_FRAME_INDEX_MAGIC_SIZE;
+    size_t const count = (indexSize - FL2_FRAME_INDEX_MAGIC_SIZE) / FL2_FRAME_INDEX_ENTRY_SIZE;
+
+    if (MEM_readLE64(entries) != 0 || MEM_readLE64(entries + 8) != 0)
+        return FL2_ERROR(corruption_detected);
+    for (size_t u = 1; u < count; ++u) {
+        const BYTE* const entry = entries + u * FL2_FRAME_INDEX_ENTRY_SIZE;
+        if (MEM_readLE64(entry) <= MEM_readLE64(entry - FL2_FRAME_INDEX_ENTRY_SIZE)
+            || MEM_readLE64(entry + 8) <= MEM_readLE64(entry - FL2_FRAME_INDEX_ENTRY_SIZE + 8))
+            return FL2_ERROR(corruption_detected);
+    }
+    return count;
+}
+
+FL2LIB_API unsigned long long FL2LIB_CALL FL2_findDecompressedSizeIndexed(const void* index, size_t indexSize)
+{
+    size_t const count = FL2_checkFrameIndex(index, indexSize);
+    if (FL2_isError(count))
+        return FL2_CONTENTSIZE_ERROR;
+    return MEM_readLE64((const BYTE*)index + FL2_FRAME_INDEX_MAGIC_SIZE + (count - 1) * FL2_FRAME_INDEX_ENTRY_SIZE + 8);
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_getIndexBlocks(const void* index, size_t indexSize,
+    FL2_blockInfo* blocks, size_t maxBlocks)
+{
+    size_t const count = FL2_checkFrameIndex(index, indexSize);
+    if (FL2_isError(count))
+        return count;
+
+    const BYTE* entry = (const BYTE*)index + FL2_FRAME_INDEX_MAGIC_SIZE;
+    size_t const nbBlocks = count - 1;
+
+    for (size_t u = 0; u < nbBlocks && u < maxBlocks && blocks != NULL; ++u, entry += FL2_FRAME_INDEX_ENTRY_SIZE) {
+        blocks[u].packPos = MEM_readLE64(entry);
+        blocks[u].packSize = MEM_readLE64(entry + FL2_FRAME_INDEX_ENTRY_SIZE) - blocks[u].packPos;
+        blocks[u].unpackPos = MEM_readLE64(entry + 8);
+        blocks[u].unpackSize = MEM_readLE64(entry + FL2_FRAME_INDEX_ENTRY_SIZE + 8) - blocks[u].unpackPos;
+    }
+    return nbBlocks;
+}
+
 typedef struct
 {
     LZMA2_DCtx* dec;
@@ -46,6 +103,9 @@ typedef struct
     size_t unpackPos;
     size_t unpackSize;
     size_t res;
+    size_t lookback;                /* output preceding a checkpoint block, or 0 */
+    const BYTE *lookbackData;
+    size_t decodeSize;              /* unpackSize less the next block's look-back */
     LZMA2_finishMode finish;
 } FL2_blockDecMt;
 
@@ -56,6 +116,10 @@ struct FL2_DCtx_s
     FL2_blockDecMt *blocks;
     FL2POOL_ctx *factory;
     size_t nbThreads;
+    const BYTE *cpEntry;            /* next checkpoint index entry, or NULL */
+    const BYTE *cpEnd;
+    const BYTE *frameIndex;         /* frame index entries, or NULL */
+    size_t frameEntries;
 #endif
     BYTE lzma2prop;
 };
@@ -107,6 +171,10 @@ FL2LIB_API FL2_DCtx *FL2LIB_CALL FL2_createDCtxMt(unsigned nbThreads)
     dctx->nbThreads = 1;
     dctx->blocks = NULL;
     dctx->factory = NULL;
+    dctx->cpEntry = NULL;
+    dctx->cpEnd = NULL;
+    dctx->frameIndex = NULL;
+    dctx->frameEntries = 0;
 
     if (nbThreads > 1) {
         dctx->blocks = malloc(nbThreads * sizeof(FL2_blockDecMt));
@@ -158,6 +226,36 @@ FL2LIB_API size_t FL2LIB_CALL FL2_freeDCtx(FL2_DCtx* dctx)
     return FL2_error_no_error;
 }
 
+static int FL2_isValidProbBits(unsigned const bits)
+{
+    return bits == LZMA_PROB_BITS_AUTO || bits == 16 || bits == 32;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_setDCtxProbBits(FL2_DCtx * dctx, unsigned bits)
+{
+    if (!FL2_isValidProbBits(bits))
+        return FL2_ERROR(parameter_outOfBound);
+
+    LZMA2_setProbBits(&dctx->dec, bits);
+#ifndef FL2_SINGLETHREAD
+    for (size_t thread = 1; thread < dctx->nbThreads; ++thread)
+        LZMA2_setProbBits(dctx->blocks[thread].dec, bits);
+#endif
+    return FL2_error_no_error;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_setDCtxThreadPool(FL2_DCtx * dctx, FL2_threadPool * pool, unsigned maxThreads)
+{
+#ifndef FL2_SINGLETHREAD
+    /* The calling thread decodes the first block */
+    if (FL2POOL_rebind(&dctx->factory, pool, dctx->nbThreads - 1, maxThreads))
+        return FL2_ERROR(memory_allocation);
+#else
+    (void)dctx, (void)pool, (void)maxThreads;
+#endif
+    return FL2_error_no_error;
+}
+
 #ifndef FL2_SINGLETHREAD
 
 FL2LIB_API unsigned FL2LIB_CALL FL2_getDCtxThreadCount(const FL2_DCtx * dctx)
@@ -173,11 +271,19 @@ static void FL2_decompressCtxBlock(void* const jobDescription, ptrdiff_t const n
 
     DEBUGLOG(4, "Thread %u: decoding block of input size %u, output size %u", (unsigned)n, (unsigned)srcLen, (unsigned)blocks[n].unpackSize);
 
-    blocks[n].res = LZMA2_decodeToDic(blocks[n].dec, blocks[n].unpackSize, blocks[n].src, &srcLen, blocks[n].finish);
+    blocks[n].res = LZMA2_decodeToDic(blocks[n].dec, blocks[n].lookback + blocks[n].decodeSize, blocks[n].src, &srcLen, blocks[n].finish);
 
-    /* If no error occurred, store into res the dic_pos value, which is the end of the decompressed data in the buffer */
+    /* If no error occurred, store into res the dic_pos value, which is the end of the decompressed data in the buffer.
+     * Output not decoded at the end is the next block's look-back, which is already in place. */
     if (!FL2_isError(blocks[n].res))
-        blocks[n].res = blocks[n].dec->dic_pos;
+        blocks[n].res = blocks[n].dec->dic_pos - blocks[n].lookback + blocks[n].unpackSize - blocks[n].decodeSize;
+}
+
+static size_t FL2_initBlockDecoderMt(FL2_blockDecMt* const block, BYTE const prop, BYTE *const dst)
+{
+    if (block->lookback == 0)
+        return LZMA2_initDecoder(block->dec, prop, dst + block->unpackPos, block->unpackSize);
+    return LZMA2_initDecoderAt(block->dec, prop, dst + block->unpackPos - block->lookback, block->lookback, block->unpackSize);
 }
 
 static size_t FL2_decompressCtxBlocksMt(FL2_DCtx* const dctx, const BYTE *const src, BYTE *const dst, size_t const dstCapacity, size_t const nbThreads)
@@ -191,6 +297,7 @@ static size_t FL2_decompressCtxBlocksMt(FL2_DCtx* const dctx, const BYTE *const
     blocks[0].packPos = 0;
     blocks[0].unpackPos = 0;
     blocks[0].src = src;
+    blocks[0].decodeSize = blocks[0].unpackSize;
 
     BYTE const prop = dctx->lzma2prop & FL2_LZMA_PROP_MASK;
 
@@ -198,16 +305,28 @@ static size_t FL2_decompressCtxBlocksMt(FL2_DCtx* const dctx, const BYTE *const
         blocks[thread].packPos = blocks[thread - 1].packPos + blocks[thread - 1].packSize;
         blocks[thread].unpackPos = blocks[thread - 1].unpackPos + blocks[thread - 1].unpackSize;
         blocks[thread].src = src + blocks[thread].packPos;
-        CHECK_F(LZMA2_initDecoder(blocks[thread].dec, prop, dst + blocks[thread].unpackPos, blocks[thread].unpackSize));
+        blocks[thread].decodeSize = blocks[thread].unpackSize;
+        CHECK_F(FL2_initBlockDecoderMt(blocks + thread, prop, dst));
     }
     if (dstCapacity < blocks[nbThreads - 1].unpackPos + blocks[nbThreads - 1].unpackSize)
         return FL2_ERROR(dstSize_tooSmall);
 
+    /* A checkpoint block's look-back is the end of the previous block, which is copied from
+     * the index instead of decoded so the blocks can run concurrently. Block 0's look-back
+     * was decoded in the previous round. */
+    for (size_t thread = 1; thread < nbThreads; ++thread) {
+        size_t const lookback = blocks[thread].lookback;
+        if (lookback != 0) {
+            memcpy(dst + blocks[thread].unpackPos - lookback, blocks[thread].lookbackData, lookback);
+            blocks[thread - 1].decodeSize -= lookback;
+        }
+    }
+
     /* Decompress thread 1..n */
     FL2POOL_addRange(dctx->factory, FL2_decompressCtxBlock, blocks, 1, nbThreads);
 
     /* Decompress thread 0 */
-    CHECK_F(LZMA2_initDecoder(blocks[0].dec, prop, dst + blocks[0].unpackPos, blocks[0].unpackSize));
+    CHECK_F(FL2_initBlockDecoderMt(blocks, prop, dst));
     FL2_decompressCtxBlock(blocks, 0);
 
     FL2POOL_waitAll(dctx->factory, 0);
@@ -227,9 +346,52 @@ static void FL2_resetMtBlocks(FL2_DCtx* const dctx)
         dctx->blocks[thread].finish = LZMA_FINISH_ANY;
         dctx->blocks[thread].packSize = 0;
         dctx->blocks[thread].unpackSize = 0;
+        dctx->blocks[thread].lookback = 0;
     }
 }
 
+/* Return the look-back size of the checkpoint index entry for the chunk at packPos, or 0 if
+ * none exists or it can't be used. The look-back must not reach before blockStart, the
+ * output position of the current block, and must preserve the position bits relative to
+ * the last dictionary reset at dictStart.
+ */
+static size_t FL2_findCheckpoint(FL2_DCtx* const dctx, const BYTE* const chunk,
+    U64 const packPos, size_t const unpackPos,
+    size_t const blockStart, size_t const dictStart, size_t const dictSize,
+    const BYTE** const lookbackData)
+{
+    while (dctx->cpEntry != NULL) {
+        const BYTE* const entry = dctx->cpEntry;
+        if ((size_t)(dctx->cpEnd - entry) < FL2_CHECKPOINT_ENTRY_SIZE
+            || (size_t)(dctx->cpEnd - entry) - FL2_CHECKPOINT_ENTRY_SIZE < MEM_readLE32(entry + 16)) {
+            /* Truncated */
+            dctx->cpEntry = NULL;
+            return 0;
+        }
+        U64 const entryPos = MEM_readLE64(entry);
+        if (entryPos > packPos)
+            return 0;
+
+        size_t const lookback = MEM_readLE32(entry + 16);
+        dctx->cpEntry = (entry + FL2_CHECKPOINT_ENTRY_SIZE + lookback < dctx->cpEnd) ? entry + FL2_CHECKPOINT_ENTRY_SIZE + lookback : NULL;
+        if (entryPos < packPos)
+            continue;
+
+        /* Checkpoints reset the state, or are stored and precede a chunk that does */
+        BYTE const control = chunk[0];
+        if (MEM_readLE64(entry + 8) != unpackPos
+            || ((control & 0xE0) != 0xC0 && control != 2)
+            || lookback == 0 || lookback > dictSize
+            || lookback > unpackPos - blockStart
+            || ((unpackPos - lookback - dictStart) & 0xF) != 0)
+            return 0;
+
+        *lookbackData = entry + FL2_CHECKPOINT_ENTRY_SIZE;
+        return lookback;
+    }
+    return 0;
+}
+
 /* Decompress an entire stream stored in memory */
 static size_t FL2_decompressDCtxMt(FL2_DCtx* const dctx,
     void* dst, size_t dstCapacity,
@@ -244,6 +406,12 @@ static size_t FL2_decompressDCtxMt(FL2_DCtx* const dctx,
     FL2_blockDecMt* const blocks = dctx->blocks;
     size_t thread = 0;
     size_t pos = 0;
+    /* Stream positions for locating checkpoints */
+    const BYTE* const srcStart = src;
+    size_t const dictSize = LZMA2_getDictSizeFromProp(dctx->lzma2prop & FL2_LZMA_PROP_MASK);
+    size_t unpackPos = 0;
+    size_t blockStart = 0;
+    size_t dictStart = 0;
     while (pos < srcSize) {
         LZMA2_chunk inf;
         int type = LZMA2_parseInput(src, pos, srcSize - pos, &inf);
@@ -256,7 +424,14 @@ static size_t FL2_decompressDCtxMt(FL2_DCtx* const dctx,
         if (pos == 0 && type == CHUNK_DICT_RESET)
             type = CHUNK_CONTINUE;
 
-        if (type == CHUNK_DICT_RESET || type == CHUNK_FINAL) {
+        /* A checkpoint also starts a new block */
+        const BYTE* lookbackData = NULL;
+        size_t const lookback = (type == CHUNK_CONTINUE && pos != 0)
+            ? FL2_findCheckpoint(dctx, (const BYTE*)src + pos, (size_t)((const BYTE*)src - srcStart) + pos, unpackPos,
+                blockStart, dictStart, dictSize, &lookbackData)
+            : 0;
+
+        if (type == CHUNK_DICT_RESET || type == CHUNK_FINAL || lookback != 0) {
             if (type == CHUNK_FINAL) {
                 /* The finish value will be passed to the decoder */
                 blocks[thread].finish = LZMA_FINISH_END;
@@ -266,8 +441,9 @@ static size_t FL2_decompressDCtxMt(FL2_DCtx* const dctx,
             }
             /* Move to the next thread. Decoding will begin if all threads are used. */
             ++thread;
+            blockStart = unpackPos;
         }
-        if (type == CHUNK_FINAL || (type == CHUNK_DICT_RESET && thread == dctx->nbThreads)) {
+        if (type == CHUNK_FINAL || thread == dctx->nbThreads) {
             size_t res = FL2_decompressCtxBlocksMt(dctx, (BYTE*)src, dst, dstCapacity, thread);
             if (FL2_isError(res))
                 return res;
@@ -281,7 +457,7 @@ static size_t FL2_decompressDCtxMt(FL2_DCtx* const dctx,
             if (type == CHUNK_FINAL)
                 return LZMA_STATUS_FINISHED;
 
-            /* Only excecuted at a dict reset. pos is the location of the reset */
+            /* Only excecuted at a dict reset or checkpoint. pos is the location of the chunk */
             src = (BYTE*)src + pos;
             srcSize -= pos;
             dst = (BYTE*)dst + res;
@@ -293,14 +469,98 @@ static size_t FL2_decompressDCtxMt(FL2_DCtx* const dctx,
         }
         else {
             /* Not the end or a dict reset, so add it to the current block */
+            BYTE const control = ((const BYTE*)src)[pos];
+            if (control == 1 || control >= 0xE0)
+                dictStart = unpackPos;
             blocks[thread].packSize += inf.pack_size;
             blocks[thread].unpackSize += inf.unpack_size;
+            unpackPos += inf.unpack_size;
             pos += inf.pack_size;
         }
+        if (lookback != 0) {
+            blocks[thread].lookback = lookback;
+            blocks[thread].lookbackData = lookbackData;
+        }
     }
     return FL2_ERROR(srcSize_wrong);
 }
 
+/* Decompress an entire stream stored in memory, assigning the dictionary reset blocks listed
+ * in the frame index to threads without parsing the chunk headers first */
+static size_t FL2_decompressDCtxFramed(FL2_DCtx* const dctx,
+    void* const dst, size_t const dstCapacity,
+    const void* const src, size_t *const srcLen)
+{
+    const BYTE* const srcBuf = src;
+    const BYTE* const entries = dctx->frameIndex;
+    size_t const nbBlocks = dctx->frameEntries - 1;
+    const BYTE* const last = entries + nbBlocks * FL2_FRAME_INDEX_ENTRY_SIZE;
+    U64 const packEnd = MEM_readLE64(last);
+    U64 const unpackEnd = MEM_readLE64(last + 8);
+
+    if (packEnd >= *srcLen)
+        return FL2_ERROR(srcSize_wrong);
+    /* End marker */
+    if (srcBuf[packEnd] != 0)
+        return FL2_ERROR(corruption_detected);
+    if (unpackEnd > dstCapacity)
+        return FL2_ERROR(dstSize_tooSmall);
+
+    for (size_t block = 0; block < nbBlocks;) {
+        size_t const nbThreads = MIN(dctx->nbThreads, nbBlocks - block);
+        const BYTE* const first = entries + block * FL2_FRAME_INDEX_ENTRY_SIZE;
+        size_t const packPos = (size_t)MEM_readLE64(first);
+        size_t const unpackPos = (size_t)MEM_readLE64(first + 8);
+
+        FL2_resetMtBlocks(dctx);
+        for (size_t thread = 0; thread < nbThreads; ++thread) {
+            const BYTE* const entry = first + thread * FL2_FRAME_INDEX_ENTRY_SIZE;
+            BYTE const control = srcBuf[MEM_readLE64(entry)];
+            /* Each block must start with a dictionary reset */
+            if (control != 1 && control < 0xE0)
+                return FL2_ERROR(corruption_detected);
+            dctx->blocks[thread].packSize = (size_t)(MEM_readLE64(entry + FL2_FRAME_INDEX_ENTRY_SIZE) - MEM_readLE64(entry));
+            dctx->blocks[thread].unpackSize = (size_t)(MEM_readLE64(entry + FL2_FRAME_INDEX_ENTRY_SIZE + 8) - MEM_readLE64(entry + 8));
+        }
+        block += nbThreads;
+        if (block == nbBlocks) {
+            /* The last block includes the end marker */
+            dctx->blocks[nbThreads - 1].finish = LZMA_FINISH_END;
+            ++dctx->blocks[nbThreads - 1].packSize;
+        }
+
+        size_t const res = FL2_decompressCtxBlocksMt(dctx, srcBuf + packPos, (BYTE*)dst + unpackPos, dstCapacity - unpackPos, nbThreads);
+        if (FL2_isError(res))
+            return res;
+        if (res != (size_t)MEM_readLE64(entries + block * FL2_FRAME_INDEX_ENTRY_SIZE + 8) - unpackPos)
+            return FL2_ERROR(corruption_detected);
+    }
+    dctx->dec.dic_pos = (size_t)unpackEnd;
+    *srcLen = (size_t)packEnd + 1;
+
+    return LZMA_STATUS_FINISHED;
+}
+
+#endif
+
+#ifndef NO_XXHASH
+static size_t FL2_checkHash(const void* const dst, size_t const dicPos,
+    const BYTE* const srcBuf, size_t const srcSize, size_t const srcPos)
+{
+    XXH32_canonical_t canonical;
+    U32 hash;
+
+    DEBUGLOG(4, "Checking hash");
+
+    if (srcSize - srcPos < XXHASH_SIZEOF)
+        return FL2_ERROR(srcSize_wrong);
+
+    memcpy(&canonical, srcBuf + srcPos, XXHASH_SIZEOF);
+    hash = XXH32_hashFromCanonical(&canonical);
+    if (hash != XXH32(dst, dicPos, 0))
+        return FL2_ERROR(checksum_wrong);
+    return 0;
+}
 #endif
 
 FL2LIB_API size_t FL2LIB_CALL FL2_initDCtx(FL2_DCtx * dctx, unsigned char prop)
@@ -339,7 +599,9 @@ FL2LIB_API size_t FL2LIB_CALL FL2_decompressDCtx(FL2_DCtx* dctx,
 #ifndef FL2_SINGLETHREAD
     if (dctx->blocks != NULL) {
         dctx->lzma2prop = prop;
-        res = FL2_decompressDCtxMt(dctx, dst, dstCapacity, srcBuf, &srcPos);
+        res = (dctx->frameIndex != NULL)
+            ? FL2_decompressDCtxFramed(dctx, dst, dstCapacity, srcBuf, &srcPos)
+            : FL2_decompressDCtxMt(dctx, dst, dstCapacity, srcBuf, &srcPos);
     }
     else 
 #endif
@@ -362,22 +624,353 @@ FL2LIB_API size_t FL2LIB_CALL FL2_decompressDCtx(FL2_DCtx* dctx,
     dicPos = dctx->dec.dic_pos - dicPos;
 
 #ifndef NO_XXHASH
-    if (doHash) {
-        XXH32_canonical_t canonical;
-        U32 hash;
+    if (doHash)
+        CHECK_F(FL2_checkHash(dst, dicPos, srcBuf, srcSize, srcPos));
+#endif
+    return dicPos;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_decompressDCtxIndexed(FL2_DCtx* dctx,
+    void* dst, size_t dstCapacity,
+    const void* src, size_t srcSize,
+    const void* index, size_t indexSize)
+{
+#ifndef FL2_SINGLETHREAD
+    if (index != NULL && indexSize != 0) {
+        if (indexSize >= FL2_FRAME_INDEX_MAGIC_SIZE && MEM_readLE32(index) == FL2_FRAME_INDEX_MAGIC) {
+            size_t const count = FL2_checkFrameIndex(index, indexSize);
+            if (FL2_isError(count))
+                return count;
+            dctx->frameIndex = (const BYTE*)index + FL2_FRAME_INDEX_MAGIC_SIZE;
+            dctx->frameEntries = count;
+        }
+        else {
+            if (indexSize < FL2_CHECKPOINT_MAGIC_SIZE || MEM_readLE32(index) != FL2_CHECKPOINT_MAGIC)
+                return FL2_ERROR(corruption_detected);
+            dctx->cpEntry = (const BYTE*)index + FL2_CHECKPOINT_MAGIC_SIZE;
+            dctx->cpEnd = (const BYTE*)index + indexSize;
+        }
+    }
+    size_t const res = FL2_decompressDCtx(dctx, dst, dstCapacity, src, srcSize);
+
+    dctx->cpEntry = NULL;
+    dctx->cpEnd = NULL;
+    dctx->frameIndex = NULL;
+    dctx->frameEntries = 0;
 
-        DEBUGLOG(4, "Checking hash");
+    return res;
+#else
+    (void)index;
+    (void)indexSize;
+    return FL2_decompressDCtx(dctx, dst, dstCapacity, src, srcSize);
+#endif
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_decompressFile(FL2_DCtx* dctx, int dstFd, int srcFd)
+{
+    /* The property byte is needed to find the decompressed size */
+    if (dctx->lzma2prop != LZMA2_PROP_UNINITIALIZED)
+        return FL2_ERROR(parameter_unsupported);
+
+    FL2_mapping src;
+    CHECK_F(FL2_mapFile(&src, srcFd));
 
-        if (srcSize - srcPos < XXHASH_SIZEOF)
+    size_t res = FL2_ERROR(srcSize_wrong);
+    U64 const dSize = FL2_findDecompressedSize(src.data, src.size);
+
+    if (src.size == 0 || dSize == FL2_CONTENTSIZE_ERROR) {
+        FL2_unmapFile(&src);
+        return res;
+    }
+    if (dSize > (size_t)-1) {
+        FL2_unmapFile(&src);
+        return FL2_ERROR(dstSize_tooSmall);
+    }
+    DEBUGLOG(4, "FL2_decompressFile : %u bytes => %u bytes", (unsigned)src.size, (unsigned)dSize);
+
+    /* Reset blocks are decoded by the pool threads in parallel, so the whole input is needed */
+    FL2_adviseWillNeed(&src, 0, src.size);
+
+    FL2_mapping dst;
+    res = FL2_mapFileOutput(&dst, dstFd, (size_t)dSize);
+    if (!FL2_isError(res)) {
+        /* An empty stream is decoded into a dummy buffer because the decoder allocates its own if dst is NULL */
+        BYTE empty;
+        res = FL2_decompressDCtx(dctx, dSize ? dst.data : &empty, (size_t)dSize, src.data, src.size);
+        if (!FL2_isError(res) && res != dSize)
+            res = FL2_ERROR(corruption_detected);
+        FL2_unmapFile(&dst);
+    }
+    /* Don't leave a full-size file of partly decoded data */
+    if (FL2_isError(res))
+        FL2_truncateFile(dstFd, 0);
+    FL2_unmapFile(&src);
+
+    return res;
+}
+
+/* Find the last dictionary reset at or before the chunk containing unpack position offset.
+ * Returns the input position of the reset chunk and stores its unpack position in resetPos,
+ * or returns srcSize if the frame ends before offset. */
+static size_t FL2_findResetPoint(const BYTE* const src, size_t const srcSize,
+    unsigned long long const offset, unsigned long long* const resetPos)
+{
+    unsigned long long unpackPos = 0;
+    size_t resetPackPos = 0;
+    size_t pos = 0;
+
+    *resetPos = 0;
+    while (pos < srcSize) {
+        LZMA2_chunk inf;
+        LZMA2_parseRes const type = LZMA2_parseInput(src, pos, srcSize - pos, &inf);
+
+        if (type == CHUNK_ERROR || type == CHUNK_MORE_DATA)
+            return FL2_ERROR(corruption_detected);
+        if (type == CHUNK_FINAL)
+            break;
+
+        /* An uncompressed chunk with control byte 1 also resets the dictionary */
+        if (type == CHUNK_DICT_RESET || src[pos] == 1) {
+            resetPackPos = pos;
+            *resetPos = unpackPos;
+        }
+        unpackPos += inf.unpack_size;
+        if (unpackPos > offset)
+            return resetPackPos;
+        pos += inf.pack_size;
+    }
+    return srcSize;
+}
+
+/* Find the last block in a validated frame index which starts at or before offset.
+ * Returns the input position of its reset chunk and stores its unpack position in resetPos,
+ * or returns srcSize if the frame ends before offset. */
+static size_t FL2_findIndexedResetPoint(const BYTE* const entries, size_t const count, size_t const srcSize,
+    unsigned long long const offset, unsigned long long* const resetPos)
+{
+    *resetPos = 0;
+    if (offset >= MEM_readLE64(entries + (count - 1) * FL2_FRAME_INDEX_ENTRY_SIZE + 8))
+        return srcSize;
+
+    /* Entry 0 is at 0 and the last is beyond offset */
+    size_t low = 0;
+    size_t high = count - 1;
+    while (high - low > 1) {
+        size_t const mid = (low + high) / 2;
+        if (MEM_readLE64(entries + mid * FL2_FRAME_INDEX_ENTRY_SIZE + 8) <= offset)
+            low = mid;
+        else
+            high = mid;
+    }
+    U64 const packPos = MEM_readLE64(entries + low * FL2_FRAME_INDEX_ENTRY_SIZE);
+    if (packPos >= srcSize)
+        return FL2_ERROR(srcSize_wrong);
+
+    *resetPos = MEM_readLE64(entries + low * FL2_FRAME_INDEX_ENTRY_SIZE + 8);
+    return (size_t)packPos;
+}
+
+/* Decompress a range of a frame, locating the reset with the frame index entries if not NULL */
+static size_t FL2_decompressRange_internal(FL2_DCtx* const dctx,
+    void* const dst, size_t const dstCapacity,
+    const void* const src, size_t srcSize,
+    unsigned long long const offset,
+    const BYTE* const entries, size_t const count)
+{
+    BYTE prop = dctx->lzma2prop;
+    const BYTE *srcBuf = src;
+
+    if (prop == LZMA2_PROP_UNINITIALIZED) {
+        if (srcSize == 0)
             return FL2_ERROR(srcSize_wrong);
+        prop = *(const BYTE*)src;
+        ++srcBuf;
+        --srcSize;
+    }
+    dctx->lzma2prop = LZMA2_PROP_UNINITIALIZED;
+    prop &= FL2_LZMA_PROP_MASK;
+
+    unsigned long long resetPos;
+    size_t const start = (entries != NULL)
+        ? FL2_findIndexedResetPoint(entries, count, srcSize, offset, &resetPos)
+        : FL2_findResetPoint(srcBuf, srcSize, offset, &resetPos);
+    if (FL2_isError(start))
+        return start;
+    /* Offset is at or beyond the end of the frame */
+    if (start == srcSize || dstCapacity == 0)
+        return 0;
 
-        memcpy(&canonical, srcBuf + srcPos, XXHASH_SIZEOF);
-        hash = XXH32_hashFromCanonical(&canonical);
-        if (hash != XXH32(dst, dicPos, 0))
-            return FL2_ERROR(checksum_wrong);
+    DEBUGLOG(4, "FL2_decompressRange : offset %llu, reset at unpack pos %llu, pack pos %u", offset, resetPos, (unsigned)start);
+
+    LZMA2_DCtx* const dec = &dctx->dec;
+    CHECK_F(LZMA2_initDecoder(dec, prop, NULL, 0));
+
+    srcBuf += start;
+    srcSize -= start;
+
+    /* Decode and discard everything between the reset and the offset, wrapping in the dictionary buffer */
+    unsigned long long skip = offset - resetPos;
+    while (skip > 0) {
+        if (dec->dic_pos == dec->dic_buf_size)
+            dec->dic_pos = 0;
+
+        size_t const dicPos = dec->dic_pos;
+        size_t outCur = dec->dic_buf_size - dicPos;
+        if (outCur > skip)
+            outCur = (size_t)skip;
+
+        size_t inCur = srcSize;
+        size_t const res = LZMA2_decodeToDic(dec, dicPos + outCur, srcBuf, &inCur, LZMA_FINISH_ANY);
+        if (FL2_isError(res))
+            return res;
+
+        srcBuf += inCur;
+        srcSize -= inCur;
+        outCur = dec->dic_pos - dicPos;
+        skip -= outCur;
+        if (skip > 0 && (res == LZMA_STATUS_FINISHED || (outCur == 0 && inCur == 0)))
+            return FL2_ERROR(srcSize_wrong);
     }
+
+    size_t dstLen = dstCapacity;
+    size_t srcLen = srcSize;
+    size_t const res = LZMA2_decodeToBuf(dec, dst, &dstLen, srcBuf, &srcLen, LZMA_FINISH_ANY);
+    if (FL2_isError(res))
+        return res;
+    /* The frame may legitimately end before dstCapacity, but not without its end marker */
+    if (dstLen < dstCapacity && res != LZMA_STATUS_FINISHED)
+        return FL2_ERROR(srcSize_wrong);
+
+    return dstLen;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_decompressRange(FL2_DCtx* dctx,
+    void* dst, size_t dstCapacity,
+    const void* src, size_t srcSize,
+    unsigned long long offset)
+{
+    return FL2_decompressRange_internal(dctx, dst, dstCapacity, src, srcSize, offset, NULL, 0);
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_decompressRangeIndexed(FL2_DCtx* dctx,
+    void* dst, size_t dstCapacity,
+    const void* src, size_t srcSize,
+    unsigned long long offset,
+    const void* index, size_t indexSize)
+{
+    size_t const count = FL2_checkFrameIndex(index, indexSize);
+    if (FL2_isError(count))
+        return count;
+    return FL2_decompressRange_internal(dctx, dst, dstCapacity, src, srcSize, offset,
+        (const BYTE*)index + FL2_FRAME_INDEX_MAGIC_SIZE, count);
+}
+
+/* Decompress one complete frame, including its property byte, into dst using dec */
+static size_t FL2_decompressFrame(LZMA2_DCtx* const dec,
+    void* const dst, size_t const dstCapacity,
+    const void* const src, size_t srcSize)
+{
+    if (srcSize == 0)
+        return FL2_ERROR(srcSize_wrong);
+
+    const BYTE* const srcBuf = (const BYTE*)src + 1;
+    BYTE prop = *(const BYTE*)src;
+    --srcSize;
+
+#ifndef NO_XXHASH
+    BYTE const doHash = prop >> FL2_PROP_HASH_BIT;
 #endif
-    return dicPos;
+    prop &= FL2_LZMA_PROP_MASK;
+
+    CHECK_F(LZMA2_initDecoder(dec, prop, dst, dstCapacity));
+
+    size_t srcPos = srcSize;
+    size_t const res = LZMA2_decodeToDic(dec, dstCapacity, srcBuf, &srcPos, LZMA_FINISH_END);
+
+    if (FL2_isError(res))
+        return res;
+    if (res == LZMA_STATUS_NEEDS_MORE_INPUT)
+        return FL2_ERROR(srcSize_wrong);
+
+#ifndef NO_XXHASH
+    if (doHash)
+        CHECK_F(FL2_checkHash(dst, dec->dic_pos, srcBuf, srcSize, srcPos));
+#endif
+    return dec->dic_pos;
+}
+
+typedef struct
+{
+    void* const* dsts;
+    const size_t* dstCapacities;
+    const void* const* srcs;
+    const size_t* srcSizes;
+    size_t* results;
+    size_t nbFrames;
+    FL2_DCtx* dctx;
+    FL2_atomic next;
+} FL2_batchDecJob;
+
+/* FL2_decompressBatchThread() : FL2POOL_function type
+ * Each thread claims the next undecoded frame until none remain, so uneven frame sizes balance out */
+static void FL2_decompressBatchThread(void* const jobDescription, ptrdiff_t const n)
+{
+    FL2_batchDecJob* const job = (FL2_batchDecJob*)jobDescription;
+    LZMA2_DCtx* dec = &job->dctx->dec;
+#ifndef FL2_SINGLETHREAD
+    if (n != 0)
+        dec = job->dctx->blocks[n].dec;
+#else
+    (void)n;
+#endif
+
+    for (;;) {
+        size_t const index = (size_t)FL2_atomic_increment(job->next);
+        if (index >= job->nbFrames)
+            break;
+        job->results[index] = FL2_decompressFrame(dec,
+            job->dsts[index], job->dstCapacities[index],
+            job->srcs[index], job->srcSizes[index]);
+    }
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_decompressDCtxBatch(FL2_DCtx* dctx,
+    void* const* dsts, const size_t* dstCapacities,
+    const void* const* srcs, const size_t* srcSizes,
+    size_t* results, size_t nbFrames)
+{
+    FL2_batchDecJob job;
+    job.dsts = dsts;
+    job.dstCapacities = dstCapacities;
+    job.srcs = srcs;
+    job.srcSizes = srcSizes;
+    job.results = results;
+    job.nbFrames = nbFrames;
+    job.dctx = dctx;
+    job.next = ATOMIC_INITIAL_VALUE;
+
+    DEBUGLOG(4, "FL2_decompressDCtxBatch : %u frames", (unsigned)nbFrames);
+
+#ifndef FL2_SINGLETHREAD
+    if (dctx->blocks != NULL && nbFrames > 1) {
+        size_t const nbThreads = MIN(dctx->nbThreads, nbFrames);
+
+        FL2POOL_addRange(dctx->factory, FL2_decompressBatchThread, &job, 1, nbThreads);
+        FL2_decompressBatchThread(&job, 0);
+        FL2POOL_waitAll(dctx->factory, 0);
+    }
+    else
+#endif
+    {
+        FL2_decompressBatchThread(&job, 0);
+    }
+
+    dctx->lzma2prop = LZMA2_PROP_UNINITIALIZED;
+
+    for (size_t i = 0; i < nbFrames; ++i)
+        if (FL2_isError(results[i]))
+            return results[i];
+    return 0;
 }
 
 /*===== Streaming decompression functions =====*/
@@ -386,9 +979,6 @@ typedef enum
 {
     FL2DEC_STAGE_INIT,
     FL2DEC_STAGE_DECOMP,
-#ifndef FL2_SINGLETHREAD
-    FL2DEC_STAGE_MT_WRITE,
-#endif
     FL2DEC_STAGE_HASH,
     FL2DEC_STAGE_FINISHED
 } FL2_decStage;
@@ -396,10 +986,15 @@ typedef enum
 #ifndef FL2_SINGLETHREAD
 typedef struct FL2_decInbuf_s FL2_decInbuf;
 
+/* Input buffer node. Consecutive nodes overlap by LZMA_REQUIRED_INPUT_MAX bytes.
+ * In resident input mode a node may reference the caller's input instead of inBuf. */
 struct FL2_decInbuf_s
 {
     FL2_decInbuf *next;
+    const BYTE *data;   /* inBuf, or the caller's input */
     size_t length;
+    size_t capacity;    /* size of inBuf */
+    U64 streamPos;      /* input stream position of data if it is the caller's input */
     BYTE inBuf[1];
 };
 
@@ -416,24 +1011,41 @@ typedef struct
 {
     LZMA2_DCtx dec;
     FL2_decBlock inBlock;
+    BYTE *dst;          /* outBuf, or the caller's output in resident output mode */
     BYTE *outBuf;
-    size_t bufSize;
+    size_t bufSize;     /* decompressed size of the block */
+    size_t bufCapacity; /* allocated size of outBuf, which is kept for reuse */
     size_t res;
+    BYTE isLast; /* block ends with the terminator */
+    BYTE done;   /* decoding finished. Protected by doneMutex. */
 } FL2_decJob;
 
+/* Blocks are dispatched to the pool as soon as their input is complete and written out in
+ * order. Jobs are numbered consecutively and job n uses slot n % maxJobs. Under memory
+ * pressure the number of jobs in progress is limited to jobLimit, which rises again as
+ * memory is released. */
 typedef struct
 {
     FL2POOL_ctx* factory;
     FL2_decInbuf *head;
     FL2_decInbuf *cur;
     size_t curPos;
-    size_t numThreads;
+    FL2_decBlock load;  /* block being read from the input */
+    size_t jobHead;     /* oldest job not yet written out */
+    size_t jobEnd;      /* next job to dispatch */
+    size_t maxJobs;
     size_t maxThreads;
-    size_t srcThread;
+    size_t jobLimit;    /* jobs allowed in progress, <= maxJobs */
     size_t srcPos;
     size_t memTotal;
     size_t memLimit;
+    U64 inputBase;      /* input stream position of the caller's input->src */
+    FL2_pthread_mutex_t doneMutex;
+    FL2_pthread_cond_t doneCond;
+    BYTE loadDone;      /* load is complete but no slot or memory was free for it */
     BYTE isFinal;
+    BYTE residentInput;
+    BYTE residentOutput;
     BYTE failState;
     BYTE canceled;
     BYTE prop;
@@ -457,6 +1069,7 @@ struct FL2_DStream_s
     FL2_inBuffer* asyncInput;
     size_t asyncRes;
     U64 streamTotal;
+    U64 inputTotal;
     size_t overlapSize;
     FL2_atomic progress;
     unsigned timeout;
@@ -469,15 +1082,89 @@ struct FL2_DStream_s
     BYTE doHash;
     BYTE loopCount;
     BYTE wait;
+    BYTE residentOutput; /* caller's output buffer may be used as the dictionary */
+    BYTE residentInput;  /* MT decoder may reference the caller's input */
+    BYTE dicPending;     /* decoder init deferred until the output buffer is known */
+    BYTE dicIsOutput;    /* decoding directly into the caller's output buffer */
+    BYTE dicProp;
     BYTE overlap[LZMA_OVERLAP_SIZE];
 };
 
+/* Initialize the single-threaded decoder. In resident output mode the init is deferred
+ * until the first output buffer is presented. */
+static size_t FL2_initSingleDecoder(FL2_DStream* const fds, BYTE const prop)
+{
+    if (fds->residentOutput) {
+        fds->dicProp = prop;
+        fds->dicPending = 1;
+        return FL2_error_no_error;
+    }
+    return LZMA2_initDecoder(&fds->dec, prop, NULL, 0);
+}
+
+/* Use the caller's output buffer as the dictionary if it can hold at least one dictionary,
+ * otherwise fall back to an internal dictionary and copying */
+static size_t FL2_initResidentDecoder(FL2_DStream* const fds, FL2_outBuffer* const output)
+{
+    size_t const dictSize = LZMA2_getDictSizeFromProp(fds->dicProp);
+
+    fds->dicPending = 0;
+    fds->dicIsOutput = 0;
+
+    if (output->size < dictSize || output->pos > output->size)
+        return LZMA2_initDecoder(&fds->dec, fds->dicProp, NULL, 0);
+
+    CHECK_F(LZMA2_initDecoder(&fds->dec, fds->dicProp, (BYTE*)output->dst, output->size));
+    /* No match can reference data before the stream start, so decoding may begin at pos */
+    fds->dec.dic_pos = output->pos;
+    fds->dicIsOutput = 1;
+
+    DEBUGLOG(4, "Decoding into resident output buffer of size %u", (unsigned)output->size);
+
+    return FL2_error_no_error;
+}
+
+/* Decode directly into the caller's output buffer, which is the dictionary. The same buffer
+ * must be presented on each call. The position may be wrapped to zero only when it reaches
+ * the end of the buffer, and the data must not be modified. */
+static size_t FL2_decodeToOutput(FL2_DStream* const fds, FL2_outBuffer* const output,
+    const BYTE* const src, size_t* const srcSize, size_t* const destSize)
+{
+    LZMA2_DCtx *const dec = &fds->dec;
+
+    *destSize = 0;
+    if ((BYTE*)output->dst != dec->dic || output->size != dec->dic_buf_size) {
+        *srcSize = 0;
+        return FL2_ERROR(buffer);
+    }
+    if (output->pos != dec->dic_pos) {
+        if (output->pos != 0 || dec->dic_pos != dec->dic_buf_size) {
+            *srcSize = 0;
+            return FL2_ERROR(buffer);
+        }
+        dec->dic_pos = 0;
+    }
+
+    size_t const res = LZMA2_decodeToDic(dec, dec->dic_buf_size, src, srcSize, LZMA_FINISH_ANY);
+
+    *destSize = dec->dic_pos - output->pos;
+    return res;
+}
+
 static size_t FL2_decompressInput(FL2_DStream* fds, FL2_outBuffer* output, FL2_inBuffer* input)
 {
     if (fds->stage == FL2DEC_STAGE_DECOMP) {
         size_t destSize = output->size - output->pos;
         size_t srcSize = input->size - input->pos;
-        size_t const res = LZMA2_decodeToBuf(&fds->dec, (BYTE*)output->dst + output->pos, &destSize, (const BYTE*)input->src + input->pos, &srcSize, LZMA_FINISH_ANY);
+        size_t res;
+
+        if (fds->dicPending)
+            CHECK_F(FL2_initResidentDecoder(fds, output));
+
+        if (fds->dicIsOutput)
+            res = FL2_decodeToOutput(fds, output, (const BYTE*)input->src + input->pos, &srcSize, &destSize);
+        else
+            res = LZMA2_decodeToBuf(&fds->dec, (BYTE*)output->dst + output->pos, &destSize, (const BYTE*)input->src + input->pos, &srcSize, LZMA_FINISH_ANY);
 
         DEBUGLOG(5, "Decoded %u bytes", (U32)destSize);
 
@@ -536,13 +1223,23 @@ static size_t FL2_decompressOverlappedInput(FL2_DStream* fds, FL2_outBuffer* out
 
 #ifndef FL2_SINGLETHREAD
 
+static size_t LZMA2_inbufNodeSize(size_t const capacity)
+{
+    return sizeof(FL2_decInbuf) - 1 + capacity;
+}
+
+static int LZMA2_isInbufNodeFull(const FL2_decInbuf *const node)
+{
+    return node->data != node->inBuf || node->length >= node->capacity;
+}
+
 /* Free buffer nodes from node to the end, except keep */
 static void LZMA2_freeInbufNodeChain(FL2_decMt *const decmt, FL2_decInbuf *node, FL2_decInbuf *const keep)
 {
     while (node) {
         FL2_decInbuf *const next = node->next;
         if (node != keep) {
-            decmt->memTotal -= sizeof(FL2_decInbuf) + LZMA2_MT_INPUT_SIZE - 1;
+            decmt->memTotal -= LZMA2_inbufNodeSize(node->capacity);
             free(node);
         }
         else {
@@ -552,29 +1249,139 @@ static void LZMA2_freeInbufNodeChain(FL2_decMt *const decmt, FL2_decInbuf *node,
     }
 }
 
-/* Free all buffer nodes except the head */
+/* Free all buffer nodes except the head. The head is freed too if it is not a full-size
+ * buffer, and is then recreated when needed. */
 static void LZMA2_freeExtraInbufNodes(FL2_decMt *const decmt)
 {
+    if (decmt->head == NULL)
+        return;
+    if (decmt->head->data != decmt->head->inBuf || decmt->head->capacity != LZMA2_MT_INPUT_SIZE) {
+        LZMA2_freeInbufNodeChain(decmt, decmt->head, NULL);
+        decmt->head = NULL;
+        return;
+    }
     LZMA2_freeInbufNodeChain(decmt, decmt->head->next, NULL);
     decmt->head->next = NULL;
     decmt->head->length = 0;
 }
 
+/* Free buffer nodes preceding keep, which becomes the head */
+static void LZMA2_releaseInbufNodes(FL2_decMt *const decmt, FL2_decInbuf *const keep)
+{
+    while (decmt->head != keep) {
+        FL2_decInbuf *const next = decmt->head->next;
+        decmt->memTotal -= LZMA2_inbufNodeSize(decmt->head->capacity);
+        free(decmt->head);
+        decmt->head = next;
+    }
+}
+
+static FL2_decJob *FL2_jobSlotMt(FL2_decMt *const decmt, size_t const job)
+{
+    return decmt->threads + job % decmt->maxJobs;
+}
+
+static void FL2_freeOutputBuffer(FL2_decMt *const decmt, FL2_decJob *const job)
+{
+    if (job->outBuf != NULL) {
+        decmt->memTotal -= job->bufCapacity;
+        free(job->outBuf);
+        job->outBuf = NULL;
+        job->bufCapacity = 0;
+    }
+}
+
 static void FL2_freeOutputBuffers(FL2_decMt *const decmt)
 {
-    for (size_t thread = 0; thread < decmt->maxThreads; ++thread)
-        if(decmt->threads[thread].outBuf != NULL) {
-            decmt->memTotal -= decmt->threads[thread].bufSize;
-            free(decmt->threads[thread].outBuf);
-            decmt->threads[thread].outBuf = NULL;
-        }
-    decmt->numThreads = 0;
+    for (size_t slot = 0; slot < decmt->maxJobs; ++slot)
+        FL2_freeOutputBuffer(decmt, decmt->threads + slot);
+}
+
+static int FL2_isSlotIdleMt(const FL2_decMt *const decmt, size_t const slot)
+{
+    return (slot + decmt->maxJobs - decmt->jobHead % decmt->maxJobs) % decmt->maxJobs >= decmt->jobEnd - decmt->jobHead;
+}
+
+/* Free buffers held by idle slots until the total is within the limit */
+static void FL2_trimOutputBuffers(FL2_decMt *const decmt, size_t const limit)
+{
+    for (size_t slot = 0; slot < decmt->maxJobs && decmt->memTotal > limit; ++slot)
+        if (FL2_isSlotIdleMt(decmt, slot))
+            FL2_freeOutputBuffer(decmt, decmt->threads + slot);
+}
+
+/* Round size up to a size class so buffers for blocks of similar size are interchangeable.
+ * Classes are 1/8 of a power of 2 apart. */
+static size_t FL2_outBufferClass(size_t const size)
+{
+    if (size <= FL2_OUTBUF_CLASS_MIN)
+        return FL2_OUTBUF_CLASS_MIN;
+    if (size > ((size_t)1 << 31))
+        return size;
+    size_t const step = (size_t)1 << (ZSTD_highbit32((U32)(size - 1)) - 3);
+    return (size + step - 1) & ~(step - 1);
+}
+
+/* Provide an output buffer of at least bufSize bytes for the job.
+ * The smallest idle buffer that is large enough is moved to the job's slot. Otherwise
+ * a new one is allocated, freeing idle buffers if necessary to stay within the limit.
+ * Returns 0 on success, or 1 if the memory is not available.
+ */
+static int FL2_getOutputBuffer(FL2_decMt *const decmt, FL2_decJob *const job, size_t const bufSize)
+{
+    FL2_decJob *best = NULL;
+    for (size_t slot = 0; slot < decmt->maxJobs; ++slot) {
+        FL2_decJob *const idle = decmt->threads + slot;
+        if (FL2_isSlotIdleMt(decmt, slot) && idle->outBuf != NULL && idle->bufCapacity >= bufSize
+            && (best == NULL || idle->bufCapacity < best->bufCapacity))
+            best = idle;
+    }
+    if (best != NULL) {
+        BYTE *const outBuf = job->outBuf;
+        size_t const capacity = job->bufCapacity;
+        job->outBuf = best->outBuf;
+        job->bufCapacity = best->bufCapacity;
+        best->outBuf = outBuf;
+        best->bufCapacity = capacity;
+        return 0;
+    }
+    /* The job's own buffer is too small */
+    FL2_freeOutputBuffer(decmt, job);
+
+    size_t capacity = FL2_outBufferClass(bufSize);
+    if (decmt->memTotal + capacity > decmt->memLimit)
+        FL2_trimOutputBuffers(decmt, decmt->memLimit - MIN(capacity, decmt->memLimit));
+    /* Use the exact size if the rounded size will not fit */
+    if (decmt->memTotal + capacity > decmt->memLimit)
+        capacity = bufSize;
+    if (decmt->memTotal + capacity > decmt->memLimit)
+        return 1;
+
+    job->outBuf = malloc(capacity);
+    if (job->outBuf == NULL)
+        return 1;
+    job->bufCapacity = capacity;
+    decmt->memTotal += capacity;
+    return 0;
+}
+
+/* Cancel any jobs in progress and wait for them to exit */
+static void FL2_stopJobsMt(FL2_decMt *const decmt)
+{
+    if (decmt->jobHead != decmt->jobEnd) {
+        BYTE const canceled = decmt->canceled;
+        decmt->canceled = 1;
+        FL2POOL_waitAll(decmt->factory, 0);
+        decmt->canceled = canceled;
+    }
+    decmt->jobHead = 0;
+    decmt->jobEnd = 0;
 }
 
 static void FL2_lzma2DecMt_cleanup(FL2_decMt *const decmt)
 {
     if (decmt) {
-        FL2_freeOutputBuffers(decmt);
+        FL2_stopJobsMt(decmt);
         LZMA2_freeExtraInbufNodes(decmt);
     }
 }
@@ -582,9 +1389,12 @@ static void FL2_lzma2DecMt_cleanup(FL2_decMt *const decmt)
 static void FL2_lzma2DecMt_free(FL2_decMt *const decmt)
 {
     if (decmt) {
+        FL2_stopJobsMt(decmt);
         FL2_freeOutputBuffers(decmt);
         LZMA2_freeInbufNodeChain(decmt, decmt->head, NULL);
         FL2POOL_free(decmt->factory);
+        FL2_pthread_mutex_destroy(&decmt->doneMutex);
+        FL2_pthread_cond_destroy(&decmt->doneCond);
         free(decmt);
     }
 }
@@ -595,15 +1405,22 @@ static void FL2_lzma2DecMt_init(FL2_decMt *const decmt)
         decmt->cur = NULL;
         decmt->failState = 0;
         decmt->isFinal = 0;
+        decmt->loadDone = 0;
+        decmt->srcPos = 0;
+        decmt->jobLimit = decmt->maxJobs;
+        FL2_stopJobsMt(decmt);
         decmt->canceled = 0;
-        decmt->memTotal = 0;
-        FL2_freeOutputBuffers(decmt);
         LZMA2_freeExtraInbufNodes(decmt);
-        decmt->threads[0].inBlock.first = decmt->head;
-        decmt->threads[0].inBlock.last = decmt->head;
-        decmt->threads[0].inBlock.startPos = 0;
-        decmt->threads[0].inBlock.endPos = 0;
-        decmt->threads[0].inBlock.unpackSize = 0;
+        /* Output buffers are kept for reuse */
+        decmt->memTotal = 0;
+        for (size_t slot = 0; slot < decmt->maxJobs; ++slot)
+            decmt->memTotal += decmt->threads[slot].bufCapacity;
+        FL2_trimOutputBuffers(decmt, decmt->memLimit);
+        decmt->load.first = decmt->head;
+        decmt->load.last = decmt->head;
+        decmt->load.startPos = 0;
+        decmt->load.endPos = 0;
+        decmt->load.unpackSize = 0;
     }
 }
 
@@ -621,21 +1438,28 @@ static int FL2_lzma2DecMt_initProp(FL2_decMt *const decmt, BYTE prop)
     return 0;
 }
 
-static FL2_decInbuf * FL2_createInbufNode(FL2_decMt *const decmt, FL2_decInbuf *const prev)
+/* Create a node with capacity bytes of buffer, which must be at least
+ * LZMA_REQUIRED_INPUT_MAX if prev is not NULL. A capacity of zero is for a node that
+ * references the caller's input. */
+static FL2_decInbuf * FL2_createInbufNode(FL2_decMt *const decmt, FL2_decInbuf *const prev, size_t const capacity)
 {
-    decmt->memTotal += sizeof(FL2_decInbuf) + LZMA2_MT_INPUT_SIZE - 1;
-    if (decmt->memTotal > decmt->memLimit)
+    size_t const nodeSize = LZMA2_inbufNodeSize(capacity);
+    if (decmt->memTotal + nodeSize > decmt->memLimit)
         return NULL;
 
-    FL2_decInbuf *const node = malloc(sizeof(FL2_decInbuf) + LZMA2_MT_INPUT_SIZE - 1);
+    FL2_decInbuf *const node = malloc(nodeSize);
     if (node == NULL)
         return NULL;
+    decmt->memTotal += nodeSize;
 
     node->next = NULL;
+    node->data = node->inBuf;
     node->length = 0;
-    if (prev) {
+    node->capacity = capacity;
+    node->streamPos = 0;
+    if (prev && capacity) {
         /* Node buffers overlap by LZMA_REQUIRED_INPUT_MAX */
-        memcpy(node->inBuf, prev->inBuf + prev->length - LZMA_REQUIRED_INPUT_MAX, LZMA_REQUIRED_INPUT_MAX);
+        memcpy(node->inBuf, prev->data + prev->length - LZMA_REQUIRED_INPUT_MAX, LZMA_REQUIRED_INPUT_MAX);
         prev->next = node;
         node->length = LZMA_REQUIRED_INPUT_MAX;
     }
@@ -646,32 +1470,43 @@ static FL2_decMt *FL2_lzma2DecMt_create(unsigned maxThreads)
 {
     maxThreads += !maxThreads;
 
-    FL2_decMt *const decmt = malloc(sizeof(FL2_decMt) + (maxThreads - 1) * sizeof(FL2_decJob));
+    /* One job slot more than the thread count, so a finished block can be written out
+     * while all threads decode */
+    FL2_decMt *const decmt = malloc(sizeof(FL2_decMt) + maxThreads * sizeof(FL2_decJob));
     if (decmt == NULL)
         return NULL;
 
     decmt->memTotal = 0;
     decmt->memLimit = (size_t)1 << 29;
     decmt->maxThreads = 0;
-
-    /* The head always exists and is only freed on deallocation */
-    decmt->head = FL2_createInbufNode(decmt, NULL);
+    decmt->maxJobs = 0;
+    decmt->jobLimit = 0;
+    decmt->jobHead = 0;
+    decmt->jobEnd = 0;
+    decmt->factory = NULL;
+    (void)FL2_pthread_mutex_init(&decmt->doneMutex, NULL);
+    (void)FL2_pthread_cond_init(&decmt->doneCond, NULL);
+
+    /* The head is a full-size buffer which is reused for each stream */
+    decmt->head = FL2_createInbufNode(decmt, NULL, LZMA2_MT_INPUT_SIZE);
     if (decmt->head == NULL) {
-        free(decmt);
+        FL2_lzma2DecMt_free(decmt);
         return NULL;
     }
 
-    decmt->factory = FL2POOL_create(maxThreads - 1);
+    decmt->factory = FL2POOL_create(maxThreads);
 
-    if (maxThreads > 1 && decmt->factory == NULL) {
+    if (decmt->factory == NULL) {
         FL2_lzma2DecMt_free(decmt);
         return NULL;
     }
-    decmt->numThreads = 0;
     decmt->maxThreads = maxThreads;
+    decmt->maxJobs = maxThreads + 1;
 
-    for (size_t n = 0; n < maxThreads; ++n) {
+    for (size_t n = 0; n < decmt->maxJobs; ++n) {
+        decmt->threads[n].dst = NULL;
         decmt->threads[n].outBuf = NULL;
+        decmt->threads[n].bufCapacity = 0;
         LZMA_constructDCtx(&decmt->threads[n].dec);
     }
     FL2_lzma2DecMt_init(decmt);
@@ -694,7 +1529,7 @@ static LZMA2_parseRes FL2_parseMt(FL2_decBlock* const inBlock)
 
     while (inBlock->endPos < cur->length) {
         LZMA2_chunk inf;
-        res = LZMA2_parseInput(cur->inBuf, inBlock->endPos, cur->length - inBlock->endPos, &inf);
+        res = LZMA2_parseInput(cur->data, inBlock->endPos, cur->length - inBlock->endPos, &inf);
         if (first && res == CHUNK_DICT_RESET)
             res = CHUNK_CONTINUE;
         if (res != CHUNK_CONTINUE)
@@ -714,32 +1549,31 @@ static LZMA2_parseRes FL2_parseMt(FL2_decBlock* const inBlock)
  * the last chunk before the next dict reset, or the terminator.
  * The input is a chain of buffers.
  */
-static size_t FL2_decompressBlockMt(FL2_DStream* const fds, size_t const thread)
+static size_t FL2_decompressBlockMt(FL2_DStream* const fds, FL2_decJob *const ti)
 {
     FL2_decMt *const decmt = fds->decmt;
-    FL2_decJob *const ti = &decmt->threads[thread];
     LZMA2_DCtx *const dec = &ti->dec;
 
-    DEBUGLOG(4, "Thread %u: decoding block of size %u", (unsigned)thread, (unsigned)ti->bufSize);
+    DEBUGLOG(4, "Decoding block of size %u", (unsigned)ti->bufSize);
 
-    CHECK_F(LZMA2_initDecoder(dec, decmt->prop, ti->outBuf, ti->bufSize));
+    CHECK_F(LZMA2_initDecoder(dec, decmt->prop, ti->dst, ti->bufSize));
 
-    /* Input buffer node containing the starting chunk. If thread > 0 this is usually
-     * the last input buffer node of the previous thread. */
+    /* Input buffer node containing the starting chunk. This is usually
+     * the last input buffer node of the previous block. */
     FL2_decInbuf *cur = ti->inBlock.first;
     /* Position of the starting chunk. */
     size_t inPos = ti->inBlock.startPos;
-    /* Flag to indicate this block ends with the terminator */
-    BYTE const last = decmt->isFinal && (thread == decmt->numThreads - 1);
 
     while (!decmt->canceled) {
-        size_t srcSize = cur->length - inPos;
+        /* The block ends at inBlock.endPos. Input after it may be added or removed
+         * while the block is decoded. */
+        size_t srcSize = (cur == ti->inBlock.last ? ti->inBlock.endPos : cur->length) - inPos;
         size_t const dicPos = dec->dic_pos;
 
         size_t const res = LZMA2_decodeToDic(dec,
             ti->bufSize,
-            cur->inBuf + inPos, &srcSize,
-            last && cur == ti->inBlock.last ? LZMA_FINISH_END : LZMA_FINISH_ANY);
+            cur->data + inPos, &srcSize,
+            ti->isLast && cur == ti->inBlock.last ? LZMA_FINISH_END : LZMA_FINISH_ANY);
 
         CHECK_F(res);
 
@@ -765,17 +1599,55 @@ static size_t FL2_decompressBlockMt(FL2_DStream* const fds, size_t const thread)
     return FL2_error_no_error;
 }
 
+/* FL2_decompressBlock() : FL2POOL_function type */
+static void FL2_decompressBlock(void* const jobDescription, ptrdiff_t const n)
+{
+    FL2_DStream* const fds = (FL2_DStream*)jobDescription;
+    FL2_decMt *const decmt = fds->decmt;
+    FL2_decJob *const job = FL2_jobSlotMt(decmt, (size_t)n);
+
+    job->res = FL2_decompressBlockMt(fds, job);
+
+    FL2_pthread_mutex_lock(&decmt->doneMutex);
+    job->done = 1;
+    FL2_pthread_cond_signal(&decmt->doneCond);
+    FL2_pthread_mutex_unlock(&decmt->doneMutex);
+}
+
+/* Return nonzero if the job has finished, first waiting for it if wait is nonzero */
+static int FL2_isJobDoneMt(FL2_decMt *const decmt, FL2_decJob *const job, int const wait)
+{
+    FL2_pthread_mutex_lock(&decmt->doneMutex);
+    while (wait && !job->done)
+        FL2_pthread_cond_wait(&decmt->doneCond, &decmt->doneMutex);
+    int const done = job->done;
+    FL2_pthread_mutex_unlock(&decmt->doneMutex);
+    return done;
+}
+
 /*
- * Write the data from the output buffer of each thread.
+ * Write the data from the output buffers of finished jobs in order, releasing the
+ * buffers of each job once all of its data is written.
+ * If wait is nonzero and the output has room, wait for the oldest job to finish.
  */
-static size_t FL2_writeStreamBlocks(FL2_DStream* const fds, FL2_outBuffer* const output)
+static size_t FL2_writeStreamBlocks(FL2_DStream* const fds, FL2_outBuffer* const output, int wait)
 {
     FL2_decMt *const decmt = fds->decmt;
 
-    for (; decmt->srcThread < fds->decmt->numThreads; ++decmt->srcThread) {
-        FL2_decJob *thread = decmt->threads + decmt->srcThread;
-        size_t to_write = MIN(thread->bufSize - decmt->srcPos, output->size - output->pos);
-        memcpy((BYTE*)output->dst + output->pos, thread->outBuf + decmt->srcPos, to_write);
+    wait &= output->pos < output->size;
+
+    while (decmt->jobHead != decmt->jobEnd) {
+        FL2_decJob *const job = FL2_jobSlotMt(decmt, decmt->jobHead);
+        if (!FL2_isJobDoneMt(decmt, job, wait))
+            break;
+        CHECK_F(job->res);
+
+        size_t to_write = MIN(job->bufSize - decmt->srcPos, output->size - output->pos);
+        if (job->dst == job->outBuf)
+            memcpy((BYTE*)output->dst + output->pos, job->outBuf + decmt->srcPos, to_write);
+        /* Data decoded in place must be where the caller expects it */
+        else if ((BYTE*)output->dst + output->pos != job->dst + decmt->srcPos)
+            return FL2_ERROR(buffer);
 
 #ifndef NO_XXHASH
         if (fds->doHash)
@@ -784,106 +1656,178 @@ static size_t FL2_writeStreamBlocks(FL2_DStream* const fds, FL2_outBuffer* const
         decmt->srcPos += to_write;
         output->pos += to_write;
 
-        if (decmt->srcPos < thread->bufSize)
+        if (decmt->srcPos < job->bufSize)
             break;
 
+        /* All data written. The output buffer stays in the slot for reuse.
+         * Input nodes before the last are not needed by later blocks. */
         decmt->srcPos = 0;
+        LZMA2_releaseInbufNodes(decmt, job->inBlock.last);
+        ++decmt->jobHead;
+        /* Allow another job in progress if the limit has room for one more buffer like this one */
+        if (decmt->jobLimit < decmt->maxJobs && decmt->memTotal + job->bufCapacity <= decmt->memLimit)
+            ++decmt->jobLimit;
+        wait = 0;
     }
-    if (decmt->srcThread < fds->decmt->numThreads)
-        return 0;
-
-    FL2_freeOutputBuffers(fds->decmt);
-    fds->decmt->numThreads = 0;
-
-    return 1;
+    return FL2_error_no_error;
 }
 
-/* FL2_decompressBlock() : FL2POOL_function type */
-static void FL2_decompressBlock(void* const jobDescription, ptrdiff_t const n)
+/* Total size of the data not yet written out by jobs in progress */
+static size_t FL2_pendingOutputMt(FL2_decMt *const decmt)
 {
-    FL2_DStream* const fds = (FL2_DStream*)jobDescription;
-    fds->decmt->threads[n].res = FL2_decompressBlockMt(fds, n);
+    size_t total = 0;
+    for (size_t n = decmt->jobHead; n != decmt->jobEnd; ++n)
+        total += FL2_jobSlotMt(decmt, n)->bufSize;
+    return total - decmt->srcPos;
 }
 
-static size_t FL2_decompressBlocksMt(FL2_DStream* const fds)
+/* Memory for the next block is not available. Limit the jobs in progress to those already
+ * dispatched, which release memory as they are written out.
+ * Returns 0, or FL2_error_memory_allocation if no jobs are in progress.
+ */
+static size_t FL2_limitJobsMt(FL2_decMt *const decmt)
 {
-    /* Set the threads to work on the blocks */
-    FL2_decMt * const decmt = fds->decmt;
-    FL2POOL_addRange(decmt->factory, FL2_decompressBlock, fds, 1, decmt->numThreads);
-
-    /* Do block 0 in the main thread */
-    decmt->threads[0].res = FL2_decompressBlockMt(fds, 0);
-    FL2POOL_waitAll(fds->decmt->factory, 0);
+    size_t const inProgress = decmt->jobEnd - decmt->jobHead;
+    if (inProgress == 0)
+        return FL2_ERROR(memory_allocation);
+    if (inProgress < decmt->jobLimit) {
+        DEBUGLOG(3, "Limiting MT decompression to %u jobs. Memory: %u, limit %u", (unsigned)inProgress, (unsigned)decmt->memTotal, (unsigned)decmt->memLimit);
+        decmt->jobLimit = inProgress;
+    }
+    return 0;
+}
 
-    /* Free all input buffers except the last */
-    FL2_decInbuf *const keep = decmt->threads[decmt->numThreads - 1].inBlock.last;
-    LZMA2_freeInbufNodeChain(decmt, decmt->head, keep);
-    /* The last becomes the new head */
-    decmt->head = keep;
-    decmt->threads[0].inBlock.first = keep;
-    decmt->threads[0].inBlock.last = keep;
-    /* Initialize the start and end to the next chunk */
-    decmt->threads[0].inBlock.endPos = decmt->threads[decmt->numThreads - 1].inBlock.endPos;
-    decmt->threads[0].inBlock.startPos = decmt->threads[0].inBlock.endPos;
-    decmt->threads[0].inBlock.unpackSize = 0;
+/* Allocate the output buffer for the complete block in decmt->load, and dispatch it
+ * to the pool in a free job slot.
+ * In resident output mode the block is decoded in place if it will be written to the
+ * caller's buffer before the end is reached. The caller presents the same buffer on each call.
+ * Returns 1 if the block was dispatched, 0 if no slot or memory is free but jobs in
+ * progress will release some, or FL2_error_memory_allocation.
+ */
+static size_t FL2_dispatchBlockMt(FL2_DStream* const fds, FL2_outBuffer* const output)
+{
+    FL2_decMt *const decmt = fds->decmt;
 
-    for (size_t thread = 0; thread < decmt->numThreads; ++thread)
-        if (FL2_isError(decmt->threads[thread].res))
-            return decmt->threads[thread].res;
+    if (decmt->jobEnd - decmt->jobHead >= decmt->jobLimit)
+        return 0;
 
-    decmt->srcThread = 0;
-    decmt->srcPos = 0;
+    size_t const bufSize = decmt->load.unpackSize;
+    FL2_decJob *const job = FL2_jobSlotMt(decmt, decmt->jobEnd);
+    size_t const outPos = output->pos + FL2_pendingOutputMt(decmt);
+    if (decmt->residentOutput && output->pos <= output->size
+        && outPos <= output->size && bufSize <= output->size - outPos) {
+        job->dst = (BYTE*)output->dst + outPos;
+    }
+    /* Decompressed data will be stored in outBuf */
+    else if (FL2_getOutputBuffer(decmt, job, bufSize))
+        return FL2_limitJobsMt(decmt);
+    else
+        job->dst = job->outBuf;
+
+    job->inBlock = decmt->load;
+    job->bufSize = bufSize;
+    job->res = 0;
+    job->isLast = decmt->isFinal;
+    job->done = 0;
+    FL2POOL_append(decmt->factory, FL2_decompressBlock, fds, (ptrdiff_t)decmt->jobEnd);
+    ++decmt->jobEnd;
+
+    /* Set up the start of the next series of chunks. The first buffer is the last of those already loaded. */
+    decmt->load.first = decmt->load.last;
+    decmt->load.startPos = decmt->load.endPos;
+    decmt->load.unpackSize = 0;
+    decmt->loadDone = 0;
 
-    return FL2_error_no_error;
+    return 1;
 }
 
-static size_t FL2_handleFinalChunkMt(FL2_decMt *const decmt, size_t res)
+/* Return the input beyond the parse position to the caller. Input is only left unparsed
+ * when loading stops, so all of it was read in the current call.
+ * Required for xxhash and container formats if the terminator was found.
+ */
+static void FL2_rewindInputMt(FL2_decMt *const decmt, FL2_inBuffer* const input)
 {
-    FL2_decBlock *inBlock = &decmt->threads[decmt->numThreads].inBlock;
-
-    FL2_decJob * const done = decmt->threads + decmt->numThreads;
-    ++decmt->numThreads;
-
-    done->bufSize = done->inBlock.unpackSize;
-    decmt->memTotal += done->bufSize;
-    if (decmt->memTotal > decmt->memLimit)
-        return FL2_ERROR(memory_allocation);
-
-    /* Decompressed data will be stored in outBuf */
-    done->outBuf = malloc(done->bufSize);
-    if (done->outBuf == NULL)
-        return FL2_ERROR(memory_allocation);
+    FL2_decBlock *const inBlock = &decmt->load;
+    FL2_decInbuf *const last = inBlock->last;
+
+    if (last->next != NULL) {
+        /* Referenced input not yet reached by the parser */
+        for (const FL2_decInbuf *node = last->next; node != NULL; node = node->next)
+            input->pos -= node->length - LZMA_REQUIRED_INPUT_MAX;
+        LZMA2_freeInbufNodeChain(decmt, last->next, NULL);
+        last->next = NULL;
+    }
+    if (inBlock->endPos < last->length) {
+        size_t back = MIN(input->pos, last->length - inBlock->endPos);
+        input->pos -= back;
+        last->length -= back;
+    }
+}
 
-    decmt->isFinal = (res == CHUNK_FINAL);
+/* Link the rest of the caller's input into the chain without copying it.
+ * A small node holds the end of the last node and the start of the input, which makes
+ * the nodes overlap as usual. The reference begins within the input, so a
+ * LZMA_REQUIRED_INPUT_MAX overlap can be taken from any position in it.
+ * Returns 0, or 1 if allocation failed.
+ */
+static int FL2_referenceInputMt(FL2_decMt *const decmt, FL2_inBuffer* const input)
+{
+    FL2_decInbuf *const last = decmt->load.last;
+    const BYTE *const src = (const BYTE*)input->src + input->pos;
+    size_t const size = input->size - input->pos;
 
-    if (decmt->numThreads == decmt->maxThreads || decmt->isFinal)
+    FL2_decInbuf *const ref = FL2_createInbufNode(decmt, NULL, 0);
+    if (ref == NULL)
         return 1;
+    FL2_decInbuf *const join = FL2_createInbufNode(decmt, last, LZMA_REQUIRED_INPUT_MAX * 3);
+    if (join == NULL) {
+        LZMA2_freeInbufNodeChain(decmt, ref, NULL);
+        return 1;
+    }
+    memcpy(join->inBuf + LZMA_REQUIRED_INPUT_MAX, src, LZMA_REQUIRED_INPUT_MAX * 2);
+    join->length = LZMA_REQUIRED_INPUT_MAX * 3;
+    join->next = ref;
 
-    /* Set up the start of the next series of chunks. The first buffer is the last of the those already loaded. */
-    inBlock = &decmt->threads[decmt->numThreads].inBlock;
-    inBlock->first = done->inBlock.last;
-    inBlock->last = inBlock->first;
-    inBlock->endPos = done->inBlock.endPos;
-    inBlock->startPos = inBlock->endPos;
-    inBlock->unpackSize = 0;
+    ref->data = src + LZMA_REQUIRED_INPUT_MAX;
+    ref->length = size - LZMA_REQUIRED_INPUT_MAX;
+    ref->streamPos = decmt->inputBase + input->pos;
 
+    input->pos = input->size;
     return 0;
 }
 
-/* Read input into the buffer chain, adding new nodes when necessary. 
- * The chunks in each buffer are parsed before a new buffer is allocated.
+/* Read input into the buffer chain, adding new nodes when necessary.
+ * The chunks in each buffer are parsed before a new buffer is allocated, and each
+ * block is dispatched as soon as the next dict reset or the terminator is found.
  * No new buffers will be allocated after the terminator is encountered.
- * Returns 1 if the terminator was found or enough work exists for all threads,
- * 0 if input is empty,
- * or FL2_error_corruption_detected, or FL2_error_memory_allocation.
+ * Returns 0 if input is empty or loading must wait for jobs in progress to release memory,
+ * or FL2_error_corruption_detected, or FL2_error_memory_allocation if no jobs are in progress.
  * The memory limit is enforced by returning FL2_error_memory_allocation.
  */
-static size_t FL2_loadInputMt(FL2_decMt *const decmt, FL2_inBuffer* const input)
+static size_t FL2_loadInputMt(FL2_DStream* const fds, FL2_outBuffer* const output, FL2_inBuffer* const input)
 {
-    FL2_decBlock *inBlock = &decmt->threads[decmt->numThreads].inBlock;
+    FL2_decMt *const decmt = fds->decmt;
+    FL2_decBlock *const inBlock = &decmt->load;
+
+    if (decmt->loadDone) {
+        size_t const res = FL2_dispatchBlockMt(fds, output);
+        if (res != 1)
+            return res;
+    }
+    if (decmt->isFinal)
+        return 0;
+
+    if (decmt->head == NULL) {
+        decmt->head = FL2_createInbufNode(decmt, NULL, LZMA2_MT_INPUT_SIZE);
+        if (decmt->head == NULL)
+            return FL2_ERROR(memory_allocation);
+        inBlock->first = decmt->head;
+        inBlock->last = decmt->head;
+    }
+
     LZMA2_parseRes res = CHUNK_CONTINUE;
-    /* Continue while input is available or the parse pos is not beyond the end */
-    while (input->pos < input->size || inBlock->endPos < inBlock->last->length) {
+    /* Continue while input is available or the parse pos is not beyond the end of the chain */
+    while (input->pos < input->size || inBlock->endPos < inBlock->last->length || inBlock->last->next != NULL) {
         if (inBlock->endPos < inBlock->last->length) {
             res = FL2_parseMt(inBlock);
             if (res == CHUNK_ERROR)
@@ -891,39 +1835,47 @@ static size_t FL2_loadInputMt(FL2_decMt *const decmt, FL2_inBuffer* const input)
 
             if (res == CHUNK_DICT_RESET || res == CHUNK_FINAL) {
                 /* We have a complete series of chunks starting from a dict reset and
-                 * ending with another reset or the terminator. Set up the thread job. */
-                size_t end = FL2_handleFinalChunkMt(decmt, res);
-
-                /* end is nonzero if memory limit hit or ready to decode */
-                if (end != 0) {
-                    inBlock = &decmt->threads[decmt->numThreads - 1].inBlock;
-                    /* rewind input in case data beyond terminator was read. Required for xxhash and container formats */
-                    size_t back = MIN(input->pos, inBlock->last->length - inBlock->endPos);
-                    input->pos -= back;
-                    inBlock->last->length -= back;
-                    return end;
+                 * ending with another reset or the terminator. Start decoding it. */
+                decmt->loadDone = 1;
+                decmt->isFinal = (res == CHUNK_FINAL);
+                /* Rewind before the block is shared with a decoder thread */
+                if (decmt->isFinal)
+                    FL2_rewindInputMt(decmt, input);
+                size_t const dispatched = FL2_dispatchBlockMt(fds, output);
+                if (dispatched != 1) {
+                    FL2_rewindInputMt(decmt, input);
+                    return dispatched;
                 }
-                inBlock = &decmt->threads[decmt->numThreads].inBlock;
+                if (decmt->isFinal)
+                    return 0;
             }
         }
-        if (inBlock->last->length >= LZMA2_MT_INPUT_SIZE && inBlock->endPos + LZMA_REQUIRED_INPUT_MAX >= inBlock->last->length) {
-            /* Create a new buffer if endPos is within the overlap region. The function copies the overlap. */
-            FL2_decInbuf *const next = FL2_createInbufNode(decmt, inBlock->last);
-            if (next == NULL) {
-                if (inBlock->endPos < inBlock->last->length) {
-                    size_t back = MIN(input->pos, inBlock->last->length - inBlock->endPos);
-                    input->pos -= back;
-                    inBlock->last->length -= back;
+        FL2_decInbuf *const last = inBlock->last;
+        if (inBlock->endPos + LZMA_REQUIRED_INPUT_MAX >= last->length
+            && (last->next != NULL || LZMA2_isInbufNodeFull(last))) {
+            if (last->next == NULL) {
+                if (input->pos == input->size)
+                    break;
+                /* Create a new buffer if endPos is within the overlap region. The function copies the overlap. */
+                if (FL2_createInbufNode(decmt, last, LZMA2_MT_INPUT_SIZE) == NULL) {
+                    FL2_rewindInputMt(decmt, input);
+                    return FL2_limitJobsMt(decmt);
                 }
-                return FL2_ERROR(memory_allocation);
             }
-            inBlock->last = next;
-            inBlock->endPos -= LZMA2_MT_INPUT_SIZE - LZMA_REQUIRED_INPUT_MAX;
+            inBlock->last = last->next;
+            inBlock->endPos -= last->length - LZMA_REQUIRED_INPUT_MAX;
+            continue;
         }
+        size_t const avail = input->size - input->pos;
+        if (decmt->residentInput && avail >= FL2_RESIDENT_INPUT_MIN
+            && last->next == NULL && last->length >= LZMA_REQUIRED_INPUT_MAX
+            && !FL2_referenceInputMt(decmt, input))
+            continue;
+
         /* Read as much input as possible */
-        size_t toread = MIN(input->size - input->pos, LZMA2_MT_INPUT_SIZE - inBlock->last->length);
-        memcpy(inBlock->last->inBuf + inBlock->last->length, (BYTE*)input->src + input->pos, toread);
-        inBlock->last->length += toread;
+        size_t toread = (last->next == NULL && !LZMA2_isInbufNodeFull(last)) ? MIN(avail, last->capacity - last->length) : 0;
+        memcpy(last->inBuf + last->length, (BYTE*)input->src + input->pos, toread);
+        last->length += toread;
         input->pos += toread;
 
         /* Do not continue if we have an incomplete chunk header */
@@ -941,18 +1893,19 @@ static size_t FL2_decompressFailedMt(FL2_DStream* const fds, FL2_outBuffer* cons
 {
     FL2_decMt *const decmt = fds->decmt;
 
-    if(decmt->head->length == 0)
+    if(decmt->head == NULL || decmt->head->length == 0)
         return FL2_decompressOverlappedInput(fds, output, input);
 
     if (!decmt->failState) {
         /* On first call of this function, free any output buffers already allocated,
-         * and set up the read position in the input buffer chain. The main thread's decoder needs initialization too. */
+         * and set up the read position in the input buffer chain. The main thread's decoder needs initialization too.
+         * All jobs have been written out, so the block being loaded is the next to decode. */
         DEBUGLOG(3, "Switching to ST decompression. Memory: %u, limit %u", (unsigned)decmt->memTotal, (unsigned)decmt->memLimit);
 
         FL2_freeOutputBuffers(decmt);
 
-        decmt->cur = decmt->threads[0].inBlock.first;
-        decmt->curPos = decmt->threads[0].inBlock.startPos;
+        decmt->cur = decmt->load.first;
+        decmt->curPos = decmt->load.startPos;
 
         decmt->failState = 1;
 
@@ -961,7 +1914,7 @@ static size_t FL2_decompressFailedMt(FL2_DStream* const fds, FL2_outBuffer* cons
     FL2_decInbuf *const cur = decmt->cur;
 
     FL2_inBuffer temp;
-    temp.src = cur->inBuf;
+    temp.src = cur->data;
     temp.pos = decmt->curPos;
     temp.size = cur->length;
 
@@ -973,7 +1926,7 @@ static size_t FL2_decompressFailedMt(FL2_DStream* const fds, FL2_outBuffer* cons
         if (cur->next == NULL) {
             /* The last buffer in the chain */
             fds->overlapSize = temp.size - temp.pos;
-            memcpy(fds->overlap, cur->inBuf + temp.pos, fds->overlapSize);
+            memcpy(fds->overlap, cur->data + temp.pos, fds->overlapSize);
             decmt->cur = NULL;
             LZMA2_freeExtraInbufNodes(decmt);
         }
@@ -995,25 +1948,33 @@ static size_t FL2_decompressStreamMt(FL2_DStream* const fds, FL2_outBuffer* cons
         return FL2_decompressFailedMt(fds, output, input);
 
     if (fds->stage == FL2DEC_STAGE_DECOMP) {
-        /* Allocate and fill the input buffer chain */
-        size_t const res = FL2_loadInputMt(decmt, input);
-
-        /* Failover if allocation failed */
-        if (FL2_getErrorCode(res) == FL2_error_memory_allocation)
-            return FL2_decompressFailedMt(fds, output, input);
-        CHECK_F(res);
-
-        /* res > 0 means all threads have input or the terminator was encountered */
-        if (res > 0) {
-            CHECK_F(FL2_decompressBlocksMt(fds));
-            fds->stage = FL2DEC_STAGE_MT_WRITE;
+        size_t const prevIn = input->pos;
+        size_t const prevOut = output->pos;
+        for (;;) {
+            size_t const inPos = input->pos;
+            size_t const outPos = output->pos;
+            size_t const jobHead = decmt->jobHead;
+            size_t const jobEnd = decmt->jobEnd;
+
+            /* Allocate and fill the input buffer chain, and dispatch complete blocks */
+            size_t const res = FL2_loadInputMt(fds, output, input);
+
+            /* Failover if allocation failed with no jobs in progress */
+            if (FL2_getErrorCode(res) == FL2_error_memory_allocation)
+                return FL2_decompressFailedMt(fds, output, input);
+            CHECK_F(res);
+
+            /* Block on the oldest job only if nothing else can be done in this call */
+            CHECK_F(FL2_writeStreamBlocks(fds, output, input->pos == prevIn && output->pos == prevOut));
+
+            if (decmt->isFinal && !decmt->loadDone && decmt->jobHead == decmt->jobEnd) {
+                fds->stage = fds->doHash ? FL2DEC_STAGE_HASH : FL2DEC_STAGE_FINISHED;
+                break;
+            }
+            if (input->pos == inPos && output->pos == outPos && decmt->jobHead == jobHead && decmt->jobEnd == jobEnd)
+                break;
         }
     }
-    if (fds->stage == FL2DEC_STAGE_MT_WRITE) {
-        if (FL2_writeStreamBlocks(fds, output))
-            fds->stage = decmt->isFinal ? (fds->doHash ? FL2DEC_STAGE_HASH : FL2DEC_STAGE_FINISHED)
-                : FL2DEC_STAGE_DECOMP;
-    }
     return fds->stage != FL2DEC_STAGE_FINISHED;
 }
 
@@ -1029,6 +1990,7 @@ static void FL2_resetDStream(FL2_DStream *fds)
     fds->stage = FL2DEC_STAGE_INIT;
     fds->asyncRes = 0;
     fds->streamTotal = 0;
+    fds->inputTotal = 0;
     fds->overlapSize = 0;
     fds->progress = 0;
 #ifndef NO_XXHASH
@@ -1036,6 +1998,8 @@ static void FL2_resetDStream(FL2_DStream *fds)
 #endif
     fds->loopCount = 0;
     fds->wait = 0;
+    fds->dicPending = 0;
+    fds->dicIsOutput = 0;
 }
 
 FL2LIB_API FL2_DStream *FL2LIB_CALL FL2_createDStreamMt(unsigned nbThreads)
@@ -1050,6 +2014,8 @@ FL2LIB_API FL2_DStream *FL2LIB_CALL FL2_createDStreamMt(unsigned nbThreads)
 
         FL2_resetDStream(fds);
         fds->timeout = 0;
+        fds->residentOutput = 0;
+        fds->residentInput = 0;
 
 #ifndef FL2_SINGLETHREAD
         fds->decompressThread = NULL;
@@ -1084,10 +2050,97 @@ FL2LIB_API size_t FL2LIB_CALL FL2_freeDStream(FL2_DStream* fds)
 
 FL2LIB_API void FL2LIB_CALL FL2_setDStreamMemoryLimitMt(FL2_DStream * fds, size_t limit)
 {
+#ifndef FL2_SINGLETHREAD
+    if (fds->decmt != NULL) {
+        FL2_decMt *const decmt = fds->decmt;
+        /* A higher limit may permit all jobs again. A lower one takes effect as jobs are dispatched. */
+        if (limit > decmt->memLimit)
+            decmt->jobLimit = decmt->maxJobs;
+        decmt->memLimit = limit;
+        FL2_trimOutputBuffers(decmt, limit);
+    }
+#endif
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_setDStreamThreadPool(FL2_DStream * fds, FL2_threadPool * pool, unsigned maxThreads)
+{
+#ifndef FL2_SINGLETHREAD
+    if (fds->decmt != NULL) {
+        FL2_decMt *const decmt = fds->decmt;
+        if (fds->wait || decmt->jobHead != decmt->jobEnd)
+            return FL2_ERROR(stage_wrong);
+        if (FL2POOL_rebind(&decmt->factory, pool, decmt->maxThreads, maxThreads))
+            return FL2_ERROR(memory_allocation);
+    }
+#else
+    (void)fds, (void)pool, (void)maxThreads;
+#endif
+    return FL2_error_no_error;
+}
+
+FL2LIB_API void FL2LIB_CALL FL2_getDStreamMemoryUsage(const FL2_DStream * fds, FL2_DStreamMemory * usage)
+{
+    memset(usage, 0, sizeof(*usage));
+    usage->nbThreads = 1;
+    usage->singleThread = 1;
+#ifndef FL2_SINGLETHREAD
+    if (fds->decmt != NULL) {
+        const FL2_decMt *const decmt = fds->decmt;
+        usage->memoryUsed = decmt->memTotal;
+        usage->memoryLimit = decmt->memLimit;
+        usage->nbThreads = (unsigned)decmt->maxThreads;
+        usage->activeJobs = (unsigned)(decmt->jobEnd - decmt->jobHead);
+        usage->jobLimit = (unsigned)decmt->jobLimit;
+        usage->maxJobs = (unsigned)decmt->maxJobs;
+        usage->singleThread = decmt->failState;
+    }
+#endif
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_setDStreamProbBits(FL2_DStream * fds, unsigned bits)
+{
+    if (!FL2_isValidProbBits(bits))
+        return FL2_ERROR(parameter_outOfBound);
+    if (fds->wait)
+        return FL2_ERROR(stage_wrong);
+
+    LZMA2_setProbBits(&fds->dec, bits);
 #ifndef FL2_SINGLETHREAD
     if (fds->decmt != NULL)
-        fds->decmt->memLimit = limit;
+        for (size_t thread = 0; thread < fds->decmt->maxJobs; ++thread)
+            LZMA2_setProbBits(&fds->decmt->threads[thread].dec, bits);
 #endif
+    return FL2_error_no_error;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_setDStreamResidentOutput(FL2_DStream * fds, unsigned resident)
+{
+    if (fds->wait)
+        return FL2_ERROR(stage_wrong);
+
+    fds->residentOutput = (resident != 0);
+    return FL2_error_no_error;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_setDStreamResidentInput(FL2_DStream * fds, unsigned resident)
+{
+    if (fds->wait)
+        return FL2_ERROR(stage_wrong);
+
+    fds->residentInput = (resident != 0);
+    return FL2_error_no_error;
+}
+
+FL2LIB_API unsigned long long FL2LIB_CALL FL2_getDStreamInputReleased(const FL2_DStream * fds)
+{
+#ifndef FL2_SINGLETHREAD
+    /* Input before the first node referencing the caller's input is no longer needed */
+    if (fds->decmt != NULL)
+        for (const FL2_decInbuf *node = fds->decmt->head; node != NULL; node = node->next)
+            if (node->data != node->inBuf)
+                return node->streamPos;
+#endif
+    return fds->inputTotal;
 }
 
 FL2LIB_API size_t FL2LIB_CALL FL2_initDStream(FL2_DStream* fds)
@@ -1101,6 +2154,10 @@ FL2LIB_API size_t FL2LIB_CALL FL2_initDStream(FL2_DStream* fds)
 
 #ifndef FL2_SINGLETHREAD
     FL2_lzma2DecMt_init(fds->decmt);
+    if (fds->decmt != NULL) {
+        fds->decmt->residentInput = fds->residentInput;
+        fds->decmt->residentOutput = fds->residentOutput;
+    }
 #endif
     return FL2_error_no_error;
 }
@@ -1157,6 +2214,9 @@ FL2LIB_API unsigned long long FL2LIB_CALL FL2_getDStreamProgress(const FL2_DStre
 
 static size_t FL2_initDStream_prop(FL2_DStream* const fds, BYTE prop)
 {
+    if ((prop & FL2_LZMA_PROP_MASK) > 40)
+        return FL2_ERROR(corruption_detected);
+
     fds->doHash = prop >> FL2_PROP_HASH_BIT;
     prop &= FL2_LZMA_PROP_MASK;
 
@@ -1164,7 +2224,7 @@ static size_t FL2_initDStream_prop(FL2_DStream* const fds, BYTE prop)
 #ifndef FL2_SINGLETHREAD
     if (fds->decmt == NULL || FL2_lzma2DecMt_initProp(fds->decmt, prop))
 #endif
-        CHECK_F(LZMA2_initDecoder(&fds->dec, prop, NULL, 0));
+        CHECK_F(FL2_initSingleDecoder(fds, prop));
 
 #ifndef NO_XXHASH
     if (fds->doHash) {
@@ -1204,11 +2264,12 @@ static size_t FL2_decompressStream_blocking(FL2_DStream* fds, FL2_outBuffer* out
         if (fds->stage == FL2DEC_STAGE_INIT) {
             BYTE prop = ((const BYTE*)input->src)[input->pos];
             ++input->pos;
-            FL2_initDStream_prop(fds, prop);
+            CHECK_F(FL2_initDStream_prop(fds, prop));
             fds->stage = FL2DEC_STAGE_DECOMP;
         }
 #ifndef FL2_SINGLETHREAD
         if (decmt) {
+            decmt->inputBase = fds->inputTotal - prevIn;
             size_t res = FL2_decompressStreamMt(fds, output, input);
             if (FL2_isError(res)) {
                 FL2_lzma2DecMt_cleanup(decmt);
@@ -1247,6 +2308,8 @@ static size_t FL2_decompressStream_blocking(FL2_DStream* fds, FL2_outBuffer* out
 #endif /* NO_XXHASH */
         }
     }
+    fds->inputTotal += input->pos - prevIn;
+
     if (fds->stage != FL2DEC_STAGE_FINISHED && prevOut == output->pos && prevIn == input->pos) {
         /* No progress was made */
         ++fds->loopCount;
@@ -1325,8 +2388,9 @@ FL2LIB_API size_t FL2LIB_CALL FL2_estimateDStreamSize(size_t dictSize, unsigned
 {
     nbThreads = FL2_checkNbThreads(nbThreads);
     if (nbThreads > 1) {
-        /* Estimate 50% compression and a block size of 4 * dictSize */
-        return nbThreads * sizeof(FL2_DCtx) + (dictSize + dictSize / 2) * 4 * nbThreads;
+        /* Estimate 50% compression and a block size of 4 * dictSize, with one block
+         * more than the thread count held for output */
+        return (nbThreads + 1) * sizeof(FL2_DCtx) + (dictSize + dictSize / 2) * 4 * (nbThreads + 1);
     }
     return LZMA2_decMemoryUsage(dictSize);
 }
\ No newline at end of file
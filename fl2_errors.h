@@ -44,6 +44,7 @@ typedef enum {
   FL2_error_canceled                = 13,
   FL2_error_buffer                  = 14,
   FL2_error_timedOut                = 15,
+  FL2_error_io                      = 16,
   FL2_error_maxCode                 = 20  /* never EVER use this value directly, it can change in future versions! Use FL2_isError() instead */
 } FL2_ErrorCode;
 
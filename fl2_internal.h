@@ -41,6 +41,20 @@ extern "C" {
 #  define XXHASH_SIZEOF sizeof(XXH32_canonical_t)
 #endif
 
+/* Checkpoint index : magic number, then for each checkpoint the LE64 position of its chunk
+ * relative to the first chunk, the LE64 uncompressed position, the LE32 look-back size,
+ * and the look-back data */
+#define FL2_CHECKPOINT_MAGIC 0x50434C46U
+#define FL2_CHECKPOINT_MAGIC_SIZE 4
+#define FL2_CHECKPOINT_ENTRY_SIZE 20
+
+/* Frame index : magic number, then for each dictionary reset the LE64 position of its chunk
+ * relative to the first chunk and the LE64 uncompressed position, and a last entry holding
+ * the position of the end marker and the decompressed size */
+#define FL2_FRAME_INDEX_MAGIC 0x49324C46U
+#define FL2_FRAME_INDEX_MAGIC_SIZE 4
+#define FL2_FRAME_INDEX_ENTRY_SIZE 16
+
 
 /*-*************************************
 *  Debug
@@ -0,0 +1,317 @@
+/*
+* Copyright (c) 2018, Conor McCarthy
+* All rights reserved.
+*
+* This source code is licensed under both the BSD-style license (found in the
+* LICENSE file in the root directory of this source tree) and the GPLv2 (found
+* in the COPYING file in the root directory of this source tree).
+* You may select, at your option, one of the above-listed licenses.
+*/
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#  define _GNU_SOURCE  /* memfd_create */
+#endif
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#  define _DEFAULT_SOURCE  /* madvise */
+#endif
+
+#include <errno.h>
+#include "fl2_errors.h"
+#include "fl2_internal.h"
+#include "fl2_mmap.h"
+
+#ifdef _WIN32
+#  include <windows.h>
+#  include <io.h>      /* _get_osfhandle, _write */
+#else
+#  include <sys/types.h>
+#  include <sys/stat.h>
+#  include <sys/mman.h>
+#  include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+size_t FL2_mapFile(FL2_mapping* const map, int const fd)
+{
+    map->data = NULL;
+    map->size = 0;
+    map->handle = NULL;
+
+    HANDLE const file = (HANDLE)_get_osfhandle(fd);
+    LARGE_INTEGER size;
+    if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size))
+        return FL2_ERROR(io);
+    if ((unsigned long long)size.QuadPart > (size_t)-1)
+        return FL2_ERROR(srcSize_wrong);
+
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    map->pageSize = info.dwPageSize;
+
+    if (size.QuadPart == 0)
+        return FL2_error_no_error;
+
+    map->handle = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (map->handle == NULL)
+        return FL2_ERROR(io);
+    map->data = MapViewOfFile(map->handle, FILE_MAP_READ, 0, 0, 0);
+    if (map->data == NULL) {
+        CloseHandle(map->handle);
+        map->handle = NULL;
+        return FL2_ERROR(io);
+    }
+    map->size = (size_t)size.QuadPart;
+
+    return FL2_error_no_error;
+}
+
+size_t FL2_mapFileOutput(FL2_mapping* const map, int const fd, size_t const size)
+{
+    map->data = NULL;
+    map->size = 0;
+    map->handle = NULL;
+
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    map->pageSize = info.dwPageSize;
+
+    HANDLE const file = (HANDLE)_get_osfhandle(fd);
+    if (file == INVALID_HANDLE_VALUE || _chsize_s(fd, (__int64)size) != 0)
+        return FL2_ERROR(io);
+
+    if (size == 0)
+        return FL2_error_no_error;
+
+    map->handle = CreateFileMapping(file, NULL, PAGE_READWRITE, 0, 0, NULL);
+    if (map->handle == NULL)
+        return FL2_ERROR(io);
+    map->data = MapViewOfFile(map->handle, FILE_MAP_WRITE, 0, 0, 0);
+    if (map->data == NULL) {
+        CloseHandle(map->handle);
+        map->handle = NULL;
+        return FL2_ERROR(io);
+    }
+    map->size = size;
+
+    return FL2_error_no_error;
+}
+
+void FL2_unmapFile(FL2_mapping* const map)
+{
+    if (map->data != NULL)
+        UnmapViewOfFile(map->data);
+    if (map->handle != NULL)
+        CloseHandle(map->handle);
+    map->data = NULL;
+    map->size = 0;
+    map->handle = NULL;
+}
+
+size_t FL2_truncateFile(int const fd, size_t const size)
+{
+    if (_chsize_s(fd, (__int64)size) != 0)
+        return FL2_ERROR(io);
+    return FL2_error_no_error;
+}
+
+/* Windows has no portable read-ahead hint for mapped views. The file cache's own
+ * read-ahead handles sequential access. */
+void FL2_adviseWillNeed(const FL2_mapping* const map, size_t const start, size_t const end)
+{
+    (void)map; (void)start; (void)end;
+}
+
+void FL2_adviseDontNeed(const FL2_mapping* const map, size_t start, size_t end)
+{
+    start = (start + map->pageSize - 1) & ~(map->pageSize - 1);
+    end &= ~(map->pageSize - 1);
+    /* Unlocking pages that are not locked removes them from the working set */
+    if (start < end)
+        VirtualUnlock(map->data + start, end - start);
+}
+
+/* Placing two views at adjacent addresses requires releasing a reservation first, which
+ * another thread can race. Callers fall back to separate buffers. */
+size_t FL2_mapRing(FL2_ringMapping* const ring, size_t const minSize)
+{
+    (void)minSize;
+    ring->data = NULL;
+    ring->size = 0;
+    return FL2_ERROR(parameter_unsupported);
+}
+
+void FL2_unmapRing(FL2_ringMapping* const ring)
+{
+    ring->data = NULL;
+    ring->size = 0;
+}
+
+size_t FL2_writeFile(int const fd, const void* buf, size_t size)
+{
+    const BYTE* src = buf;
+    while (size != 0) {
+        unsigned const toWrite = (unsigned)MIN(size, 1U << 30);
+        int const written = _write(fd, src, toWrite);
+        if (written <= 0)
+            return FL2_ERROR(io);
+        src += written;
+        size -= written;
+    }
+    return FL2_error_no_error;
+}
+
+#else /* POSIX */
+
+size_t FL2_mapFile(FL2_mapping* const map, int const fd)
+{
+    map->data = NULL;
+    map->size = 0;
+    map->pageSize = (size_t)sysconf(_SC_PAGESIZE);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        return FL2_ERROR(io);
+    if ((unsigned long long)st.st_size > (size_t)-1)
+        return FL2_ERROR(srcSize_wrong);
+    if (st.st_size == 0)
+        return FL2_error_no_error;
+
+    void* const data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+        return FL2_ERROR(io);
+    map->data = data;
+    map->size = (size_t)st.st_size;
+
+    return FL2_error_no_error;
+}
+
+size_t FL2_mapFileOutput(FL2_mapping* const map, int const fd, size_t const size)
+{
+    map->data = NULL;
+    map->size = 0;
+    map->pageSize = (size_t)sysconf(_SC_PAGESIZE);
+
+    if ((off_t)size < 0 || ftruncate(fd, (off_t)size) != 0)
+        return FL2_ERROR(io);
+    if (size == 0)
+        return FL2_error_no_error;
+
+    void* const data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+        return FL2_ERROR(io);
+    map->data = data;
+    map->size = size;
+
+    return FL2_error_no_error;
+}
+
+void FL2_unmapFile(FL2_mapping* const map)
+{
+    if (map->data != NULL)
+        munmap(map->data, map->size);
+    map->data = NULL;
+    map->size = 0;
+}
+
+size_t FL2_truncateFile(int const fd, size_t const size)
+{
+    if ((off_t)size < 0 || ftruncate(fd, (off_t)size) != 0)
+        return FL2_ERROR(io);
+    return FL2_error_no_error;
+}
+
+void FL2_adviseWillNeed(const FL2_mapping* const map, size_t start, size_t end)
+{
+    start &= ~(map->pageSize - 1);
+    end = MIN(end, map->size);
+    if (start < end)
+#ifdef MADV_WILLNEED
+        madvise(map->data + start, end - start, MADV_WILLNEED);
+#else
+        posix_madvise(map->data + start, end - start, POSIX_MADV_WILLNEED);
+#endif
+}
+
+void FL2_adviseDontNeed(const FL2_mapping* const map, size_t start, size_t end)
+{
+    start = (start + map->pageSize - 1) & ~(map->pageSize - 1);
+    end &= ~(map->pageSize - 1);
+    if (start < end)
+#ifdef MADV_DONTNEED
+        madvise(map->data + start, end - start, MADV_DONTNEED);
+#else
+        posix_madvise(map->data + start, end - start, POSIX_MADV_DONTNEED);
+#endif
+}
+
+size_t FL2_mapRing(FL2_ringMapping* const ring, size_t const minSize)
+{
+    ring->data = NULL;
+    ring->size = 0;
+
+#ifdef MFD_CLOEXEC
+    size_t const pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t const size = (minSize + pageSize - 1) & ~(pageSize - 1);
+
+    if (size == 0 || size > (size_t)-1 / 3 || (off_t)size < 0)
+        return FL2_ERROR(memory_allocation);
+
+    int const fd = memfd_create("fl2_ring", MFD_CLOEXEC);
+    if (fd < 0)
+        return FL2_ERROR(parameter_unsupported);
+    if (ftruncate(fd, (off_t)size) != 0) {
+        close(fd);
+        return FL2_ERROR(memory_allocation);
+    }
+    /* Reserve the address range for all views, then replace each part with the file */
+    BYTE* const base = mmap(NULL, size * 3, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return FL2_ERROR(memory_allocation);
+    }
+    for (unsigned u = 0; u < 3; ++u) {
+        if (mmap(base + size * u, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            munmap(base, size * 3);
+            close(fd);
+            return FL2_ERROR(memory_allocation);
+        }
+    }
+    /* The mappings keep the memory alive */
+    close(fd);
+
+    ring->data = base;
+    ring->size = size;
+
+    return FL2_error_no_error;
+#else
+    (void)minSize;
+    return FL2_ERROR(parameter_unsupported);
+#endif
+}
+
+void FL2_unmapRing(FL2_ringMapping* const ring)
+{
+    if (ring->data != NULL)
+        munmap(ring->data, ring->size * 3);
+    ring->data = NULL;
+    ring->size = 0;
+}
+
+size_t FL2_writeFile(int const fd, const void* buf, size_t size)
+{
+    const BYTE* src = buf;
+    while (size != 0) {
+        ssize_t const written = write(fd, src, size);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return FL2_ERROR(io);
+        }
+        src += written;
+        size -= (size_t)written;
+    }
+    return FL2_error_no_error;
+}
+
+#endif /* _WIN32 */
@@ -0,0 +1,74 @@
+/*
+* Copyright (c) 2018, Conor McCarthy
+* All rights reserved.
+*
+* This source code is licensed under both the BSD-style license (found in the
+* LICENSE file in the root directory of this source tree) and the GPLv2 (found
+* in the COPYING file in the root directory of this source tree).
+* You may select, at your option, one of the above-listed licenses.
+*/
+
+#ifndef FL2_MMAP_H
+#define FL2_MMAP_H
+
+#include "mem.h"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+/* Mapping of a whole file. Data is writable only if mapped with FL2_mapFileOutput(). */
+typedef struct {
+    BYTE* data;
+    size_t size;
+    size_t pageSize;
+#ifdef _WIN32
+    void* handle;
+#endif
+} FL2_mapping;
+
+/* Map the file open as `fd`. A zero-length file yields data == NULL and size == 0.
+ * Return: 0 or an error code */
+size_t FL2_mapFile(FL2_mapping* const map, int const fd);
+
+/* Resize the file open as `fd` to `size` bytes and map it for writing.
+ * Return: 0 or an error code */
+size_t FL2_mapFileOutput(FL2_mapping* const map, int const fd, size_t const size);
+
+void FL2_unmapFile(FL2_mapping* const map);
+
+/* Resize the file open as `fd` to `size` bytes. It must not be mapped.
+ * Return: 0 or an error code */
+size_t FL2_truncateFile(int const fd, size_t const size);
+
+/* Hint that bytes [start, end) of the mapping will be needed soon. */
+void FL2_adviseWillNeed(const FL2_mapping* const map, size_t const start, size_t const end);
+
+/* Hint that bytes [start, end) will not be needed again. Whole pages inside the range
+ * may be dropped from memory and are read back from the file if touched. */
+void FL2_adviseDontNeed(const FL2_mapping* const map, size_t const start, size_t const end);
+
+/* Anonymous memory mapped three times in succession, so data[i], data[i + size] and
+ * data[i + size * 2] are the same byte. A range of up to `size` bytes before and after any
+ * position in the middle view is contiguous. */
+typedef struct {
+    BYTE* data;
+    size_t size;
+} FL2_ringMapping;
+
+/* Create a mirrored mapping of at least `minSize` bytes, rounded up to whole pages.
+ * Not available on all platforms.
+ * Return: 0 or an error code */
+size_t FL2_mapRing(FL2_ringMapping* const ring, size_t const minSize);
+
+void FL2_unmapRing(FL2_ringMapping* const ring);
+
+/* Write all of `buf` to `fd`.
+ * Return: 0 or an error code */
+size_t FL2_writeFile(int const fd, const void* buf, size_t size);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif /* FL2_MMAP_H */
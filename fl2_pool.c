@@ -20,34 +20,165 @@
 #ifndef FL2_SINGLETHREAD
 
 #include "fl2_threading.h"   /* pthread adaptation */
+#include "atomic.h"
 
-struct FL2POOL_ctx_s {
+/* Jobs are dispatched without locking. Each queue has job counters which only increase:
+ * queueEnd is raised to add jobs and a worker claims a job by advancing queueIndex with a
+ * compare-and-swap. Job n is passed as queueBase + index. The function, opaque and base are
+ * atomics stored before queueEnd is raised, and change only when all jobs are claimed, so a
+ * successful claim validates the values read before it. The mutex is taken only to sleep, to wake sleeping threads, and to serve
+ * several queues in turn.
+ */
+
+/* Worker threads, which may be shared by the queues of several contexts */
+struct FL2_threadPool_s {
     /* Keep track of the threads */
     size_t numThreads;
 
-    /* All threads work on the same function and object during a job */
-    FL2POOL_function function;
-    void *opaque;
-
-    /* The number of threads working on jobs */
-    size_t numThreadsBusy;
-    /* Indicates the number of threads requested and the values to pass */
-    ptrdiff_t queueIndex;
-    ptrdiff_t queueEnd;
+    /* The attached queues form a ring. Workers search for jobs starting at the rover, which
+     * moves past each queue served so that queues take turns. */
+    FL2POOL_ctx *rover;
+    /* Number of attached queues. With one queue, workers continue with its jobs without
+     * taking the mutex. */
+    FL2_atomic64 numQueues;
+    /* Number of attached queues, plus one until FL2POOL_releaseShared() is called */
+    size_t refCount;
+    /* Number of threads searching for jobs under the mutex or waiting for them */
+    FL2_atomic64 numIdle;
 
-    /* The mutex protects the queue */
+    /* The mutex protects the ring and the condition variables */
     FL2_pthread_mutex_t queueMutex;
-    /* Condition variable for pushers to wait on when the queue is full */
-    FL2_pthread_cond_t busyCond;
-    /* Condition variable for poppers to wait on when the queue is empty */
+    /* Condition variable for poppers to wait on when no queue has a job to start */
     FL2_pthread_cond_t newJobsCond;
-    /* Indicates if the queue is shutting down */
+    /* Indicates if the pool is shutting down */
     int shutdown;
 
     /* The threads. Extras to be calloc'd */
     FL2_pthread_t threads[1];
 };
 
+/* A context's job queue */
+struct FL2POOL_ctx_s {
+    FL2POOL_shared *pool;
+    FL2POOL_ctx *prev;
+    FL2POOL_ctx *next;
+
+    /* All threads work on the same function and object during a job */
+    FL2_ATOMIC_PTR(FL2POOL_function) function;
+    FL2_ATOMIC_PTR(void*) opaque;
+    FL2_atomic64 queueBase;
+
+    /* The number of threads working on jobs, including threads about to look for another */
+    FL2_atomic64 numThreadsBusy;
+    /* The most threads allowed to work on this queue's jobs at once */
+    long long maxThreadsBusy;
+    /* Indicates the number of threads requested and the values to pass */
+    FL2_atomic64 queueIndex;
+    FL2_atomic64 queueEnd;
+
+    /* Condition variable for pushers to wait on when the queue is full */
+    FL2_pthread_cond_t busyCond;
+};
+
+typedef struct {
+    FL2POOL_function function;
+    void *opaque;
+    ptrdiff_t n;
+} FL2POOL_job;
+
+static int FL2POOL_isIdle(FL2POOL_ctx* const ctx)
+{
+    return FL2_atomic64_load(ctx->numThreadsBusy) == 0
+        && FL2_atomic64_load(ctx->queueIndex) >= FL2_atomic64_load(ctx->queueEnd);
+}
+
+/* Claim the next job of a queue for a thread already counted as busy.
+ * Returns 1 if a job was claimed, or 0 if none is queued. */
+static int FL2POOL_claimJob(FL2POOL_ctx* const ctx, FL2POOL_job* const job)
+{
+    for (;;) {
+        long long const end = FL2_atomic64_load(ctx->queueEnd);
+        long long const index = FL2_atomic64_load(ctx->queueIndex);
+        if (index >= end)
+            return 0;
+        job->function = (FL2POOL_function)FL2_atomicPtr_load(ctx->function);
+        job->opaque = (void*)FL2_atomicPtr_load(ctx->opaque);
+        job->n = (ptrdiff_t)(FL2_atomic64_load(ctx->queueBase) + index);
+        if (FL2_atomic64_cas(ctx->queueIndex, index, index + 1))
+            return 1;
+    }
+}
+
+/* Release a thread's busy count. The count reaches zero under the mutex, and the queue is
+ * not accessed after that, so FL2POOL_free() can't free the queue while it's in use. */
+static void FL2POOL_endJob(FL2POOL_ctx* const ctx, int const locked)
+{
+    FL2POOL_shared* const pool = ctx->pool;
+    for (;;) {
+        long long const busy = FL2_atomic64_load(ctx->numThreadsBusy);
+        if (busy > 1) {
+            if (FL2_atomic64_cas(ctx->numThreadsBusy, busy, busy - 1))
+                return;
+            continue;
+        }
+        if (!locked)
+            FL2_pthread_mutex_lock(&pool->queueMutex);
+        FL2_atomic64_add(ctx->numThreadsBusy, -1);
+        /* Signal the master thread waiting for jobs to complete */
+        FL2_pthread_cond_broadcast(&ctx->busyCond);
+        if (!locked)
+            FL2_pthread_mutex_unlock(&pool->queueMutex);
+        return;
+    }
+}
+
+/* Start a job of the queue if one is queued and the queue is under its thread limit.
+ * Returns 1 if a job was claimed. */
+static int FL2POOL_startJob(FL2POOL_ctx* const ctx, FL2POOL_job* const job)
+{
+    for (;;) {
+        long long const busy = FL2_atomic64_load(ctx->numThreadsBusy);
+        if (busy >= ctx->maxThreadsBusy)
+            return 0;
+        if (FL2_atomic64_cas(ctx->numThreadsBusy, busy, busy + 1))
+            break;
+    }
+    if (FL2POOL_claimJob(ctx, job))
+        return 1;
+    FL2POOL_endJob(ctx, 1);
+    return 0;
+}
+
+/* Start a job of the first queue at or after the rover which has one available.
+ * Called with the mutex locked. Returns the queue, or NULL if no job was started. */
+static FL2POOL_ctx* FL2POOL_nextQueue(FL2POOL_shared* const pool, FL2POOL_job* const job)
+{
+    FL2POOL_ctx* ctx = pool->rover;
+    if (ctx == NULL)
+        return NULL;
+    do {
+        if (FL2POOL_startJob(ctx, job)) {
+            pool->rover = ctx->next;
+            return ctx;
+        }
+        ctx = ctx->next;
+    } while (ctx != pool->rover);
+    return NULL;
+}
+
+/* Wake sleeping threads after jobs are added */
+static void FL2POOL_wake(FL2POOL_shared* const pool, int const all)
+{
+    if (FL2_atomic64_load(pool->numIdle) == 0)
+        return;
+    FL2_pthread_mutex_lock(&pool->queueMutex);
+    if (all)
+        FL2_pthread_cond_broadcast(&pool->newJobsCond);
+    else
+        FL2_pthread_cond_signal(&pool->newJobsCond);
+    FL2_pthread_mutex_unlock(&pool->queueMutex);
+}
+
 /* FL2POOL_thread() :
    Work thread for the thread pool.
    Waits for jobs and executes them.
@@ -55,97 +186,211 @@ struct FL2POOL_ctx_s {
 */
 static void* FL2POOL_thread(void* opaque)
 {
-    FL2POOL_ctx* const ctx = (FL2POOL_ctx*)opaque;
-    if (!ctx) { return NULL; }
-    FL2_pthread_mutex_lock(&ctx->queueMutex);
+    FL2POOL_shared* const pool = (FL2POOL_shared*)opaque;
+    if (!pool) { return NULL; }
     for (;;) {
+        FL2POOL_ctx* ctx;
+        FL2POOL_job job;
 
-        /* While the mutex is locked, wait for a non-empty queue or until shutdown */
-        while (ctx->queueIndex >= ctx->queueEnd && !ctx->shutdown) {
-            FL2_pthread_cond_wait(&ctx->newJobsCond, &ctx->queueMutex);
+        FL2_pthread_mutex_lock(&pool->queueMutex);
+        FL2_atomic64_add(pool->numIdle, 1);
+        /* While the mutex is locked, wait for a queue with a job to start or until shutdown */
+        while ((ctx = FL2POOL_nextQueue(pool, &job)) == NULL && !pool->shutdown) {
+            FL2_pthread_cond_wait(&pool->newJobsCond, &pool->queueMutex);
         }
+        FL2_atomic64_add(pool->numIdle, -1);
         /* empty => shutting down: so stop */
-        if (ctx->shutdown) {
-            FL2_pthread_mutex_unlock(&ctx->queueMutex);
+        if (ctx == NULL) {
+            FL2_pthread_mutex_unlock(&pool->queueMutex);
             return opaque;
         }
-        /* Pop a job off the queue */
-        size_t n = ctx->queueIndex;
-        ++ctx->queueIndex;
-        ++ctx->numThreadsBusy;
+        /* Pass the wakeup on if more jobs can start */
+        if (FL2_atomic64_load(pool->numIdle) != 0
+            && FL2_atomic64_load(ctx->queueIndex) < FL2_atomic64_load(ctx->queueEnd))
+            FL2_pthread_cond_signal(&pool->newJobsCond);
         /* Unlock the mutex and run the job */
-        FL2_pthread_mutex_unlock(&ctx->queueMutex);
+        FL2_pthread_mutex_unlock(&pool->queueMutex);
 
-        ctx->function(ctx->opaque, n);
+        /* Run jobs from the same queue without locking while it is the only one.
+         * The busy count held by this thread keeps the queue alive. */
+        do {
+            job.function(job.opaque, job.n);
+        } while (FL2_atomic64_load(pool->numQueues) == 1 && FL2POOL_claimJob(ctx, &job));
 
-        FL2_pthread_mutex_lock(&ctx->queueMutex);
-        --ctx->numThreadsBusy;
-        /* Signal the master thread waiting for jobs to complete */
-        FL2_pthread_cond_signal(&ctx->busyCond);
+        FL2POOL_endJob(ctx, 0);
     }  /* for (;;) */
     /* Unreachable */
 }
 
-FL2POOL_ctx* FL2POOL_create(size_t numThreads)
+/*! FL2POOL_join() :
+    Shutdown the pool, wake any sleeping threads, and join all of the threads.
+*/
+static void FL2POOL_join(FL2POOL_shared* pool)
 {
-    FL2POOL_ctx* ctx;
+    /* Shut down the queue */
+    FL2_pthread_mutex_lock(&pool->queueMutex);
+    pool->shutdown = 1;
+    /* Wake up sleeping threads */
+    FL2_pthread_cond_broadcast(&pool->newJobsCond);
+    FL2_pthread_mutex_unlock(&pool->queueMutex);
+    /* Join all of the threads */
+    for (size_t i = 0; i < pool->numThreads; ++i)
+        FL2_pthread_join(pool->threads[i], NULL);
+}
+
+static void FL2POOL_freeShared(FL2POOL_shared* pool)
+{
+    FL2POOL_join(pool);
+    FL2_pthread_mutex_destroy(&pool->queueMutex);
+    FL2_pthread_cond_destroy(&pool->newJobsCond);
+    free(pool);
+}
+
+FL2POOL_shared* FL2POOL_createShared(size_t numThreads)
+{
+    FL2POOL_shared* pool;
     /* Check the parameters */
     if (!numThreads) { return NULL; }
-    /* Allocate the context and zero initialize */
-    ctx = calloc(1, sizeof(FL2POOL_ctx) + (numThreads - 1) * sizeof(FL2_pthread_t));
+    /* Allocate the pool and zero initialize */
+    pool = calloc(1, sizeof(FL2POOL_shared) + (numThreads - 1) * sizeof(FL2_pthread_t));
+    if (!pool) { return NULL; }
+    pool->rover = NULL;
+    pool->numQueues = 0;
+    pool->refCount = 1;
+    pool->numIdle = 0;
+    (void)FL2_pthread_mutex_init(&pool->queueMutex, NULL);
+    (void)FL2_pthread_cond_init(&pool->newJobsCond, NULL);
+    pool->shutdown = 0;
+    pool->numThreads = 0;
+    /* Initialize the threads */
+    {   size_t i;
+        for (i = 0; i < numThreads; ++i) {
+            if (FL2_pthread_create(&pool->threads[i], NULL, &FL2POOL_thread, pool)) {
+                pool->numThreads = i;
+                FL2POOL_freeShared(pool);
+                return NULL;
+        }   }
+        pool->numThreads = numThreads;
+    }
+    return pool;
+}
+
+/* Drop a reference to the pool, and free it if it was the last */
+static void FL2POOL_unref(FL2POOL_shared* pool)
+{
+    FL2_pthread_mutex_lock(&pool->queueMutex);
+    size_t const refCount = --pool->refCount;
+    FL2_pthread_mutex_unlock(&pool->queueMutex);
+    if (refCount == 0)
+        FL2POOL_freeShared(pool);
+}
+
+void FL2POOL_releaseShared(FL2POOL_shared* pool)
+{
+    if (pool != NULL)
+        FL2POOL_unref(pool);
+}
+
+FL2POOL_ctx* FL2POOL_attach(FL2POOL_shared* pool, size_t maxThreads)
+{
+    if (!pool || !maxThreads) { return NULL; }
+    FL2POOL_ctx* const ctx = malloc(sizeof(FL2POOL_ctx));
     if (!ctx) { return NULL; }
+    ctx->pool = pool;
+    ctx->function = NULL;
+    ctx->opaque = NULL;
+    ctx->queueBase = 0;
     /* Initialize the busy count and jobs range */
     ctx->numThreadsBusy = 0;
+    ctx->maxThreadsBusy = (long long)maxThreads;
     ctx->queueIndex = 0;
     ctx->queueEnd = 0;
-    (void)FL2_pthread_mutex_init(&ctx->queueMutex, NULL);
     (void)FL2_pthread_cond_init(&ctx->busyCond, NULL);
-    (void)FL2_pthread_cond_init(&ctx->newJobsCond, NULL);
-    ctx->shutdown = 0;
-    ctx->numThreads = 0;
-    /* Initialize the threads */
-    {   size_t i;
-        for (i = 0; i < numThreads; ++i) {
-            if (FL2_pthread_create(&ctx->threads[i], NULL, &FL2POOL_thread, ctx)) {
-                ctx->numThreads = i;
-                FL2POOL_free(ctx);
-                return NULL;
-        }   }
-        ctx->numThreads = numThreads;
+
+    FL2_pthread_mutex_lock(&pool->queueMutex);
+    if (pool->rover == NULL) {
+        ctx->prev = ctx;
+        ctx->next = ctx;
+        pool->rover = ctx;
     }
+    else {
+        /* Join the ring just before the rover, i.e. last in the current round */
+        ctx->next = pool->rover;
+        ctx->prev = pool->rover->prev;
+        ctx->prev->next = ctx;
+        ctx->next->prev = ctx;
+    }
+    FL2_atomic64_add(pool->numQueues, 1);
+    ++pool->refCount;
+    FL2_pthread_mutex_unlock(&pool->queueMutex);
     return ctx;
 }
 
-/*! FL2POOL_join() :
-    Shutdown the queue, wake any sleeping threads, and join all of the threads.
-*/
-static void FL2POOL_join(FL2POOL_ctx* ctx)
+FL2POOL_ctx* FL2POOL_create(size_t numThreads)
 {
-    /* Shut down the queue */
-    FL2_pthread_mutex_lock(&ctx->queueMutex);
-    ctx->shutdown = 1;
-    /* Wake up sleeping threads */
-    FL2_pthread_cond_broadcast(&ctx->newJobsCond);
-    FL2_pthread_mutex_unlock(&ctx->queueMutex);
-    /* Join all of the threads */
-    for (size_t i = 0; i < ctx->numThreads; ++i)
-        FL2_pthread_join(ctx->threads[i], NULL);
+    FL2POOL_shared* const pool = FL2POOL_createShared(numThreads);
+    if (!pool) { return NULL; }
+    /* The queue holds the only reference, so the threads are freed with it */
+    FL2POOL_ctx* const ctx = FL2POOL_attach(pool, numThreads);
+    FL2POOL_unref(pool);
+    return ctx;
 }
 
 void FL2POOL_free(FL2POOL_ctx *ctx)
 {
     if (!ctx) { return; }
-    FL2POOL_join(ctx);
-    FL2_pthread_mutex_destroy(&ctx->queueMutex);
+    FL2POOL_shared* const pool = ctx->pool;
+    /* Drop jobs not yet started */
+    for (;;) {
+        long long const index = FL2_atomic64_load(ctx->queueIndex);
+        long long const end = FL2_atomic64_load(ctx->queueEnd);
+        if (index >= end || FL2_atomic64_cas(ctx->queueIndex, index, end))
+            break;
+    }
+    FL2_pthread_mutex_lock(&pool->queueMutex);
+    /* Wait for those running */
+    while (FL2_atomic64_load(ctx->numThreadsBusy) != 0)
+        FL2_pthread_cond_wait(&ctx->busyCond, &pool->queueMutex);
+    /* Leave the ring */
+    if (ctx->next == ctx) {
+        pool->rover = NULL;
+    }
+    else {
+        if (pool->rover == ctx)
+            pool->rover = ctx->next;
+        ctx->prev->next = ctx->next;
+        ctx->next->prev = ctx->prev;
+    }
+    FL2_atomic64_add(pool->numQueues, -1);
+    FL2_pthread_mutex_unlock(&pool->queueMutex);
     FL2_pthread_cond_destroy(&ctx->busyCond);
-    FL2_pthread_cond_destroy(&ctx->newJobsCond);
     free(ctx);
+    FL2POOL_unref(pool);
+}
+
+int FL2POOL_rebind(FL2POOL_ctx **ctxPtr, FL2POOL_shared *pool, size_t numThreads, size_t maxThreads)
+{
+    if (!numThreads)
+        return 0;
+    if (!maxThreads || maxThreads > numThreads)
+        maxThreads = numThreads;
+    FL2POOL_ctx* const ctx = pool ? FL2POOL_attach(pool, maxThreads) : FL2POOL_create(numThreads);
+    if (!ctx)
+        return 1;
+    FL2POOL_free(*ctxPtr);
+    *ctxPtr = ctx;
+    return 0;
 }
 
 size_t FL2POOL_sizeof(FL2POOL_ctx *ctx)
 {
     if (ctx==NULL) return 0;  /* supports sizeof NULL */
-    return sizeof(*ctx) + ctx->numThreads * sizeof(FL2_pthread_t);
+    FL2POOL_shared* const pool = ctx->pool;
+    FL2_pthread_mutex_lock(&pool->queueMutex);
+    size_t const owned = pool->refCount == 1;
+    FL2_pthread_mutex_unlock(&pool->queueMutex);
+    /* Threads shared with other queues or still held by their creator are not counted */
+    return sizeof(*ctx) + owned * (sizeof(*pool) + (pool->numThreads - 1) * sizeof(FL2_pthread_t));
 }
 
 void FL2POOL_addRange(void* ctxVoid, FL2POOL_function function, void *opaque, ptrdiff_t first, ptrdiff_t end)
@@ -155,15 +400,16 @@ void FL2POOL_addRange(void* ctxVoid, FL2POOL_function function, void *opaque, pt
 		return; 
 
     /* Callers always wait for jobs to complete before adding a new set */
-    assert(!ctx->numThreadsBusy);
+    assert(FL2POOL_isIdle(ctx));
 
-    FL2_pthread_mutex_lock(&ctx->queueMutex);
-    ctx->function = function;
-    ctx->opaque = opaque;
-    ctx->queueIndex = first;
-    ctx->queueEnd = end;
-    FL2_pthread_cond_broadcast(&ctx->newJobsCond);
-    FL2_pthread_mutex_unlock(&ctx->queueMutex);
+    if (end <= first)
+        return;
+    /* All jobs are claimed, so the values can change */
+    FL2_atomicPtr_store(ctx->function, function);
+    FL2_atomicPtr_store(ctx->opaque, opaque);
+    FL2_atomic64_store(ctx->queueBase, first - FL2_atomic64_load(ctx->queueEnd));
+    FL2_atomic64_add(ctx->queueEnd, end - first);
+    FL2POOL_wake(ctx->pool, 1);
 }
 
 void FL2POOL_add(void* ctxVoid, FL2POOL_function function, void *opaque, ptrdiff_t n)
@@ -171,28 +417,56 @@ void FL2POOL_add(void* ctxVoid, FL2POOL_function function, void *opaque, ptrdiff
     FL2POOL_addRange(ctxVoid, function, opaque, n, n + 1);
 }
 
+void FL2POOL_append(void* ctxVoid, FL2POOL_function function, void *opaque, ptrdiff_t n)
+{
+    FL2POOL_ctx* const ctx = (FL2POOL_ctx*)ctxVoid;
+    if (!ctx)
+        return;
+
+    long long const queueEnd = FL2_atomic64_load(ctx->queueEnd);
+    /* Start a new range if all queued jobs have been taken, otherwise extend it.
+     * Workers can't claim a job once all are taken, so the values can change. */
+    if (FL2_atomic64_load(ctx->queueIndex) >= queueEnd) {
+        FL2_atomicPtr_store(ctx->function, function);
+        FL2_atomicPtr_store(ctx->opaque, opaque);
+        FL2_atomic64_store(ctx->queueBase, n - queueEnd);
+    }
+    else
+        assert(n == FL2_atomic64_load(ctx->queueBase) + queueEnd);
+    FL2_atomic64_add(ctx->queueEnd, 1);
+    FL2POOL_wake(ctx->pool, 0);
+}
+
 int FL2POOL_waitAll(void *ctxVoid, unsigned timeout)
 {
     FL2POOL_ctx* const ctx = (FL2POOL_ctx*)ctxVoid;
-    if (!ctx || (!ctx->numThreadsBusy && ctx->queueIndex >= ctx->queueEnd) || ctx->shutdown) { return 0; }
+    if (!ctx || FL2POOL_isIdle(ctx)) { return 0; }
 
-    FL2_pthread_mutex_lock(&ctx->queueMutex);
-    /* Need to test for ctx->queueIndex < ctx->queueEnd in case not all jobs have started */
+    FL2_pthread_mutex_lock(&ctx->pool->queueMutex);
+    /* Need to test the queue in case not all jobs have started */
     if (timeout != 0) {
-        if ((ctx->numThreadsBusy || ctx->queueIndex < ctx->queueEnd) && !ctx->shutdown)
-            FL2_pthread_cond_timedwait(&ctx->busyCond, &ctx->queueMutex, timeout);
+        if (!FL2POOL_isIdle(ctx))
+            FL2_pthread_cond_timedwait(&ctx->busyCond, &ctx->pool->queueMutex, timeout);
     }
     else {
-        while ((ctx->numThreadsBusy || ctx->queueIndex < ctx->queueEnd) && !ctx->shutdown)
-            FL2_pthread_cond_wait(&ctx->busyCond, &ctx->queueMutex);
+        while (!FL2POOL_isIdle(ctx))
+            FL2_pthread_cond_wait(&ctx->busyCond, &ctx->pool->queueMutex);
     }
-    FL2_pthread_mutex_unlock(&ctx->queueMutex);
-    return ctx->numThreadsBusy && !ctx->shutdown;
+    FL2_pthread_mutex_unlock(&ctx->pool->queueMutex);
+    /* Jobs not yet started count as busy */
+    return !FL2POOL_isIdle(ctx);
 }
 
-size_t FL2POOL_threadsBusy(void * ctx)
+size_t FL2POOL_threadsBusy(void * ctxVoid)
 {
-    return ((FL2POOL_ctx*)ctx)->numThreadsBusy;
+    FL2POOL_ctx* const ctx = (FL2POOL_ctx*)ctxVoid;
+    if (!ctx)
+        return 0;
+
+    /* Jobs added but not yet started count as busy */
+    long long const busy = FL2_atomic64_load(ctx->numThreadsBusy);
+    long long const pending = FL2_atomic64_load(ctx->queueEnd) - FL2_atomic64_load(ctx->queueIndex);
+    return (size_t)(busy + MAX(pending, 0));
 }
 
 #endif  /* FL2_SINGLETHREAD */
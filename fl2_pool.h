@@ -21,6 +21,9 @@ extern "C" {
 
 typedef struct FL2POOL_ctx_s FL2POOL_ctx;
 
+/* Worker threads shared by several queues. This is the public FL2_threadPool. */
+typedef struct FL2_threadPool_s FL2POOL_shared;
+
 /*! FL2POOL_create() :
 *  Create a thread pool with at most `numThreads` threads.
 * `numThreads` must be at least 1.
@@ -30,12 +33,41 @@ FL2POOL_ctx *FL2POOL_create(size_t numThreads);
 
 
 /*! FL2POOL_free() :
-Free a thread pool returned by FL2POOL_create().
+Free a thread pool returned by FL2POOL_create() or a queue returned by FL2POOL_attach().
+Jobs not yet started are dropped and jobs in progress are waited for.
 */
 void FL2POOL_free(FL2POOL_ctx *ctx);
 
+/*! FL2POOL_createShared() :
+*  Create `numThreads` worker threads for queues attached with FL2POOL_attach().
+*  Workers serve the queues with jobs in turn.
+* @return : FL2POOL_shared pointer on success, else NULL.
+*/
+FL2POOL_shared *FL2POOL_createShared(size_t numThreads);
+
+/*! FL2POOL_releaseShared() :
+Release the creator's reference. The threads exit once all attached queues are freed.
+*/
+void FL2POOL_releaseShared(FL2POOL_shared *pool);
+
+/*! FL2POOL_attach() :
+*  Create a queue served by the threads of `pool`, running at most `maxThreads` of its
+*  jobs at once. The queue is used in the same way as a pool from FL2POOL_create().
+* @return : FL2POOL_ctx pointer on success, else NULL.
+*/
+FL2POOL_ctx *FL2POOL_attach(FL2POOL_shared *pool, size_t maxThreads);
+
+/*! FL2POOL_rebind() :
+Replace the idle queue *ctxPtr of a context that uses `numThreads` pool threads with a queue
+on `pool` limited to `maxThreads` (0 for `numThreads`), or with a private pool if `pool` is NULL.
+Nothing is done if `numThreads` is 0.
+@return : 0 on success, or 1 on failure with *ctxPtr unchanged.
+*/
+int FL2POOL_rebind(FL2POOL_ctx **ctxPtr, FL2POOL_shared *pool, size_t numThreads, size_t maxThreads);
+
 /*! FL2POOL_sizeof() :
-return memory usage of pool returned by FL2POOL_create().
+return memory usage of pool returned by FL2POOL_create(). The threads of a shared pool are
+included only once the queue holds the last reference to them.
 */
 size_t FL2POOL_sizeof(FL2POOL_ctx *ctx);
 
@@ -53,6 +85,12 @@ Note : The function may be executed asynchronously, so `opaque` must live until
 void FL2POOL_add(void* ctxVoid, FL2POOL_function function, void *opaque, ptrdiff_t n);
 void FL2POOL_addRange(void *ctx, FL2POOL_function function, void *opaque, ptrdiff_t first, ptrdiff_t end);
 
+/*! FL2POOL_append() :
+Add job `n` without waiting for jobs in progress. If queued jobs have not all started,
+`n` must follow the last one and `function` and `opaque` must be unchanged.
+*/
+void FL2POOL_append(void *ctx, FL2POOL_function function, void *opaque, ptrdiff_t n);
+
 int FL2POOL_waitAll(void *ctx, unsigned timeout);
 
 size_t FL2POOL_threadsBusy(void *ctx);
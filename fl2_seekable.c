@@ -0,0 +1,344 @@
+/*
+* Copyright (c) 2018, Conor McCarthy
+* All rights reserved.
+*
+* This source code is licensed under both the BSD-style license (found in the
+* LICENSE file in the root directory of this source tree) and the GPLv2 (found
+* in the COPYING file in the root directory of this source tree).
+* You may select, at your option, one of the above-listed licenses.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "fast-lzma2.h"
+#include "fl2_errors.h"
+#include "fl2_internal.h"
+#include "mem.h"
+#include "fl2_mmap.h"
+
+#define FL2_SEEKABLE_HEADER_SIZE 4
+#define FL2_SEEKABLE_ENTRY_SIZE 8
+#define FL2_SEEKABLE_FOOTER_SIZE 8
+
+#define FL2_SEEKABLE_NO_FRAME ((size_t)-1)
+
+static size_t FL2_seekableFrameSize(size_t const frameSize)
+{
+    return frameSize ? frameSize : FL2_SEEKABLE_FRAME_DEFAULT;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_seekableBound(size_t srcSize, size_t frameSize)
+{
+    frameSize = FL2_seekableFrameSize(frameSize);
+    size_t const nbFrames = srcSize / frameSize;
+    size_t const rem = srcSize % frameSize;
+    return FL2_SEEKABLE_HEADER_SIZE + nbFrames * FL2_compressBound(frameSize) + (rem ? FL2_compressBound(rem) : 0)
+        + (nbFrames + (rem != 0)) * FL2_SEEKABLE_ENTRY_SIZE + FL2_SEEKABLE_FOOTER_SIZE;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_compressSeekable(FL2_CCtx* cctx,
+    void* dst, size_t dstCapacity,
+    const void* src, size_t srcSize,
+    size_t frameSize)
+{
+    frameSize = FL2_seekableFrameSize(frameSize);
+    if (frameSize > FL2_SEEKABLE_FRAME_MAX)
+        return FL2_ERROR(parameter_outOfBound);
+
+    size_t const nbFrames = (srcSize + frameSize - 1) / frameSize;
+    if (nbFrames > 0xFFFFFFFFU)
+        return FL2_ERROR(srcSize_wrong);
+
+    size_t const tableSize = nbFrames * FL2_SEEKABLE_ENTRY_SIZE + FL2_SEEKABLE_FOOTER_SIZE;
+    if (dstCapacity < FL2_SEEKABLE_HEADER_SIZE + tableSize)
+        return FL2_ERROR(dstSize_tooSmall);
+
+    /* Frames are written first, so the table entries are kept until the end */
+    U32* const sizes = malloc(nbFrames * 2 * sizeof(U32) + 1);
+    if (sizes == NULL)
+        return FL2_ERROR(memory_allocation);
+
+    BYTE* dstBuf = dst;
+    MEM_writeLE32(dstBuf, FL2_SEEKABLE_HEADER_MAGIC);
+    dstBuf += FL2_SEEKABLE_HEADER_SIZE;
+    size_t avail = dstCapacity - FL2_SEEKABLE_HEADER_SIZE - tableSize;
+    for (size_t u = 0; u < nbFrames; ++u) {
+        size_t const size = MIN(frameSize, srcSize - u * frameSize);
+        size_t const cSize = FL2_compressCCtx(cctx, dstBuf, avail, (const BYTE*)src + u * frameSize, size, 0);
+        if (FL2_isError(cSize)) {
+            free(sizes);
+            return cSize;
+        }
+        DEBUGLOG(5, "Seekable frame %u : %u => %u", (unsigned)u, (unsigned)size, (unsigned)cSize);
+        sizes[u * 2] = (U32)cSize;
+        sizes[u * 2 + 1] = (U32)size;
+        dstBuf += cSize;
+        avail -= cSize;
+    }
+    for (size_t u = 0; u < nbFrames; ++u) {
+        MEM_writeLE32(dstBuf, sizes[u * 2]);
+        MEM_writeLE32(dstBuf + 4, sizes[u * 2 + 1]);
+        dstBuf += FL2_SEEKABLE_ENTRY_SIZE;
+    }
+    MEM_writeLE32(dstBuf, (U32)nbFrames);
+    MEM_writeLE32(dstBuf + 4, FL2_SEEKABLE_MAGIC);
+    dstBuf += FL2_SEEKABLE_FOOTER_SIZE;
+
+    free(sizes);
+
+    return dstBuf - (BYTE*)dst;
+}
+
+typedef struct
+{
+    BYTE* data;
+    size_t frame;       /* frame held, or FL2_SEEKABLE_NO_FRAME */
+    U64 lastUse;
+} FL2_seekCacheSlot;
+
+struct FL2_seekable_s
+{
+    FL2_DCtx* dctx;
+    const BYTE* src;
+    FL2_mapping map;            /* file mapping, if opened with FL2_initSeekableFile() */
+    U64* packPos;               /* frame positions, with the end of the last frame at nbFrames */
+    U64* unpackPos;
+    size_t nbFrames;
+    size_t slotSize;            /* capacity of each cache slot */
+    U64 useCount;
+    unsigned cacheFrames;
+    FL2_seekCacheSlot cache[1];
+};
+
+FL2LIB_API FL2_seekable* FL2LIB_CALL FL2_createSeekable(unsigned nbThreads, unsigned cacheFrames)
+{
+    if (cacheFrames == 0)
+        cacheFrames = FL2_SEEKABLE_CACHE_DEFAULT;
+
+    FL2_seekable* const fs = calloc(1, sizeof(FL2_seekable) + (cacheFrames - 1) * sizeof(FL2_seekCacheSlot));
+    if (fs == NULL)
+        return NULL;
+
+    fs->cacheFrames = cacheFrames;
+    for (unsigned u = 0; u < cacheFrames; ++u)
+        fs->cache[u].frame = FL2_SEEKABLE_NO_FRAME;
+
+    fs->dctx = FL2_createDCtxMt(nbThreads);
+    if (fs->dctx == NULL) {
+        free(fs);
+        return NULL;
+    }
+    return fs;
+}
+
+/* Release the container and the decoded frames */
+static void FL2_closeSeekable(FL2_seekable* const fs)
+{
+    FL2_unmapFile(&fs->map);
+    free(fs->packPos);
+    free(fs->unpackPos);
+    fs->src = NULL;
+    fs->packPos = NULL;
+    fs->unpackPos = NULL;
+    fs->nbFrames = 0;
+    for (unsigned u = 0; u < fs->cacheFrames; ++u)
+        fs->cache[u].frame = FL2_SEEKABLE_NO_FRAME;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_freeSeekable(FL2_seekable* fs)
+{
+    if (fs == NULL)
+        return 0;
+
+    FL2_closeSeekable(fs);
+    for (unsigned u = 0; u < fs->cacheFrames; ++u)
+        free(fs->cache[u].data);
+    FL2_freeDCtx(fs->dctx);
+    free(fs);
+
+    return 0;
+}
+
+/* Read the seek table and build the frame position arrays */
+static size_t FL2_readSeekTable(FL2_seekable* const fs, const BYTE* const src, size_t const srcSize)
+{
+    if (srcSize < FL2_SEEKABLE_HEADER_SIZE + FL2_SEEKABLE_FOOTER_SIZE)
+        return FL2_ERROR(srcSize_wrong);
+
+    const BYTE* const footer = src + srcSize - FL2_SEEKABLE_FOOTER_SIZE;
+    if (MEM_readLE32(src) != FL2_SEEKABLE_HEADER_MAGIC || MEM_readLE32(footer + 4) != FL2_SEEKABLE_MAGIC)
+        return FL2_ERROR(corruption_detected);
+
+    size_t const nbFrames = MEM_readLE32(footer);
+    if (nbFrames > (srcSize - FL2_SEEKABLE_HEADER_SIZE - FL2_SEEKABLE_FOOTER_SIZE) / FL2_SEEKABLE_ENTRY_SIZE)
+        return FL2_ERROR(corruption_detected);
+
+    /* End of the frames, where the table begins */
+    size_t const framesEnd = srcSize - FL2_SEEKABLE_FOOTER_SIZE - nbFrames * FL2_SEEKABLE_ENTRY_SIZE;
+    const BYTE* entry = src + framesEnd;
+
+    fs->packPos = malloc((nbFrames + 1) * sizeof(U64));
+    fs->unpackPos = malloc((nbFrames + 1) * sizeof(U64));
+    if (fs->packPos == NULL || fs->unpackPos == NULL)
+        return FL2_ERROR(memory_allocation);
+
+    size_t maxSize = 0;
+    U64 packPos = FL2_SEEKABLE_HEADER_SIZE;
+    U64 unpackPos = 0;
+    for (size_t u = 0; u < nbFrames; ++u, entry += FL2_SEEKABLE_ENTRY_SIZE) {
+        U32 const cSize = MEM_readLE32(entry);
+        U32 const size = MEM_readLE32(entry + 4);
+        if (cSize == 0 || size == 0 || size > FL2_SEEKABLE_FRAME_MAX)
+            return FL2_ERROR(corruption_detected);
+        fs->packPos[u] = packPos;
+        fs->unpackPos[u] = unpackPos;
+        packPos += cSize;
+        unpackPos += size;
+        maxSize = MAX(maxSize, size);
+    }
+    fs->packPos[nbFrames] = packPos;
+    fs->unpackPos[nbFrames] = unpackPos;
+
+    /* The frames must fill the space between the header and the table */
+    if (packPos != framesEnd)
+        return FL2_ERROR(corruption_detected);
+
+    /* Slots are reallocated on first use if frames are larger than before */
+    if (maxSize > fs->slotSize) {
+        for (unsigned u = 0; u < fs->cacheFrames; ++u) {
+            free(fs->cache[u].data);
+            fs->cache[u].data = NULL;
+        }
+        fs->slotSize = maxSize;
+    }
+    fs->src = src;
+    fs->nbFrames = nbFrames;
+
+    return 0;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_initSeekable(FL2_seekable* fs, const void* src, size_t srcSize)
+{
+    FL2_closeSeekable(fs);
+
+    size_t const res = FL2_readSeekTable(fs, src, srcSize);
+    if (FL2_isError(res))
+        FL2_closeSeekable(fs);
+
+    return res;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_initSeekableFile(FL2_seekable* fs, int fd)
+{
+    FL2_closeSeekable(fs);
+
+    CHECK_F(FL2_mapFile(&fs->map, fd));
+
+    size_t const res = FL2_readSeekTable(fs, fs->map.data, fs->map.size);
+    if (FL2_isError(res))
+        FL2_closeSeekable(fs);
+
+    return res;
+}
+
+FL2LIB_API unsigned long long FL2LIB_CALL FL2_getSeekableContentSize(const FL2_seekable* fs)
+{
+    return fs->src != NULL ? fs->unpackPos[fs->nbFrames] : 0;
+}
+
+/* Decode one whole frame into dst, which must hold its decompressed size */
+static size_t FL2_decodeSeekableFrame(FL2_seekable* const fs, size_t const frame, void* const dst)
+{
+    size_t const size = (size_t)(fs->unpackPos[frame + 1] - fs->unpackPos[frame]);
+    size_t const res = FL2_decompressDCtx(fs->dctx, dst, size,
+        fs->src + fs->packPos[frame], (size_t)(fs->packPos[frame + 1] - fs->packPos[frame]));
+
+    if (FL2_isError(res))
+        return res;
+    if (res != size)
+        return FL2_ERROR(corruption_detected);
+
+    return res;
+}
+
+static FL2_seekCacheSlot* FL2_findCachedFrame(FL2_seekable* const fs, size_t const frame)
+{
+    for (unsigned u = 0; u < fs->cacheFrames; ++u)
+        if (fs->cache[u].frame == frame)
+            return fs->cache + u;
+    return NULL;
+}
+
+/* Decode frame into the least recently used cache slot */
+static size_t FL2_cacheFrame(FL2_seekable* const fs, size_t const frame, FL2_seekCacheSlot** const slotPtr)
+{
+    FL2_seekCacheSlot* slot = fs->cache;
+
+    for (unsigned u = 1; u < fs->cacheFrames; ++u)
+        if (fs->cache[u].lastUse < slot->lastUse)
+            slot = fs->cache + u;
+
+    if (slot->data == NULL) {
+        slot->data = malloc(fs->slotSize);
+        if (slot->data == NULL)
+            return FL2_ERROR(memory_allocation);
+    }
+    slot->frame = FL2_SEEKABLE_NO_FRAME;
+    slot->lastUse = 0;
+
+    DEBUGLOG(4, "Seekable : decoding frame %u into cache", (unsigned)frame);
+    CHECK_F(FL2_decodeSeekableFrame(fs, frame, slot->data));
+
+    slot->frame = frame;
+    *slotPtr = slot;
+
+    return 0;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_readSeekable(FL2_seekable* fs,
+    void* dst, size_t size,
+    unsigned long long offset)
+{
+    if (fs->src == NULL)
+        return FL2_ERROR(init_missing);
+
+    U64 const contentSize = fs->unpackPos[fs->nbFrames];
+    if (offset >= contentSize)
+        return 0;
+    if (size > contentSize - offset)
+        size = (size_t)(contentSize - offset);
+
+    /* Find the last frame starting at or before offset */
+    size_t frame = 0;
+    size_t high = fs->nbFrames;
+    while (high - frame > 1) {
+        size_t const mid = (frame + high) / 2;
+        if (fs->unpackPos[mid] <= offset)
+            frame = mid;
+        else
+            high = mid;
+    }
+
+    BYTE* const out = dst;
+    size_t done = 0;
+    for (; done < size; ++frame) {
+        size_t const frameSize = (size_t)(fs->unpackPos[frame + 1] - fs->unpackPos[frame]);
+        size_t const inFrame = (size_t)(offset + done - fs->unpackPos[frame]);
+        size_t const len = MIN(frameSize - inFrame, size - done);
+
+        FL2_seekCacheSlot* slot = FL2_findCachedFrame(fs, frame);
+
+        if (slot == NULL && len == frameSize) {
+            /* A whole frame is needed only once */
+            CHECK_F(FL2_decodeSeekableFrame(fs, frame, out + done));
+        }
+        else {
+            if (slot == NULL)
+                CHECK_F(FL2_cacheFrame(fs, frame, &slot));
+            slot->lastUse = ++fs->useCount;
+            memcpy(out + done, slot->data + inFrame, len);
+        }
+        done += len;
+    }
+    return done;
+}
@@ -17,6 +17,7 @@
 #  define _CRT_SECURE_NO_WARNINGS   /* fgets */
 #  pragma warning(disable : 4127)   /* disable: C4127: conditional expression is constant */
 #  pragma warning(disable : 4204)   /* disable: C4204: non-constant aggregate initializer */
+#  define fileno _fileno
 #endif
 
 
@@ -33,6 +34,7 @@
 #include "datagen.h"      /* RDG_genBuffer */
 #include "../mem.h"
 #include "../xxhash.h"
+#include "../fl2_pool.h"
 
 /*-************************************
 *  Constants
@@ -266,6 +268,14 @@ static size_t findDiff(const void* buf1, const void* buf2, size_t max)
 *   Unit tests
 =============================================*/
 
+#ifndef FL2_SINGLETHREAD
+/* FUZ_poolJob() : FL2POOL_function type. Counts the runs of each job. */
+static void FUZ_poolJob(void* opaque, ptrdiff_t n)
+{
+    ++((BYTE*)opaque)[n];
+}
+#endif
+
 #define CHECK_V(var, fn)  size_t const var = fn; if (FL2_isError(var)) goto _output_error
 #define CHECK(fn)  { CHECK_V(err, fn); }
 #define CHECKPLUS(var, fn, more)  { CHECK_V(var, fn); more; }
@@ -333,6 +343,84 @@ static int basicUnitTests(unsigned nbThreads, U32 seed, double compressibility)
         FL2_freeCCtx(cctx);
     }
 
+    DISPLAYLEVEL(4, "test%3i : compress %u bytes with pipelined blocks : ", testNb++, (U32)(8 MB));
+    {   FL2_CCtx* const cctx = FL2_createCCtxMt(MAX(nbThreads, 2));
+        BYTE* const pipeBuffer = malloc(FL2_compressBound(8 MB));
+        size_t r;
+        if (cctx == NULL || pipeBuffer == NULL) {
+            FL2_freeCCtx(cctx);
+            free(pipeBuffer);
+            goto _output_error;
+        }
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 1);
+        FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, 20);
+        r = FL2_estimateCCtxSize_usingCCtx(cctx);
+        FL2_CCtx_setParameter(cctx, FL2_p_pipelineBlocks, 1);
+        /* The second match table must be included in the estimate */
+        if (FL2_estimateCCtxSize_usingCCtx(cctx) > r) {
+            r = FL2_compressCCtx(cctx, pipeBuffer, FL2_compressBound(8 MB), CNBuffer, 8 MB, 0);
+            if (!FL2_isError(r))
+                r = FL2_decompress(decodedBuffer, 8 MB, pipeBuffer, r);
+        }
+        FL2_freeCCtx(cctx);
+        free(pipeBuffer);
+        if (r != 8 MB || findDiff(decodedBuffer, CNBuffer, 8 MB) < 8 MB) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : compress %u bytes in concurrent reset groups : ", testNb++, (U32)(8 MB));
+    {   FL2_CCtx* const cctx = FL2_createCCtxMt(MAX(nbThreads, 2));
+        BYTE* const groupBuffer = malloc(FL2_compressBound(8 MB));
+        size_t r;
+        if (cctx == NULL || groupBuffer == NULL) {
+            FL2_freeCCtx(cctx);
+            free(groupBuffer);
+            goto _output_error;
+        }
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 1);
+        FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, 20);
+        FL2_CCtx_setParameter(cctx, FL2_p_resetInterval, 1);
+        r = FL2_estimateCCtxSize_usingCCtx(cctx);
+        FL2_CCtx_setParameter(cctx, FL2_p_groupMemoryBudget, 64);
+        /* The group contexts must be included in the estimate */
+        if (FL2_estimateCCtxSize_usingCCtx(cctx) > r) {
+            r = FL2_compressCCtx(cctx, groupBuffer, FL2_compressBound(8 MB), CNBuffer, 8 MB, 0);
+            if (!FL2_isError(r))
+                r = FL2_decompress(decodedBuffer, 8 MB, groupBuffer, r);
+        }
+        FL2_freeCCtx(cctx);
+        free(groupBuffer);
+        if (r != 8 MB || findDiff(decodedBuffer, CNBuffer, 8 MB) < 8 MB) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : compress %u byte file through a mapping : ", testNb++, (U32)(3 MB));
+    {   FL2_CCtx* const cctx = FL2_createCCtxMt(nbThreads);
+        FILE* const fin = tmpfile();
+        FILE* const fout = tmpfile();
+        BYTE* const fileBuffer = malloc(FL2_compressBound(3 MB));
+        size_t r = 0;
+        /* Failure to create the files is an error, not a reason to skip the mapping paths */
+        int bad = cctx == NULL || fin == NULL || fout == NULL || fileBuffer == NULL
+            || fwrite(CNBuffer, 1, 3 MB, fin) != 3 MB || fflush(fin) != 0;
+        if (!bad) {
+            /* 1 MB dictionary so the file spans several blocks */
+            FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, 20);
+            r = FL2_compressFile(cctx, fileno(fout), fileno(fin), 1);
+            if (!FL2_isError(r) && r <= FL2_compressBound(3 MB)) {
+                rewind(fout);
+                if (fread(fileBuffer, 1, r, fout) == r)
+                    r = FL2_decompress(decodedBuffer, 3 MB, fileBuffer, r);
+            }
+        }
+        FL2_freeCCtx(cctx);
+        if (fin != NULL) fclose(fin);
+        if (fout != NULL) fclose(fout);
+        free(fileBuffer);
+        if (bad || r != 3 MB || findDiff(decodedBuffer, CNBuffer, 3 MB) < 3 MB) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
     DISPLAYLEVEL(4, "test%3i : FL2_findDecompressedSize test : ", testNb++);
     {   unsigned long long const rSize = FL2_findDecompressedSize(compressedBuffer, cSize);
         if (rSize != CNBuffSize) goto _output_error;
@@ -350,12 +438,161 @@ static int basicUnitTests(unsigned nbThreads, U32 seed, double compressibility)
     }
     DISPLAYLEVEL(4, "OK \n");
 
+    DISPLAYLEVEL(4, "test%3i : decompress with 16 and 32-bit probs : ", testNb++);
+    {   FL2_DCtx* dctx = FL2_createDCtx();
+        unsigned bits;
+        if (dctx == NULL) goto _output_error;
+        for (bits = 16; bits <= 32; bits += 16) {
+            size_t r;
+            CHECK(FL2_setDCtxProbBits(dctx, bits));
+            memset(decodedBuffer, 0, CNBuffSize);
+            r = FL2_decompressDCtx(dctx, decodedBuffer, CNBuffSize, compressedBuffer, cSize);
+            if (r != CNBuffSize || findDiff(decodedBuffer, CNBuffer, CNBuffSize) < CNBuffSize) {
+                FL2_freeDCtx(dctx);
+                goto _output_error;
+            }
+        }
+        if (!FL2_isError(FL2_setDCtxProbBits(dctx, 8))) {
+            FL2_freeDCtx(dctx);
+            goto _output_error;
+        }
+        FL2_freeDCtx(dctx);
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : decompress file through mappings : ", testNb++);
+    {   FL2_DCtx* const dctx = FL2_createDCtxMt(nbThreads);
+        FILE* const fin = tmpfile();
+        FILE* const fout = tmpfile();
+        size_t r = 0;
+        int bad = dctx == NULL || fin == NULL || fout == NULL
+            || fwrite(compressedBuffer, 1, cSize, fin) != cSize || fflush(fin) != 0;
+        if (!bad) {
+            r = FL2_decompressFile(dctx, fileno(fout), fileno(fin));
+            if (r == CNBuffSize) {
+                memset(decodedBuffer, 0, CNBuffSize);
+                rewind(fout);
+                if (fread(decodedBuffer, 1, CNBuffSize, fout) != CNBuffSize)
+                    r = 1;
+            }
+            /* A failed decode must not leave a full-size output file */
+            if (r == CNBuffSize) {
+                BYTE const c = (BYTE)~((const BYTE*)compressedBuffer)[cSize / 2];
+                if (fseek(fin, (long)(cSize / 2), SEEK_SET) != 0 || fwrite(&c, 1, 1, fin) != 1 || fflush(fin) != 0
+                        || !FL2_isError(FL2_decompressFile(dctx, fileno(fout), fileno(fin)))
+                        || fseek(fout, 0, SEEK_END) != 0 || ftell(fout) != 0)
+                    r = 1;
+            }
+        }
+        FL2_freeDCtx(dctx);
+        if (fin != NULL) fclose(fin);
+        if (fout != NULL) fclose(fout);
+        if (bad || r != CNBuffSize || findDiff(decodedBuffer, CNBuffer, CNBuffSize) < CNBuffSize) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
     DISPLAYLEVEL(4, "test%3i : decompress with 1 missing byte : ", testNb++);
     { size_t const r = FL2_decompress(decodedBuffer, CNBuffSize, compressedBuffer, cSize-1);
       if (!FL2_isError(r)) goto _output_error;
       if (FL2_getErrorCode((size_t)r) != FL2_error_srcSize_wrong) goto _output_error; }
     DISPLAYLEVEL(4, "OK \n");
 
+    DISPLAYLEVEL(4, "test%3i : batch decompress small frames : ", testNb++);
+    {
+#define BATCH_FRAMES 9
+        FL2_DCtx* const dctx = FL2_createDCtxMt(nbThreads);
+        size_t const frameBufSize = FL2_compressBound(BATCH_FRAMES * 16 KB);
+        BYTE* const frameBuf = malloc(frameBufSize);
+        void* dsts[BATCH_FRAMES];
+        const void* srcs[BATCH_FRAMES];
+        size_t dstCapacities[BATCH_FRAMES];
+        size_t srcSizes[BATCH_FRAMES];
+        size_t results[BATCH_FRAMES];
+        size_t pos = 0;
+        int u;
+        if (dctx == NULL || frameBuf == NULL) {
+            FL2_freeDCtx(dctx);
+            free(frameBuf);
+            goto _output_error;
+        }
+        for (u = 0; u < BATCH_FRAMES; ++u) {
+            size_t const frameSize = 1 KB + u * 1500;
+            size_t const r = FL2_compress(frameBuf + pos, frameBufSize - pos, (BYTE*)CNBuffer + u * 16 KB, frameSize, 1);
+            if (FL2_isError(r)) {
+                FL2_freeDCtx(dctx);
+                free(frameBuf);
+                goto _output_error;
+            }
+            srcs[u] = frameBuf + pos;
+            srcSizes[u] = r;
+            dsts[u] = (BYTE*)decodedBuffer + u * 16 KB;
+            dstCapacities[u] = frameSize;
+            pos += r;
+        }
+        memset(decodedBuffer, 0, BATCH_FRAMES * 16 KB);
+        if (FL2_decompressDCtxBatch(dctx, dsts, dstCapacities, srcs, srcSizes, results, BATCH_FRAMES) != 0) {
+            FL2_freeDCtx(dctx);
+            free(frameBuf);
+            goto _output_error;
+        }
+        for (u = 0; u < BATCH_FRAMES; ++u) {
+            if (results[u] != dstCapacities[u]
+                || findDiff(dsts[u], (BYTE*)CNBuffer + u * 16 KB, results[u]) < results[u]) {
+                FL2_freeDCtx(dctx);
+                free(frameBuf);
+                goto _output_error;
+            }
+        }
+        /* A truncated frame must fail without affecting the others */
+        --srcSizes[BATCH_FRAMES / 2];
+        {   size_t const r = FL2_decompressDCtxBatch(dctx, dsts, dstCapacities, srcs, srcSizes, results, BATCH_FRAMES);
+            int const ok = FL2_isError(r) && FL2_isError(results[BATCH_FRAMES / 2])
+                && results[0] == dstCapacities[0] && results[BATCH_FRAMES - 1] == dstCapacities[BATCH_FRAMES - 1];
+            FL2_freeDCtx(dctx);
+            free(frameBuf);
+            if (!ok) goto _output_error;
+        }
+#undef BATCH_FRAMES
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : decompress ranges from dictionary resets : ", testNb++);
+    {   FL2_DCtx* const dctx = FL2_createDCtx();
+        static const size_t offsets[] = { 0, 1, 777777, 9 MB + 12345, 20 MB - 1000, 20 MB };
+        size_t u;
+        if (dctx == NULL) goto _output_error;
+        for (u = 0; u < sizeof(offsets) / sizeof(offsets[0]); ++u) {
+            size_t const expected = MIN(64 KB, CNBuffSize - offsets[u]);
+            size_t const r = FL2_decompressRange(dctx, decodedBuffer, 64 KB, compressedBuffer, cSize, offsets[u]);
+            if (r != expected || findDiff(decodedBuffer, (BYTE*)CNBuffer + offsets[u], r) < r) {
+                FL2_freeDCtx(dctx);
+                goto _output_error;
+            }
+        }
+        FL2_freeDCtx(dctx);
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : compress incompressible data into FL2_compressBound() bytes : ", testNb++);
+    {   static const size_t sizes[] = { 1, 100, 30000, 70000, 200000 };
+        BYTE* const noise = malloc(200000 + FL2_compressBound(200000));
+        size_t u;
+        if (noise == NULL) goto _output_error;
+        RDG_genBuffer(noise, 200000, 0., 0., seed);
+        for (u = 0; u < sizeof(sizes) / sizeof(sizes[0]); ++u) {
+            BYTE* const cBuf = noise + 200000;
+            size_t r = FL2_compress(cBuf, FL2_compressBound(sizes[u]), noise, sizes[u], 4);
+            if (!FL2_isError(r))
+                r = FL2_decompress(decodedBuffer, sizes[u], cBuf, r);
+            if (r != sizes[u] || findDiff(decodedBuffer, noise, r) < r) {
+                free(noise);
+                goto _output_error;
+            }
+        }
+        free(noise);
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
     DISPLAYLEVEL(4, "test%3i : compress/decompress empty input : ", testNb++);
     {   FL2_CCtx* cctx = FL2_createCCtx();
         size_t r = FL2_compressCCtx(cctx, compressedBuffer, compressedBufferSize, NULL, 0, 10);
@@ -379,6 +616,12 @@ static int basicUnitTests(unsigned nbThreads, U32 seed, double compressibility)
 
     /* streaming tests */
 
+    DISPLAYLEVEL(4, "test%3i : pipelined blocks rejected for streams : ", testNb++);
+    if (!FL2_isError(FL2_CStream_setParameter(cstream, FL2_p_pipelineBlocks, 1))
+        || !FL2_isError(FL2_CStream_getParameter(cstream, FL2_p_pipelineBlocks)))
+        goto _output_error;
+    DISPLAYLEVEL(4, "OK \n");
+
     DISPLAYLEVEL(4, "test%3i : compress stream in many chunks : ", testNb++);
     {   BYTE cBuf[0x8101];
         FL2_outBuffer out = { cBuf, sizeof(cBuf), 0 };
@@ -532,6 +775,780 @@ static int basicUnitTests(unsigned nbThreads, U32 seed, double compressibility)
     }
     DISPLAYLEVEL(4, "OK \n");
 
+    DISPLAYLEVEL(4, "test%3i : compress stream from scattered segments : ", testNb++);
+    {   size_t const vecSize = 4 MB;
+        size_t const maxSegs = vecSize / 256 + 1;
+        FL2_inSegment* const segs = malloc(maxSegs * sizeof(FL2_inSegment));
+        size_t const vBufSize = FL2_compressBound(vecSize);
+        BYTE* const vBuf = malloc(vBufSize);
+        FL2_outBuffer out = { vBuf, vBufSize, 0 };
+        FL2_inVector in = { segs, 0, 0, 0 };
+        size_t total = 0;
+        size_t r;
+        unsigned rand = seed;
+        int bad = 0;
+        if (segs == NULL || vBuf == NULL) {
+            free(segs);
+            free(vBuf);
+            goto _output_error;
+        }
+        /* Segment sizes 0 to 511 */
+        while (total < vecSize && in.nbSegs < maxSegs) {
+            size_t const size = MIN(FUZ_rand(&rand) & 511, vecSize - total);
+            segs[in.nbSegs].src = (BYTE*)CNBuffer + total;
+            segs[in.nbSegs].size = size;
+            total += size;
+            ++in.nbSegs;
+        }
+        r = FL2_initCStream(cstream, 2);
+        /* Resume positions outside the vector are rejected */
+        if (!FL2_isError(r)) {
+            FL2_inVector badIn = in;
+            badIn.index = in.nbSegs + 1;
+            if (!FL2_isError(FL2_compressStreamV(cstream, &out, &badIn)))
+                bad = 1;
+            badIn.index = 0;
+            badIn.pos = segs[0].size + 1;
+            if (!FL2_isError(FL2_compressStreamV(cstream, &out, &badIn)))
+                bad = 1;
+        }
+        while (!FL2_isError(r) && in.index < in.nbSegs)
+            r = FL2_compressStreamV(cstream, &out, &in);
+        if (!FL2_isError(r)) do {
+            r = FL2_endStream(cstream, &out);
+        } while (!FL2_isError(r) && r);
+        if (!FL2_isError(r))
+            r = FL2_decompress(decodedBuffer, total, vBuf, out.pos);
+        free(segs);
+        free(vBuf);
+        if (bad || r != total || findDiff(decodedBuffer, CNBuffer, total) < total) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : compress stream with low-latency flushes : ", testNb++);
+    {   size_t const msgTotal = 1 MB;
+        size_t const fBufSize = FL2_compressBound(msgTotal) * 2;
+        BYTE* const fBuf = malloc(fBufSize);
+        FL2_outBuffer out = { fBuf, fBufSize, 0 };
+        size_t total = 0;
+        size_t r;
+        unsigned rand = seed;
+        if (fBuf == NULL) goto _output_error;
+        r = FL2_CCtx_setParameter(cstream, FL2_p_flushWindowLog, 16);
+        if (!FL2_isError(r))
+            r = FL2_initCStream(cstream, 2);
+        /* Messages of 64 to 4159 bytes, each flushed */
+        while (!FL2_isError(r) && total < msgTotal) {
+            FL2_inBuffer in = { (BYTE*)CNBuffer + total, MIN(64 + (FUZ_rand(&rand) & 4095), msgTotal - total), 0 };
+            while (!FL2_isError(r) && in.pos < in.size)
+                r = FL2_compressStream(cstream, &out, &in);
+            total += in.pos;
+            while (!FL2_isError(r) && (r = FL2_flushStream(cstream, &out)) != 0)
+                ;
+        }
+        if (!FL2_isError(r)) do {
+            r = FL2_endStream(cstream, &out);
+        } while (!FL2_isError(r) && r);
+        FL2_CCtx_setParameter(cstream, FL2_p_flushWindowLog, 0);
+        if (!FL2_isError(r))
+            r = FL2_decompress(decodedBuffer, total, fBuf, out.pos);
+        free(fBuf);
+        if (r != total || findDiff(decodedBuffer, CNBuffer, total) < total) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : compress stream through a 3-buffer dictionary ring : ", testNb++);
+    {   FL2_CStream *const ring = FL2_createCStreamMt(nbThreads, 3);
+        size_t const srcSize = 8 MB;
+        size_t const fBufSize = FL2_compressBound(srcSize);
+        BYTE* const fBuf = malloc(fBufSize);
+        BYTE outBuf[4096];
+        size_t pos = 0;
+        size_t r;
+        int overflow = 0;
+        if (ring == NULL || fBuf == NULL) {
+            FL2_freeCStream(ring);
+            free(fBuf);
+            goto _output_error;
+        }
+        r = FL2_CCtx_setParameter(ring, FL2_p_dictionaryLog, 20);
+        if (!FL2_isError(r))
+            r = FL2_initCStream(ring, 4);
+        {   FL2_inBuffer in = { CNBuffer, 0, 0 };
+            while (!FL2_isError(r) && !overflow && in.size < srcSize) {
+                FL2_outBuffer out = { outBuf, sizeof(outBuf), 0 };
+                in.size = MIN(in.size + 50000, srcSize);
+                while (!FL2_isError(r) && in.pos < in.size && out.pos < out.size)
+                    r = FL2_compressStream(ring, &out, &in);
+                overflow = pos + out.pos > fBufSize;
+                if (!overflow) memcpy(fBuf + pos, outBuf, out.pos), pos += out.pos;
+            }
+            if (!FL2_isError(r) && !overflow) do {
+                FL2_outBuffer out = { outBuf, sizeof(outBuf), 0 };
+                r = FL2_endStream(ring, &out);
+                overflow = pos + out.pos > fBufSize;
+                if (!overflow) memcpy(fBuf + pos, outBuf, out.pos), pos += out.pos;
+            } while (!FL2_isError(r) && !overflow && r);
+            overflow |= in.pos != srcSize;
+        }
+        FL2_freeCStream(ring);
+        if (!FL2_isError(r) && !overflow)
+            r = FL2_decompress(decodedBuffer, srcSize, fBuf, pos);
+        free(fBuf);
+        if (r != srcSize || findDiff(decodedBuffer, CNBuffer, srcSize) < srcSize) goto _output_error;
+        {   FL2_compressionParameters params;
+            CHECK(FL2_getLevelParameters(4, 0, &params));
+            if (FL2_estimateCStreamSize_byParams(&params, nbThreads, 3)
+                <= FL2_estimateCStreamSize_byParams(&params, nbThreads, 1))
+                goto _output_error;
+        }
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : compress stream with a mirrored dictionary : ", testNb++);
+    {   size_t const srcSize = 8 MB;
+        size_t const fBufSize = FL2_compressBound(srcSize) * 2;
+        BYTE* const fBuf = malloc(fBufSize);
+        FL2_outBuffer out = { fBuf, fBufSize, 0 };
+        FL2_inBuffer in = { CNBuffer, 0, 0 };
+        size_t r;
+        if (fBuf == NULL) goto _output_error;
+        r = FL2_CCtx_setParameter(cstream, FL2_p_compressionLevel, 4);
+        if (!FL2_isError(r))
+            r = FL2_CCtx_setParameter(cstream, FL2_p_dictionaryLog, 20);
+        if (!FL2_isError(r))
+            r = FL2_CCtx_setParameter(cstream, FL2_p_mirroredDictionary, 1);
+        if (!FL2_isError(r))
+            r = FL2_initCStream(cstream, 0);
+        /* Many shifts of a small dictionary, some while the previous block is compressing */
+        while (!FL2_isError(r) && in.size < srcSize) {
+            in.size = MIN(in.size + 70000, srcSize);
+            while (!FL2_isError(r) && in.pos < in.size)
+                r = FL2_compressStream(cstream, &out, &in);
+        }
+        if (!FL2_isError(r)) do {
+            r = FL2_endStream(cstream, &out);
+        } while (!FL2_isError(r) && r);
+        FL2_CCtx_setParameter(cstream, FL2_p_mirroredDictionary, 0);
+        if (!FL2_isError(r))
+            r = FL2_decompress(decodedBuffer, srcSize, fBuf, out.pos);
+        free(fBuf);
+        if (r != srcSize || findDiff(decodedBuffer, CNBuffer, srcSize) < srcSize) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : compress stream with a sliding window : ", testNb++);
+    {   size_t const srcSize = 8 MB;
+        size_t const fBufSize = FL2_compressBound(srcSize) * 2;
+        BYTE* const fBuf = malloc(fBufSize);
+        FL2_outBuffer out = { fBuf, fBufSize, 0 };
+        FL2_inBuffer in = { CNBuffer, 0, 0 };
+        unsigned chunk = 0;
+        size_t r;
+        if (fBuf == NULL) goto _output_error;
+        r = FL2_CCtx_setParameter(cstream, FL2_p_compressionLevel, 6);
+        if (!FL2_isError(r))
+            r = FL2_CCtx_setParameter(cstream, FL2_p_dictionaryLog, 20);
+        if (!FL2_isError(r))
+            r = FL2_CCtx_setParameter(cstream, FL2_p_slidingWindow, 1);
+        if (!FL2_isError(r))
+            r = FL2_CCtx_setParameter(cstream, FL2_p_flushWindowLog, 16);
+        if (!FL2_isError(r))
+            r = FL2_initCStream(cstream, 0);
+        /* Occasional flushes compress partial blocks */
+        while (!FL2_isError(r) && in.size < srcSize) {
+            in.size = MIN(in.size + 70000, srcSize);
+            while (!FL2_isError(r) && in.pos < in.size)
+                r = FL2_compressStream(cstream, &out, &in);
+            if (++chunk % 16 == 0)
+                while (!FL2_isError(r) && (r = FL2_flushStream(cstream, &out)) != 0)
+                    ;
+        }
+        if (!FL2_isError(r)) do {
+            r = FL2_endStream(cstream, &out);
+        } while (!FL2_isError(r) && r);
+        FL2_CCtx_setParameter(cstream, FL2_p_slidingWindow, 0);
+        FL2_CCtx_setParameter(cstream, FL2_p_flushWindowLog, 0);
+        if (!FL2_isError(r))
+            r = FL2_decompress(decodedBuffer, srcSize, fBuf, out.pos);
+        free(fBuf);
+        if (r != srcSize || findDiff(decodedBuffer, CNBuffer, srcSize) < srcSize) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : pipelined MT stream decompression : ", testNb++);
+    {   size_t const srcSize = 8 MB;
+        size_t const fBufSize = FL2_compressBound(srcSize);
+        BYTE* const fBuf = malloc(fBufSize);
+        FL2_CCtx* const cctx = FL2_createCCtx();
+        FL2_DStream* const ds = FL2_createDStreamMt(4);
+        size_t cSize, r;
+        int mismatch = 0;
+        if (fBuf == NULL || cctx == NULL || ds == NULL) {
+            free(fBuf);
+            FL2_freeCCtx(cctx);
+            FL2_freeDStream(ds);
+            goto _output_error;
+        }
+        /* Many small blocks, each starting with a dict reset */
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 1);
+        FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, 20);
+        FL2_CCtx_setParameter(cctx, FL2_p_resetInterval, 1);
+        cSize = FL2_compressCCtx(cctx, fBuf, fBufSize, CNBuffer, srcSize, 0);
+        r = cSize;
+        /* The second pass has room for only a few blocks in flight */
+        for (unsigned pass = 0; pass < 2 && !FL2_isError(r) && !mismatch; ++pass) {
+            FL2_inBuffer in = { fBuf, 0, 0 };
+            FL2_outBuffer out = { decodedBuffer, 0, 0 };
+            FL2_setDStreamMemoryLimitMt(ds, pass ? 5 MB : 512 MB);
+            r = FL2_initDStream(ds);
+            /* Small pieces make the stream interleave loading, decoding and writing */
+            while (!FL2_isError(r) && (in.pos < cSize || r != 0)) {
+                in.size = MIN(in.pos + 10000, cSize);
+                out.size = MIN(out.pos + 30000, srcSize);
+                r = FL2_decompressStream(ds, &out, &in);
+            }
+            mismatch = out.pos != srcSize || findDiff(decodedBuffer, CNBuffer, srcSize) < srcSize;
+        }
+        free(fBuf);
+        FL2_freeCCtx(cctx);
+        FL2_freeDStream(ds);
+        if (FL2_isError(r) || mismatch) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : MT stream decompression from resident input : ", testNb++);
+    {   size_t const srcSize = 8 MB;
+        size_t const fBufSize = FL2_compressBound(srcSize);
+        BYTE* const fBuf = malloc(fBufSize);
+        FL2_CCtx* const cctx = FL2_createCCtx();
+        FL2_DStream* const ds = FL2_createDStreamMt(4);
+        /* Each piece of input is a separate allocation, freed once released */
+        BYTE* pieces[512] = { NULL };
+        size_t pieceEnd[512];
+        size_t nbPieces = 0, nbFreed = 0;
+        FL2_outBuffer out = { decodedBuffer, srcSize, 0 };
+        size_t cSize, r;
+        if (fBuf == NULL || cctx == NULL || ds == NULL) {
+            free(fBuf);
+            FL2_freeCCtx(cctx);
+            FL2_freeDStream(ds);
+            goto _output_error;
+        }
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 1);
+        FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, 20);
+        FL2_CCtx_setParameter(cctx, FL2_p_resetInterval, 1);
+        cSize = FL2_compressCCtx(cctx, fBuf, fBufSize, CNBuffer, srcSize, 0);
+        r = cSize;
+        if (!FL2_isError(r))
+            r = FL2_setDStreamResidentInput(ds, 1);
+        if (!FL2_isError(r))
+            r = FL2_initDStream(ds);
+        /* Small pieces are copied and large ones referenced */
+        while (!FL2_isError(r) && nbPieces < 512) {
+            size_t const start = nbPieces ? pieceEnd[nbPieces - 1] : 0;
+            size_t const size = MIN((nbPieces & 1) ? 30000 : 150000, cSize - start);
+            FL2_inBuffer in = { NULL, size, 0 };
+            pieces[nbPieces] = malloc(size + 1);
+            if (pieces[nbPieces] == NULL)
+                break;
+            memcpy(pieces[nbPieces], fBuf + start, size);
+            in.src = pieces[nbPieces];
+            do {
+                r = FL2_decompressStream(ds, &out, &in);
+            } while (!FL2_isError(r) && r != 0 && in.pos < in.size);
+            pieceEnd[nbPieces++] = start + in.pos;
+            while (nbFreed < nbPieces && pieceEnd[nbFreed] <= FL2_getDStreamInputReleased(ds)) {
+                memset(pieces[nbFreed], 0, pieceEnd[nbFreed] - (nbFreed ? pieceEnd[nbFreed - 1] : 0));
+                free(pieces[nbFreed]);
+                pieces[nbFreed++] = NULL;
+            }
+            if (r == 0)
+                break;
+        }
+        for (size_t u = nbFreed; u < nbPieces; ++u)
+            free(pieces[u]);
+        FL2_setDStreamResidentInput(ds, 0);
+        free(fBuf);
+        FL2_freeCCtx(cctx);
+        FL2_freeDStream(ds);
+        if (FL2_isError(r) || r != 0 || out.pos != srcSize || findDiff(decodedBuffer, CNBuffer, srcSize) < srcSize) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : MT stream decompression into resident output : ", testNb++);
+    {   size_t const srcSize = 8 MB;
+        size_t const ringSize = 3 MB + 12345;
+        size_t const fBufSize = FL2_compressBound(srcSize);
+        BYTE* const fBuf = malloc(fBufSize);
+        BYTE* const ring = malloc(ringSize);
+        FL2_CCtx* const cctx = FL2_createCCtx();
+        FL2_DStream* const ds = FL2_createDStreamMt(4);
+        /* Blocks that fit before the end of the ring are decoded in place */
+        FL2_outBuffer out = { ring, ringSize, 0 };
+        size_t cSize, r, total = 0, inPos = 0;
+        if (fBuf == NULL || ring == NULL || cctx == NULL || ds == NULL) {
+            free(fBuf);
+            free(ring);
+            FL2_freeCCtx(cctx);
+            FL2_freeDStream(ds);
+            goto _output_error;
+        }
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 1);
+        FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, 20);
+        FL2_CCtx_setParameter(cctx, FL2_p_resetInterval, 1);
+        cSize = FL2_compressCCtx(cctx, fBuf, fBufSize, CNBuffer, srcSize, 0);
+        r = cSize;
+        if (!FL2_isError(r))
+            r = FL2_setDStreamResidentOutput(ds, 1);
+        if (!FL2_isError(r))
+            r = FL2_initDStream(ds);
+        while (!FL2_isError(r) && total + out.pos < srcSize && inPos <= cSize) {
+            FL2_inBuffer in = { fBuf + inPos, MIN(100000, cSize - inPos), 0 };
+            r = FL2_decompressStream(ds, &out, &in);
+            inPos += in.pos;
+            if (out.pos == out.size || r == 0) {
+                memcpy((BYTE*)decodedBuffer + total, ring, out.pos);
+                total += out.pos;
+                out.pos = 0;
+            }
+            if (r == 0)
+                break;
+        }
+        FL2_setDStreamResidentOutput(ds, 0);
+        free(fBuf);
+        free(ring);
+        FL2_freeCCtx(cctx);
+        FL2_freeDStream(ds);
+        if (FL2_isError(r) || r != 0 || total != srcSize || findDiff(decodedBuffer, CNBuffer, srcSize) < srcSize) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : MT decompression with checkpoint index : ", testNb++);
+    {   size_t const srcSize = 8 MB;
+        size_t const fBufSize = FL2_compressBound(srcSize);
+        BYTE* const fBuf = malloc(fBufSize);
+        BYTE* index = NULL;
+        FL2_CCtx* const cctx = FL2_createCCtx();
+        FL2_DCtx* const dctx = FL2_createDCtxMt(4);
+        size_t r, indexSize = 0;
+        if (fBuf == NULL || cctx == NULL || dctx == NULL) {
+            free(fBuf);
+            FL2_freeCCtx(cctx);
+            FL2_freeDCtx(dctx);
+            goto _output_error;
+        }
+        /* A single dictionary block split at checkpoints */
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 1);
+        FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, 23);
+        FL2_CCtx_setParameter(cctx, FL2_p_resetInterval, 0);
+        FL2_CCtx_setParameter(cctx, FL2_p_checkpointLog, 18);
+        FL2_CCtx_setParameter(cctx, FL2_p_checkpointLookback, 4096);
+        r = FL2_compressCCtx(cctx, fBuf, fBufSize, CNBuffer, srcSize, 0);
+        if (!FL2_isError(r)) {
+            size_t const cSize = r;
+            indexSize = FL2_getCCtxCheckpointIndex(cctx, NULL, 0);
+            index = malloc(indexSize + 1);
+            if (index != NULL)
+                r = FL2_getCCtxCheckpointIndex(cctx, index, indexSize);
+            if (index != NULL && !FL2_isError(r))
+                r = FL2_decompressDCtxIndexed(dctx, decodedBuffer, srcSize, fBuf, cSize, index, indexSize);
+        }
+        free(index);
+        free(fBuf);
+        FL2_freeCCtx(cctx);
+        FL2_freeDCtx(dctx);
+        if (FL2_isError(r) || r != srcSize || indexSize <= 4 || findDiff(decodedBuffer, CNBuffer, srcSize) < srcSize) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : MT decompression with frame index : ", testNb++);
+    {   size_t const srcSize = 8 MB;
+        size_t const fBufSize = FL2_compressBound(srcSize);
+        BYTE* const fBuf = malloc(fBufSize);
+        BYTE* index = NULL;
+        FL2_CCtx* const cctx = FL2_createCCtx();
+        FL2_DCtx* const dctx = FL2_createDCtxMt(4);
+        size_t r, indexSize = 0, nbBlocks = 0;
+        if (fBuf == NULL || cctx == NULL || dctx == NULL) {
+            free(fBuf);
+            FL2_freeCCtx(cctx);
+            FL2_freeDCtx(dctx);
+            goto _output_error;
+        }
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 1);
+        FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, 20);
+        FL2_CCtx_setParameter(cctx, FL2_p_resetInterval, 1);
+        r = FL2_compressCCtx(cctx, fBuf, fBufSize, CNBuffer, srcSize, 0);
+        if (!FL2_isError(r)) {
+            size_t const cSize = r;
+            indexSize = FL2_getCCtxFrameIndex(cctx, NULL, 0);
+            index = malloc(indexSize + 1);
+            if (index != NULL)
+                r = FL2_getCCtxFrameIndex(cctx, index, indexSize);
+            if (index != NULL && !FL2_isError(r)) {
+                nbBlocks = FL2_getIndexBlocks(index, indexSize, NULL, 0);
+                if (FL2_findDecompressedSizeIndexed(index, indexSize) != srcSize)
+                    r = 0;
+                else
+                    r = FL2_decompressDCtxIndexed(dctx, decodedBuffer, srcSize, fBuf, cSize, index, indexSize);
+            }
+            if (!FL2_isError(r) && r == srcSize) {
+                /* Seek to a position in the third block */
+                size_t const offset = 2 MB + 12345;
+                r = FL2_decompressRangeIndexed(dctx, (BYTE*)decodedBuffer + offset, 100000, fBuf, cSize, offset, index, indexSize);
+                r = (r == 100000) ? srcSize : 0;
+            }
+            /* A failed call leaves no index and the parameters unlocked */
+            if (!FL2_isError(r) && r == srcSize) {
+                size_t const e = FL2_compressCCtx(cctx, fBuf, fBufSize / 100, CNBuffer, srcSize, 0);
+                if (!FL2_isError(e) || FL2_getCCtxFrameIndex(cctx, NULL, 0) != 0
+                        || FL2_isError(FL2_CCtx_setParameter(cctx, FL2_p_resetInterval, 1)))
+                    r = 0;
+            }
+        }
+        free(index);
+        free(fBuf);
+        FL2_freeCCtx(cctx);
+        FL2_freeDCtx(dctx);
+        if (FL2_isError(r) || r != srcSize || nbBlocks < 2 || FL2_isError(nbBlocks) || findDiff(decodedBuffer, CNBuffer, srcSize) < srcSize) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : seekable container random access : ", testNb++);
+    {   size_t const srcSize = 8 MB;
+        size_t const frameSize = 1 MB + 4321;
+        size_t const fBufSize = FL2_seekableBound(srcSize, frameSize);
+        BYTE* const fBuf = malloc(fBufSize);
+        FL2_CCtx* const cctx = FL2_createCCtx();
+        FL2_seekable* const fs = FL2_createSeekable(2, 2);
+        size_t r;
+        int bad = 0;
+        if (fBuf == NULL || cctx == NULL || fs == NULL) {
+            free(fBuf);
+            FL2_freeCCtx(cctx);
+            FL2_freeSeekable(fs);
+            goto _output_error;
+        }
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 1);
+        r = FL2_compressSeekable(cctx, fBuf, fBufSize, CNBuffer, srcSize, frameSize);
+        /* Plain stream readers must reject the container, not return the first frame */
+        if (!FL2_isError(r))
+            bad = FL2_findDecompressedSize(fBuf, r) != FL2_CONTENTSIZE_ERROR
+                || !FL2_isError(FL2_decompress(decodedBuffer, srcSize, fBuf, r));
+        if (!FL2_isError(r))
+            r = FL2_initSeekable(fs, fBuf, r);
+        if (!FL2_isError(r) && FL2_getSeekableContentSize(fs) != srcSize)
+            bad = 1;
+        memset(decodedBuffer, 0, srcSize);
+        /* Ranges within a frame, across frame boundaries, repeated from the cache and past the end */
+        {   static const size_t ranges[][2] = {
+                { 3 MB + 100, 5000 }, { 1 MB, 9000 }, { 3 MB + 50, 200 },
+                { 5 MB - 100, 2 MB }, { 0, 1 MB + 10000 }, { 8 MB - 1000, 5000 } };
+            for (size_t u = 0; u < sizeof(ranges) / sizeof(ranges[0]) && !FL2_isError(r) && !bad; ++u) {
+                size_t const expected = MIN(ranges[u][1], srcSize - ranges[u][0]);
+                r = FL2_readSeekable(fs, (BYTE*)decodedBuffer + ranges[u][0], ranges[u][1], ranges[u][0]);
+                if (!FL2_isError(r) && (r != expected
+                        || memcmp((BYTE*)decodedBuffer + ranges[u][0], (BYTE*)CNBuffer + ranges[u][0], r) != 0))
+                    bad = 1;
+            }
+        }
+        if (!FL2_isError(r))
+            r = FL2_readSeekable(fs, decodedBuffer, srcSize, 0);
+        free(fBuf);
+        FL2_freeCCtx(cctx);
+        FL2_freeSeekable(fs);
+        if (bad || FL2_isError(r) || r != srcSize || findDiff(decodedBuffer, CNBuffer, srcSize) < srcSize) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : MT stream decompression under memory pressure : ", testNb++);
+    {   size_t const srcSize = 8 MB;
+        size_t const fBufSize = FL2_compressBound(srcSize);
+        BYTE* const fBuf = malloc(fBufSize);
+        FL2_CCtx* const cctx = FL2_createCCtx();
+        FL2_DStream* const ds = FL2_createDStreamMt(4);
+        FL2_DStreamMemory usage;
+        FL2_inBuffer in = { NULL, 0, 0 };
+        FL2_outBuffer out = { decodedBuffer, 0, 0 };
+        unsigned minJobs = ~0U;
+        size_t cSize, r;
+        int bad = 0;
+        if (fBuf == NULL || cctx == NULL || ds == NULL) {
+            free(fBuf);
+            FL2_freeCCtx(cctx);
+            FL2_freeDStream(ds);
+            goto _output_error;
+        }
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 1);
+        FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, 20);
+        FL2_CCtx_setParameter(cctx, FL2_p_resetInterval, 1);
+        cSize = FL2_compressCCtx(cctx, fBuf, fBufSize, CNBuffer, srcSize, 0);
+        in.src = fBuf;
+        /* Room for the input and about two 1 MB blocks */
+        FL2_setDStreamMemoryLimitMt(ds, 3 MB);
+        r = FL2_isError(cSize) ? cSize : FL2_initDStream(ds);
+        while (!FL2_isError(r) && !bad && (in.pos < cSize || r != 0)) {
+            in.size = MIN(in.pos + 500000, cSize);
+            out.size = MIN(out.pos + 200000, srcSize);
+            r = FL2_decompressStream(ds, &out, &in);
+            FL2_getDStreamMemoryUsage(ds, &usage);
+            if (out.pos < srcSize / 2) {
+                minJobs = MIN(minJobs, usage.jobLimit);
+                bad = usage.memoryUsed > usage.memoryLimit;
+            }
+            /* Releasing the budget mid-stream restores full concurrency */
+            else if (usage.memoryLimit != 512 MB) {
+                FL2_setDStreamMemoryLimitMt(ds, 512 MB);
+                FL2_getDStreamMemoryUsage(ds, &usage);
+                bad = usage.jobLimit != usage.maxJobs;
+            }
+        }
+        FL2_getDStreamMemoryUsage(ds, &usage);
+        bad |= usage.singleThread || usage.nbThreads != 4 || minJobs >= usage.maxJobs || usage.activeJobs != 0;
+        free(fBuf);
+        FL2_freeCCtx(cctx);
+        FL2_freeDStream(ds);
+        if (bad || FL2_isError(r) || out.pos != srcSize || findDiff(decodedBuffer, CNBuffer, srcSize) < srcSize) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : MT stream output buffer reuse : ", testNb++);
+    {   size_t const srcSize = 8 MB;
+        size_t const fBufSize = FL2_compressBound(srcSize);
+        BYTE* const fBuf = malloc(fBufSize * 2);
+        FL2_CCtx* const cctx = FL2_createCCtx();
+        FL2_DStream* const ds = FL2_createDStreamMt(2);
+        FL2_DStreamMemory usage;
+        size_t cSize[2] = { 0, 0 };
+        size_t used = 0, r = 0;
+        int bad = 0;
+        if (fBuf == NULL || cctx == NULL || ds == NULL) {
+            free(fBuf);
+            FL2_freeCCtx(cctx);
+            FL2_freeDStream(ds);
+            goto _output_error;
+        }
+        /* Stream 0 has 2 MB blocks, enough to fill every job slot, and stream 1 has 1 MB blocks */
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 1);
+        FL2_CCtx_setParameter(cctx, FL2_p_resetInterval, 1);
+        for (int u = 0; u < 2 && !bad; ++u) {
+            FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, 21 - u);
+            cSize[u] = FL2_compressCCtx(cctx, fBuf + fBufSize * u, fBufSize, CNBuffer, srcSize, 0);
+            bad = FL2_isError(cSize[u]);
+        }
+        /* Decode stream 0 twice, then stream 1, then stream 0 again after trimming */
+        for (int pass = 0; pass < 4 && !bad; ++pass) {
+            int const u = (pass == 2);
+            FL2_inBuffer in = { fBuf + fBufSize * u, cSize[u], 0 };
+            FL2_outBuffer out = { decodedBuffer, srcSize, 0 };
+            r = FL2_initDStream(ds);
+            while (!FL2_isError(r) && (in.pos < in.size || r != 0) && out.pos < out.size)
+                r = FL2_decompressStream(ds, &out, &in);
+            FL2_getDStreamMemoryUsage(ds, &usage);
+            bad = FL2_isError(r) || r != 0 || out.pos != srcSize || findDiff(decodedBuffer, CNBuffer, srcSize) < srcSize
+                || usage.singleThread || usage.activeJobs != 0;
+            if (pass == 0) {
+                used = usage.memoryUsed;
+                bad |= used == 0;
+            }
+            /* The buffers kept from stream 0 serve the next streams. Those for stream 1 are
+             * not reallocated at the size class of its smaller blocks. */
+            else if (pass < 3) {
+                bad |= usage.memoryUsed != used;
+            }
+            if (pass == 2) {
+                /* Lowering the limit frees idle buffers */
+                FL2_setDStreamMemoryLimitMt(ds, used / 2);
+                FL2_getDStreamMemoryUsage(ds, &usage);
+                bad |= usage.memoryUsed > used / 2;
+                FL2_setDStreamMemoryLimitMt(ds, 0);
+                FL2_getDStreamMemoryUsage(ds, &usage);
+                bad |= usage.memoryUsed != 0;
+                FL2_setDStreamMemoryLimitMt(ds, 512 MB);
+            }
+        }
+        free(fBuf);
+        FL2_freeCCtx(cctx);
+        FL2_freeDStream(ds);
+        if (bad) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : contexts sharing a thread pool : ", testNb++);
+    {   size_t const srcSize = 8 MB;
+        size_t const fBufSize = FL2_compressBound(srcSize);
+        BYTE* const fBuf = malloc(fBufSize);
+        FL2_threadPool* const pool = FL2_createThreadPool(2);
+        FL2_CCtx* const cctx = FL2_createCCtxMt(4);
+        FL2_DCtx* const dctx = FL2_createDCtxMt(4);
+        FL2_DStream* const ds = FL2_createDStreamMt(4);
+        size_t cSize, r;
+        int bad = 0;
+        if (fBuf == NULL || pool == NULL || cctx == NULL || dctx == NULL || ds == NULL) {
+            free(fBuf);
+            FL2_freeThreadPool(pool);
+            FL2_freeCCtx(cctx);
+            FL2_freeDCtx(dctx);
+            FL2_freeDStream(ds);
+            goto _output_error;
+        }
+        bad = FL2_isError(FL2_setCCtxThreadPool(cctx, pool, 0))
+            || FL2_isError(FL2_setDCtxThreadPool(dctx, pool, 1))
+            || FL2_isError(FL2_setDStreamThreadPool(ds, pool, 2));
+        /* Attached contexts keep the threads alive */
+        FL2_freeThreadPool(pool);
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 1);
+        FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, 20);
+        FL2_CCtx_setParameter(cctx, FL2_p_resetInterval, 1);
+        cSize = FL2_compressCCtx(cctx, fBuf, fBufSize, CNBuffer, srcSize, 0);
+        r = cSize;
+        if (!FL2_isError(r))
+            r = FL2_decompressDCtx(dctx, decodedBuffer, srcSize, fBuf, cSize);
+        bad |= !FL2_isError(r) && (r != srcSize || findDiff(decodedBuffer, CNBuffer, srcSize) < srcSize);
+        if (!FL2_isError(r) && !bad) {
+            FL2_inBuffer in = { fBuf, cSize, 0 };
+            FL2_outBuffer out = { decodedBuffer, srcSize, 0 };
+            memset(decodedBuffer, 0, srcSize);
+            r = FL2_initDStream(ds);
+            while (!FL2_isError(r) && (in.pos < cSize || r != 0))
+                r = FL2_decompressStream(ds, &out, &in);
+            bad = out.pos != srcSize || findDiff(decodedBuffer, CNBuffer, srcSize) < srcSize;
+        }
+        /* Detach to private threads */
+        if (!FL2_isError(r) && !bad && !FL2_isError(FL2_setDCtxThreadPool(dctx, NULL, 0))) {
+            memset(decodedBuffer, 0, srcSize);
+            r = FL2_decompressDCtx(dctx, decodedBuffer, srcSize, fBuf, cSize);
+            bad = !FL2_isError(r) && (r != srcSize || findDiff(decodedBuffer, CNBuffer, srcSize) < srcSize);
+        }
+        free(fBuf);
+        FL2_freeCCtx(cctx);
+        FL2_freeDCtx(dctx);
+        FL2_freeDStream(ds);
+        if (bad || FL2_isError(r)) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+    DISPLAYLEVEL(4, "test%3i : MT stream decompression with a timeout : ", testNb++);
+    {   size_t const srcSize = 12 MB;
+        size_t const fBufSize = FL2_compressBound(srcSize);
+        BYTE* const fBuf = malloc(fBufSize);
+        FL2_CCtx* const cctx = FL2_createCCtx();
+        FL2_DStream* const ds = FL2_createDStreamMt(4);
+        FL2_inBuffer in = { NULL, 0, 0 };
+        FL2_outBuffer out = { decodedBuffer, 0, 0 };
+        size_t cSize, r;
+        if (fBuf == NULL || cctx == NULL || ds == NULL) {
+            free(fBuf);
+            FL2_freeCCtx(cctx);
+            FL2_freeDStream(ds);
+            goto _output_error;
+        }
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 1);
+        FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, 20);
+        FL2_CCtx_setParameter(cctx, FL2_p_resetInterval, 1);
+        cSize = FL2_compressCCtx(cctx, fBuf, fBufSize, CNBuffer, srcSize, 0);
+        in.src = fBuf;
+        /* A short timeout can expire before the async job starts */
+        r = FL2_isError(cSize) ? cSize : FL2_setDStreamTimeout(ds, 1);
+        if (!FL2_isError(r))
+            r = FL2_initDStream(ds);
+        while (!FL2_isError(r) && (in.pos < cSize || r != 0)) {
+            in.size = MIN(in.pos + 300000, cSize);
+            out.size = MIN(out.pos + 500000, srcSize);
+            r = FL2_decompressStream(ds, &out, &in);
+            while (FL2_isTimedOut(r))
+                r = FL2_waitDStream(ds);
+        }
+        free(fBuf);
+        FL2_freeCCtx(cctx);
+        FL2_freeDStream(ds);
+        if (FL2_isError(r) || out.pos != srcSize || findDiff(decodedBuffer, CNBuffer, srcSize) < srcSize) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
+#ifndef FL2_SINGLETHREAD
+    DISPLAYLEVEL(4, "test%3i : small appended jobs on a shared pool : ", testNb++);
+    {   enum { nbQueues = 4, nbJobs = 50000 };
+        FL2POOL_shared* const pool = FL2POOL_createShared(3);
+        FL2POOL_ctx* queues[nbQueues] = { NULL };
+        BYTE* const runs = calloc(nbQueues, nbJobs);
+        int bad = pool == NULL || runs == NULL;
+        size_t queueSize = 0;
+        for (size_t q = 0; q < nbQueues && !bad; ++q)
+            bad = (queues[q] = FL2POOL_attach(pool, 1 + q % 3)) == NULL;
+        /* Shared threads are not counted against any one queue */
+        if (!bad)
+            queueSize = FL2POOL_sizeof(queues[0]);
+        for (size_t q = 1; q < nbQueues && !bad; ++q)
+            bad = FL2POOL_sizeof(queues[q]) != queueSize;
+        /* Attached queues keep the threads alive */
+        FL2POOL_releaseShared(pool);
+        for (ptrdiff_t n = 0; n < nbJobs && !bad; ++n) {
+            for (size_t q = 0; q < nbQueues; ++q)
+                FL2POOL_append(queues[q], FUZ_poolJob, runs + q * nbJobs, n);
+            /* Wait for one queue now and then while the others keep running */
+            if (n % 1000 == 999)
+                FL2POOL_waitAll(queues[(n / 1000) % nbQueues], 0);
+        }
+        for (size_t q = 0; q < nbQueues; ++q) {
+            FL2POOL_waitAll(queues[q], 0);
+            bad |= FL2POOL_threadsBusy(queues[q]) != 0;
+        }
+        for (size_t u = 0; u < (size_t)nbQueues * nbJobs && !bad; ++u)
+            bad = runs[u] != 1;
+        for (size_t q = 0; q + 1 < nbQueues; ++q)
+            FL2POOL_free(queues[q]);
+        /* The last queue owns the threads */
+        if (!bad && queues[nbQueues - 1] != NULL) {
+            FL2POOL_ctx* const alone = FL2POOL_create(3);
+            bad = alone == NULL || FL2POOL_sizeof(queues[nbQueues - 1]) != FL2POOL_sizeof(alone)
+                || FL2POOL_sizeof(alone) <= queueSize;
+            FL2POOL_free(alone);
+        }
+        FL2POOL_free(queues[nbQueues - 1]);
+        free(runs);
+        if (bad) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+#endif
+
+    DISPLAYLEVEL(4, "test%3i : decompress stream into resident ring buffer : ", testNb++);
+    {   FL2_DStream *const ds = FL2_createDStream();
+        size_t const ringSize = FL2_getDictSizeFromProp(*(BYTE*)compressedBuffer & 0x3F);
+        FL2_inBuffer in = { compressedBuffer, 0, 0 };
+        FL2_outBuffer out = { decodedBuffer, ringSize, 0 };
+        BYTE *iend = (BYTE*)compressedBuffer + cSize;
+        size_t total = 0;
+        size_t r;
+        if (ds == NULL || ringSize > CNBuffSize) goto _output_error;
+        CHECK(FL2_setDStreamResidentOutput(ds, 1));
+        CHECK(FL2_initDStream(ds));
+        do {
+            size_t const prev = out.pos;
+            if (in.pos == in.size) {
+                in.src = (BYTE*)in.src + in.pos;
+                in.size = MIN(0x8101, iend - (BYTE*)in.src);
+                in.pos = 0;
+            }
+            r = FL2_decompressStream(ds, &out, &in);
+            if (FL2_isError(r)) {
+                FL2_freeDStream(ds);
+                goto _output_error;
+            }
+            if (findDiff((BYTE*)CNBuffer + total, (BYTE*)out.dst + prev, out.pos - prev) < out.pos - prev) {
+                FL2_freeDStream(ds);
+                goto _output_error;
+            }
+            total += out.pos - prev;
+            if (out.pos == out.size)
+                out.pos = 0;
+        } while (r);
+        FL2_freeDStream(ds);
+        if (total != CNBuffSize) goto _output_error;
+    }
+    DISPLAYLEVEL(4, "OK \n");
+
     DISPLAYLEVEL(4, "test%3i : decompress stream with progress : ", testNb++);
     {   FL2_inBuffer in = { compressedBuffer, cSize, 0 };
         FL2_outBuffer out = { decodedBuffer, CNBuffSize, 0 };
@@ -12,15 +12,32 @@ extern "C" {
 #endif
 
 /* #define LZMA_DEC_PROB16 */
-/* 32-bit probs can increase the speed on some CPUs,
-   but memory usage for LZMA2_DCtx::probs will be doubled in that case */
+/* Both 16-bit and 32-bit probability decoders are built. 32-bit probs can increase
+   the speed on some CPUs, but the probs table is twice as large, which increases
+   cache pressure when lc + lp is large or many decoders run concurrently.
+   32-bit probs are the default. Automatic selection is opt-in because 16-bit probs have
+   not been measured faster: decoding an lc4 stream on one core was 2-12% slower.
+   LZMA_DEC_PROB16 makes 16-bit probs the default. */
+
+#define LZMA_PROB_BITS_AUTO 0
 
 #ifdef LZMA_DEC_PROB16
-typedef U16 LZMA2_prob;
+#  define LZMA_PROB_BITS_DEFAULT 16
 #else
-typedef U32 LZMA2_prob;
+#  define LZMA_PROB_BITS_DEFAULT 32
 #endif
 
+/* Automatic selection uses 16-bit probs if the 32-bit table would exceed this size,
+   which is a typical L1 data cache size. Only lc + lp == 4 exceeds it. */
+#define LZMA_PROB16_AUTO_TABLE_SIZE (1U << 15)
+
+#define kNumTopBits 24
+#define kTopValue ((U32)1 << kNumTopBits)
+
+#define kNumBitModelTotalBits 11
+#define kBitModelTotal (1 << kNumBitModelTotalBits)
+#define kNumMoveBits 5
+
 
 /* ---------- LZMA Properties ---------- */
 
@@ -137,7 +154,7 @@ typedef struct
 	size_t dic_pos;
 	size_t dic_buf_size;
 	const BYTE *buf;
-	LZMA2_prob *probs_1664;
+	void *probs_1664; /* U16 or U32 depending on prob16 */
 	U32 range;
 	U32 code;
     U32 processed_pos;
@@ -155,12 +172,22 @@ typedef struct
     BYTE need_init_prop;
 	BYTE need_flush;
 	BYTE ext_dic;
-	BYTE pad_;
-    LZMA2_prob probs[NUM_BASE_PROBS + ((U32)kLzmaLitSize << kLzma2LcLpMax)];
+	BYTE prob16;
+	BYTE prob_bits;
+    U32 probs[NUM_BASE_PROBS + ((U32)kLzmaLitSize << kLzma2LcLpMax)];
 } LZMA2_DCtx;
 
 void LZMA_constructDCtx(LZMA2_DCtx *p);
 
+/* Select 16-bit or 32-bit probs, or LZMA_PROB_BITS_AUTO. Takes effect at the next state reset. */
+void LZMA2_setProbBits(LZMA2_DCtx *const p, unsigned const bits);
+
+/* Decoder loops for 32-bit and 16-bit probs (lzma_dec_p32.c, lzma_dec_p16.c, or asm) */
+int LZMA_decodeReal_3(LZMA2_DCtx *p, size_t limit, const BYTE *buf_limit);
+int LZMA_decodeReal16_3(LZMA2_DCtx *p, size_t limit, const BYTE *buf_limit);
+BYTE LZMA_tryDummy(const LZMA2_DCtx *const p);
+BYTE LZMA_tryDummy16(const LZMA2_DCtx *const p);
+
 typedef enum
 {
   LZMA_FINISH_ANY,   /* finish at any point */
@@ -188,6 +215,8 @@ size_t LZMA2_decMemoryUsage(size_t const dict_size);
 
 size_t LZMA2_initDecoder(LZMA2_DCtx *const p, BYTE const dict_prop, BYTE *const dic, size_t dic_buf_size);
 
+size_t LZMA2_initDecoderAt(LZMA2_DCtx *const p, BYTE const dict_prop, BYTE *const dic, size_t const lookback, size_t const size);
+
 size_t LZMA2_decodeToDic(LZMA2_DCtx *const p, size_t const dic_limit,
     const BYTE *const src, size_t *const src_len, LZMA2_finishMode const finish_mode);
 
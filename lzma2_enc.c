@@ -105,6 +105,10 @@ Public domain
 #define kHash3Bits 14U
 #define kNullLink -1
 
+#define kHistoryHashBitsMin 14U
+#define kHistoryHashBitsMax 22U
+#define kHistoryMatchMin 6U
+
 #define kMinTestChunkSize 0x4000U
 #define kRandomFilterMarginBits 8U
 
@@ -191,6 +195,21 @@ typedef struct {
     S32 hash_chain_3[1];
 } LZMA2_hc3;
 
+/*
+ * Hash table of the data preceding a stream block, which the radix match finder does not see.
+ * Entries are stream positions since the last dictionary reset, truncated to 32 bits. The table
+ * is one-way, so each entry is the most recent position with that hash. Extra elements in
+ * table are malloced.
+ */
+struct LZMA2_history_s
+{
+    size_t block_pos; /* stream position of block.data[0] */
+    size_t avail;     /* bytes preceding block.data that are valid for matches */
+    size_t max_dist;
+    unsigned hash_bits;
+    U32 table[1];
+};
+
 /*
  * LZMA2 encoder.
  */
@@ -234,6 +253,12 @@ struct LZMA2_ECtx_s
     ptrdiff_t hash_prev_index;
     ptrdiff_t hash_alloc_3;
 
+    const LZMA2_history* history; /* NULL unless matches can precede the block */
+
+    LZMA2_checkpoint* checkpoints;
+    size_t checkpoint_count;
+    size_t checkpoint_alloc;
+
     /* Temp output buffer before space frees up in the match table */
     BYTE out_buf[kTempBufferSize];
 };
@@ -261,6 +286,10 @@ LZMA2_ECtx* LZMA2_createECtx(void)
     enc->hash_dict_3 = 0;
     enc->chain_mask_3 = 0;
     enc->hash_alloc_3 = 0;
+    enc->history = NULL;
+    enc->checkpoints = NULL;
+    enc->checkpoint_count = 0;
+    enc->checkpoint_alloc = 0;
     return enc;
 }
 
@@ -269,6 +298,7 @@ void LZMA2_freeECtx(LZMA2_ECtx *const enc)
     if (enc == NULL)
         return;
     free(enc->hash_buf);
+    free(enc->checkpoints);
     free(enc);
 }
 
@@ -575,6 +605,110 @@ void LZMA_encodeNormalMatch(LZMA2_ECtx *const enc, unsigned const len, U32 const
     ++enc->match_price_count;
 }
 
+static unsigned LZMA2_historyHashBits(size_t const window_size)
+{
+    unsigned const bits = (window_size > 1) ? ZSTD_highbit32((U32)MIN(window_size - 1, (size_t)1 << 31)) - 2 : 0;
+    return MAX(kHistoryHashBitsMin, MIN(bits, kHistoryHashBitsMax));
+}
+
+LZMA2_history* LZMA2_createHistory(size_t const window_size)
+{
+    unsigned const hash_bits = LZMA2_historyHashBits(window_size);
+    LZMA2_history* const hist = malloc(sizeof(LZMA2_history) + (((size_t)1 << hash_bits) - 1) * sizeof(U32));
+
+    DEBUGLOG(3, "LZMA2_createHistory : hash bits %u", hash_bits);
+
+    if (hist == NULL)
+        return NULL;
+
+    hist->hash_bits = hash_bits;
+    hist->block_pos = 0;
+    hist->avail = 0;
+    hist->max_dist = 0;
+    LZMA2_historyReset(hist);
+
+    return hist;
+}
+
+void LZMA2_freeHistory(LZMA2_history* const hist)
+{
+    free(hist);
+}
+
+int LZMA2_historyCompatible(const LZMA2_history* const hist, size_t const window_size)
+{
+    return hist->hash_bits == LZMA2_historyHashBits(window_size);
+}
+
+size_t LZMA2_historyMemoryUsage(size_t const window_size)
+{
+    return sizeof(LZMA2_history) + (((size_t)1 << LZMA2_historyHashBits(window_size)) - 1) * sizeof(U32);
+}
+
+/* Empty the table after a dictionary reset. A zeroed entry can only point to position 0,
+ * and every candidate is verified, so no null value is needed. */
+void LZMA2_historyReset(LZMA2_history* const hist)
+{
+    memset(hist->table, 0, sizeof(U32) << hist->hash_bits);
+}
+
+#define GET_HASH_HISTORY(data, bits) (size_t)(((MEM_readLE64(data) << 16) * 227718039650203ULL) >> (64 - (bits)))
+
+/* Add data[start, end) to the table. data_pos is the stream position of data[0].
+ * Up to 7 bytes after end are read. */
+void LZMA2_historyInsert(LZMA2_history* const hist, const BYTE* const data, size_t const data_pos, size_t const start, size_t const end)
+{
+    unsigned const bits = hist->hash_bits;
+    for (size_t pos = start; pos < end; ++pos)
+        hist->table[GET_HASH_HISTORY(data + pos, bits)] = (U32)(data_pos + pos);
+}
+
+/* Set the block for which matches are found. avail bytes before block.data must be readable.
+ * Distances are limited to max_dist. */
+void LZMA2_historySetBlock(LZMA2_history* const hist, size_t const block_pos, size_t const avail, size_t const max_dist)
+{
+    hist->block_pos = block_pos;
+    hist->avail = avail;
+    hist->max_dist = max_dist;
+}
+
+/* Replace match with a longer one preceding the block, if the history table has one */
+HINT_INLINE
+void LZMA_historyGetMatch(const LZMA2_history* const hist, FL2_dataBlock const block, size_t const pos, RMF_match* const match)
+{
+    const BYTE* const data = block.data + pos;
+    U32 const entry = hist->table[GET_HASH_HISTORY(data, hist->hash_bits)];
+    size_t const dist = (U32)((U32)(hist->block_pos + pos) - entry);
+
+    /* Matches inside the block are found by the RMF */
+    if (dist <= pos || dist > pos + hist->avail || dist > hist->max_dist)
+        return;
+
+    size_t const max_len = MIN(kMatchLenMax, block.end - pos);
+    size_t const length = ZSTD_count(data, data - dist, data + max_len);
+
+    if (length >= kHistoryMatchMin && length > match->length) {
+        DEBUGLOG(7, "History match at %u : length %u, dist %u", (U32)pos, (U32)length, (U32)dist);
+        match->length = (U32)length;
+        match->dist = (U32)(dist - 1);
+    }
+}
+
+/* Get the RMF match at pos. If it is short and history precedes the block, check the history
+ * for a longer one. */
+FORCE_INLINE_TEMPLATE
+RMF_match LZMA_getMatch(LZMA2_ECtx *const enc, FL2_dataBlock const block,
+    FL2_matchTable* const tbl,
+    unsigned const search_depth,
+    int const struct_tbl,
+    size_t const pos)
+{
+    RMF_match match = RMF_getMatch(block, tbl, search_depth, struct_tbl, pos);
+    if (enc->history != NULL && match.length < enc->fast_length)
+        LZMA_historyGetMatch(enc->history, block, pos, &match);
+    return match;
+}
+
 FORCE_INLINE_TEMPLATE
 size_t LZMA_encodeChunkFast(LZMA2_ECtx *const enc,
     FL2_dataBlock const block,
@@ -593,7 +727,7 @@ size_t LZMA_encodeChunkFast(LZMA2_ECtx *const enc,
         /* Table of distance restrictions for short matches */
         static const U32 max_dist_table[] = { 0, 0, 0, 1 << 6, 1 << 14 };
         /* Get a match from the table, extended to its full length */
-        RMF_match best_match = RMF_getMatch(block, tbl, search_depth, struct_tbl, pos);
+        RMF_match best_match = LZMA_getMatch(enc, block, tbl, search_depth, struct_tbl, pos);
         if (best_match.length < kMatchLenMin) {
             ++pos;
             continue;
@@ -1505,7 +1639,7 @@ size_t LZMA_encodeOptimumSequence(LZMA2_ECtx *const enc, FL2_dataBlock const blo
                     }
                 }
 
-                match = RMF_getMatch(block, tbl, search_depth, struct_tbl, pos);
+                match = LZMA_getMatch(enc, block, tbl, search_depth, struct_tbl, pos);
                 if (match.length >= enc->fast_length)
                     break;
 
@@ -1663,7 +1797,7 @@ size_t LZMA_encodeChunkBest(LZMA2_ECtx *const enc,
 
     while (pos < uncompressed_end && enc->rc.out_index < enc->chunk_size)
     {
-        RMF_match const match = RMF_getMatch(block, tbl, search_depth, struct_tbl, pos);
+        RMF_match const match = LZMA_getMatch(enc, block, tbl, search_depth, struct_tbl, pos);
         if (match.length > 1) {
             /* Template-like inline function */
             if (enc->strategy == FL2_ultra) {
@@ -1934,6 +2068,29 @@ static size_t LZMA2_encodeChunk(LZMA2_ECtx *const enc,
     }
 }
 
+static int LZMA2_addCheckpoint(LZMA2_ECtx *const enc, size_t const pos, size_t const lookback, size_t const out_pos)
+{
+    if (enc->checkpoint_count == enc->checkpoint_alloc) {
+        size_t const alloc = enc->checkpoint_alloc ? enc->checkpoint_alloc * 2 : 16;
+        LZMA2_checkpoint* const checkpoints = realloc(enc->checkpoints, alloc * sizeof(LZMA2_checkpoint));
+        if (checkpoints == NULL)
+            return 1;
+        enc->checkpoints = checkpoints;
+        enc->checkpoint_alloc = alloc;
+    }
+    enc->checkpoints[enc->checkpoint_count].pos = pos;
+    enc->checkpoints[enc->checkpoint_count].lookback = lookback;
+    enc->checkpoints[enc->checkpoint_count].out_pos = out_pos;
+    ++enc->checkpoint_count;
+    return 0;
+}
+
+size_t LZMA2_getCheckpoints(const LZMA2_ECtx* const enc, const LZMA2_checkpoint** const checkpoints)
+{
+    *checkpoints = enc->checkpoints;
+    return enc->checkpoint_count;
+}
+
 size_t LZMA2_encode(LZMA2_ECtx *const enc,
     FL2_matchTable* const tbl,
     FL2_dataBlock const block,
@@ -1941,15 +2098,24 @@ size_t LZMA2_encode(LZMA2_ECtx *const enc,
     int stream_prop,
     FL2_atomic *const progress_in,
     FL2_atomic *const progress_out,
-    int *const canceled)
+    int *const canceled,
+    BYTE *const out_buffer,
+    size_t const out_capacity,
+    const LZMA2_history* const history)
 {
     size_t const start = block.start;
+    BYTE* const out_base = (out_buffer != NULL) ? out_buffer : RMF_getTableAsOutputBuffer(tbl, start);
 
-    /* Output starts in the temp buffer */
+    /* Output to the match table starts in the temp buffer */
     BYTE* out_dest = enc->out_buf;
     enc->chunk_size = kTempMinOutput;
     enc->chunk_limit = kTempBufferSize - kMaxMatchEncodeSize * 2;
 
+    if (out_buffer != NULL) {
+        /* An external buffer is never read, so it can be used from the start */
+        out_dest = out_buffer;
+    }
+
     /* Each encoder writes a properties byte because the upstream encoder(s) could */
 	/* write only uncompressed chunks with no properties. */
 	BYTE encode_properties = 1;
@@ -1969,7 +2135,13 @@ size_t LZMA2_encode(LZMA2_ECtx *const enc,
     enc->fast_length = MIN(options->fast_length, kMatchLenMax);
     enc->match_cycles = MIN(options->match_cycles, kMatchesMax - 1);
 
-    LZMA2_reset(enc, block.end);
+    /* Checkpoints must not depend on data outside the look-back window */
+    size_t const cp_interval = options->checkpoint_interval;
+    enc->history = (history != NULL && history->avail != 0 && cp_interval == 0) ? history : NULL;
+    enc->checkpoint_count = 0;
+
+    size_t const max_distance = (enc->history != NULL) ? MIN(block.end + history->avail, history->max_dist) : block.end;
+    LZMA2_reset(enc, max_distance);
 
     if (enc->strategy == FL2_ultra) {
         /* Create a hash chain to put the encoder into hybrid mode */
@@ -1987,10 +2159,57 @@ size_t LZMA2_encode(LZMA2_ECtx *const enc,
     /* Limit the matches near the end of this slice to not exceed block.end */
     RMF_limitLengths(tbl, block.end);
 
+    /* The first chunk after each multiple of cp_interval is a checkpoint. So is the slice start,
+     * because a decoder starting at an earlier checkpoint relies on the limit continuing. */
+    size_t next_cp = (cp_interval == 0) ? (size_t)-1 : (start != 0) ? start : cp_interval;
+    size_t cp_floor = 0;
+    size_t limited_end = 0;
+
     for (size_t pos = start; pos < block.end;) {
+        if (pos >= next_cp) {
+            /* Reset the state as at the start of a slice and allow matches only within the
+             * look-back window. The floor keeps the decoder's position bits aligned. */
+            LZMA2_reset(enc, max_distance);
+            encode_properties = 1;
+            cp_floor = (pos > options->checkpoint_lookback) ? (pos - options->checkpoint_lookback) & ~(size_t)15 : 0;
+            limited_end = pos;
+            next_cp = (pos / cp_interval + 1) * cp_interval;
+            if (enc->strategy == FL2_ultra) {
+                LZMA_hashReset(enc, options->second_dict_bits);
+                enc->hash_prev_index = (ptrdiff_t)cp_floor - 1;
+            }
+            /* The output of the first chunk may be in the temp buffer */
+            if (LZMA2_addCheckpoint(enc, pos, pos - cp_floor, (pos == start) ? 0 : (size_t)(out_dest - out_base)) != 0)
+                return FL2_ERROR(memory_allocation);
+        }
+        if (limited_end != 0) {
+            /* Null links below the floor for all positions the next chunk can read */
+            size_t const reach = MIN(block.end, pos + kMaxChunkUncompressedSize + kOptimizerBufferSize);
+            if (reach > limited_end) {
+                RMF_limitDistances(tbl, cp_floor, limited_end, reach);
+                limited_end = reach;
+            }
+        }
+
         size_t header_size = (stream_prop >= 0) + (encode_properties ? kChunkHeaderSize + 1 : kChunkHeaderSize);
         LZMA2_encStates saved_states;
         size_t next_index;
+        BYTE capped = 0;
+
+        if (out_buffer != NULL) {
+            /* A chunk is encoded in place before it is known whether it will be stored uncompressed,
+             * so limit its size to keep the attempt inside the external buffer */
+            size_t const avail = out_capacity - (size_t)(out_dest - out_buffer);
+            if (avail <= header_size + kMaxMatchEncodeSize * 2) {
+                /* No room to try compression. Storing is checked against the capacity below. */
+                incompressible = 1;
+            }
+            else {
+                enc->chunk_limit = MIN(avail - header_size, kMaxChunkCompressedSize) - kMaxMatchEncodeSize * 2;
+                enc->chunk_size = MIN(kChunkSize, enc->chunk_limit);
+                capped = (avail - header_size < kMaxChunkCompressedSize);
+            }
+        }
 
         RC_reset(&enc->rc);
         RC_setOutputBuffer(&enc->rc, out_dest + header_size);
@@ -2008,7 +2227,7 @@ size_t LZMA2_encode(LZMA2_ECtx *const enc,
                 LZMA_encodeLiteral(enc, 0, block.data[0], 0);
                 ++cur;
             }
-            if (pos == start) {
+            if (pos == start && out_buffer == NULL) {
                 /* After kTempMinOutput bytes we can write data to the match table because the */
                 /* compressed data will never catch up with the table position being read. */
                 cur = LZMA2_encodeChunk(enc, tbl, block, cur, end);
@@ -2017,7 +2236,7 @@ size_t LZMA2_encode(LZMA2_ECtx *const enc,
 					return FL2_ERROR(internal);
 
                 /* Switch to the match table as output buffer */
-                out_dest = RMF_getTableAsOutputBuffer(tbl, start);
+                out_dest = out_base;
                 memcpy(out_dest, enc->out_buf, header_size + enc->rc.out_index);
                 enc->rc.out_buffer = out_dest + header_size;
 
@@ -2037,6 +2256,16 @@ size_t LZMA2_encode(LZMA2_ECtx *const enc,
         if (compressed_size > kMaxChunkCompressedSize || uncompressed_size > kMaxChunkUncompressedSize)
             return FL2_ERROR(internal);
 
+        /* Output an uncompressed chunk if necessary */
+        BYTE const store = incompressible || uncompressed_size + 3 <= compressed_size + header_size;
+
+        if (store && capped) {
+            /* The attempt was cut short by the output capacity and will be stored anyway,
+             * so store a full chunk rather than add the overhead of another one */
+            next_index = MIN(pos + kChunkSize, block.end);
+            uncompressed_size = next_index - pos;
+        }
+
         BYTE* header = out_dest;
 
         if (stream_prop >= 0) {
@@ -2046,12 +2275,14 @@ size_t LZMA2_encode(LZMA2_ECtx *const enc,
 
         header[1] = (BYTE)((uncompressed_size - 1) >> 8);
         header[2] = (BYTE)(uncompressed_size - 1);
-        /* Output an uncompressed chunk if necessary */
-        if (incompressible || uncompressed_size + 3 <= compressed_size + header_size) {
+        if (store) {
             DEBUGLOG(6, "Storing chunk : was %u => %u", (unsigned)uncompressed_size, (unsigned)compressed_size);
 
             header[0] = (pos == 0) ? kChunkUncompressedDictReset : kChunkUncompressed;
 
+            if (out_buffer != NULL && (size_t)(header + 3 - out_buffer) + uncompressed_size > out_capacity)
+                return FL2_ERROR(dstSize_tooSmall);
+
             /* Copy uncompressed data into the output */
             memcpy(header + 3, block.data + pos, uncompressed_size);
 
@@ -2095,5 +2326,5 @@ size_t LZMA2_encode(LZMA2_ECtx *const enc,
         if (*canceled)
             return FL2_ERROR(canceled);
     }
-    return out_dest - RMF_getTableAsOutputBuffer(tbl, start);
+    return out_dest - out_base;
 }
@@ -24,6 +24,8 @@ extern "C" {
 
 typedef struct LZMA2_ECtx_s LZMA2_ECtx;
 
+typedef struct LZMA2_history_s LZMA2_history;
+
 typedef struct
 {
     unsigned lc;
@@ -34,8 +36,19 @@ typedef struct
     FL2_strategy strategy;
     unsigned second_dict_bits;
     unsigned reset_interval;
+    size_t checkpoint_interval; /* 0 = no checkpoints */
+    size_t checkpoint_lookback;
 } FL2_lzma2Parameters;
 
+/* A chunk at which the encoder reset the state and limited matches to a look-back window,
+ * so decoding can begin there given only the preceding lookback bytes */
+typedef struct
+{
+    size_t pos;      /* block position of the chunk */
+    size_t lookback;
+    size_t out_pos;  /* offset of the chunk header in the encoder output */
+} LZMA2_checkpoint;
+
 
 LZMA2_ECtx* LZMA2_createECtx(void);
 
@@ -50,7 +63,28 @@ size_t LZMA2_encode(LZMA2_ECtx *const enc,
     int stream_prop,
     FL2_atomic *const progress_in,
     FL2_atomic *const progress_out,
-    int *const canceled);
+    int *const canceled,
+    BYTE *const out_buffer,
+    size_t const out_capacity,
+    const LZMA2_history* const history);
+
+size_t LZMA2_getCheckpoints(const LZMA2_ECtx* const enc, const LZMA2_checkpoint** const checkpoints);
+
+/* History index for matches that precede the block in streaming mode */
+
+LZMA2_history* LZMA2_createHistory(size_t const window_size);
+
+void LZMA2_freeHistory(LZMA2_history* const hist);
+
+int LZMA2_historyCompatible(const LZMA2_history* const hist, size_t const window_size);
+
+size_t LZMA2_historyMemoryUsage(size_t const window_size);
+
+void LZMA2_historyReset(LZMA2_history* const hist);
+
+void LZMA2_historyInsert(LZMA2_history* const hist, const BYTE* const data, size_t const data_pos, size_t const start, size_t const end);
+
+void LZMA2_historySetBlock(LZMA2_history* const hist, size_t const block_pos, size_t const avail, size_t const max_dist);
 
 BYTE LZMA2_getDictSizeProp(size_t const dictionary_size);
 
@@ -0,0 +1,684 @@
+/* lzma_dec_engine.h -- LZMA decoder loop
+Based upon LzmaDec.c 2018-02-28 : Igor Pavlov : Public domain
+Modified for FL2 by Conor McCarthy */
+
+/* Included by lzma_dec_p16.c and lzma_dec_p32.c to build the decoder loop for
+ * each probability width. LZMA_ENGINE_PROB16 selects 16-bit probabilities. */
+
+#ifdef LZMA_ENGINE_PROB16
+typedef U16 LZMA2_prob;
+#else
+typedef U32 LZMA2_prob;
+#endif
+
+#ifdef HAVE_SMALL
+#  define LZMA_SIZE_OPT
+#endif
+
+#define NORMALIZE if (range < kTopValue) { range <<= 8; code = (code << 8) | (*buf++); }
+
+#define IF_BIT_0(p) ttt = *(p); NORMALIZE; bound = (range >> kNumBitModelTotalBits) * ttt; if (code < bound)
+#define UPDATE_0(p) range = bound; *(p) = (LZMA2_prob)(ttt + ((kBitModelTotal - ttt) >> kNumMoveBits));
+#define UPDATE_1(p) range -= bound; code -= bound; *(p) = (LZMA2_prob)(ttt - (ttt >> kNumMoveBits));
+#define GET_BIT2(p, i, A0, A1) IF_BIT_0(p) \
+    { UPDATE_0(p); i = (i + i); A0; } else \
+    { UPDATE_1(p); i = (i + i) + 1; A1; }
+
+#if defined __x86_64__s || defined _M_X64
+
+#define USE_CMOV
+
+#define PREP_BIT(p) ttt = *(p); NORMALIZE; bound = (range >> kNumBitModelTotalBits) * ttt
+#define UPDATE_PREP_0 U32 r0 = bound; unsigned p0 = (ttt + ((kBitModelTotal - ttt) >> kNumMoveBits))
+#define UPDATE_PREP_1 U32 r1 = range - bound; unsigned p1 = (ttt - (ttt >> kNumMoveBits))
+#define UPDATE_COND(p) range=(code < bound) ? r0 : r1; *p = (LZMA2_prob)((code < bound) ? p0 : p1)
+#define UPDATE_CODE code = code - ((code < bound) ? 0 : bound)
+
+#define TREE_GET_BIT(probs, i) { LZMA2_prob *pp = (probs)+(i); PREP_BIT(pp); \
+    UPDATE_PREP_0; unsigned i0 = (i + i); \
+    UPDATE_PREP_1; unsigned i1 = (i + i) + 1; \
+    UPDATE_COND(pp); \
+    i = (code < bound) ? i0 : i1; \
+    UPDATE_CODE; \
+}
+
+#define REV_BIT_VAR(probs, i, m) { LZMA2_prob *pp = (probs)+(i); PREP_BIT(pp); \
+    UPDATE_PREP_0; U32 i0 = i + m; U32 m2 = m + m; \
+    UPDATE_PREP_1; U32 i1 = i + m2; \
+    UPDATE_COND(pp); \
+    i = (code < bound) ? i0 : i1; \
+    m = m2; \
+    UPDATE_CODE; \
+}
+#define REV_BIT_CONST(probs, i, m) { LZMA2_prob *pp = (probs)+(i); PREP_BIT(pp); \
+    UPDATE_PREP_0; \
+    UPDATE_PREP_1; \
+    UPDATE_COND(pp); \
+    i += m + (code < bound ? 0 : m); \
+    UPDATE_CODE; \
+}
+#define REV_BIT_LAST(probs, i, m) { LZMA2_prob *pp = (probs)+(i); PREP_BIT(pp); \
+    UPDATE_PREP_0; \
+    UPDATE_PREP_1; \
+    UPDATE_COND(pp); \
+    i -= code < bound ? m : 0; \
+    UPDATE_CODE; \
+}
+
+#define MATCHED_LITER_DEC \
+    match_byte += match_byte; \
+    bit = offs; \
+    offs &= match_byte; \
+    prob_lit = prob + (offs + bit + symbol); \
+    PREP_BIT(prob_lit); \
+    { UPDATE_PREP_0; unsigned i0 = (symbol + symbol); \
+    UPDATE_PREP_1; unsigned i1 = (symbol + symbol) + 1; \
+    UPDATE_COND(prob_lit); \
+    symbol = (code < bound) ? i0 : i1; \
+    offs = (code < bound) ? offs ^ bit : offs; \
+    UPDATE_CODE; }
+
+#else
+#define TREE_GET_BIT(probs, i) { GET_BIT2(probs + i, i, ;, ;); }
+
+#define REV_BIT(p, i, A0, A1) IF_BIT_0(p + i) \
+    { UPDATE_0(p + i); A0; } else \
+    { UPDATE_1(p + i); A1; }
+#define REV_BIT_VAR(  p, i, m) REV_BIT(p, i, i += m; m += m, m += m; i += m; )
+#define REV_BIT_CONST(p, i, m) REV_BIT(p, i, i += m;       , i += m * 2; )
+#define REV_BIT_LAST( p, i, m) REV_BIT(p, i, i -= m        , ; )
+
+#define MATCHED_LITER_DEC \
+    match_byte += match_byte; \
+    bit = offs; \
+    offs &= match_byte; \
+    prob_lit = prob + (offs + bit + symbol); \
+    GET_BIT2(prob_lit, symbol, offs ^= bit; , ;)
+
+#endif
+
+#define TREE_DECODE(probs, limit, i) \
+    { i = 1; do { TREE_GET_BIT(probs, i); } while (i < limit); i -= limit; }
+
+#ifdef LZMA_SIZE_OPT
+#define TREE_6_DECODE(probs, i) TREE_DECODE(probs, (1 << 6), i)
+#else
+#define TREE_6_DECODE(probs, i) \
+    { i = 1; \
+    TREE_GET_BIT(probs, i); \
+    TREE_GET_BIT(probs, i); \
+    TREE_GET_BIT(probs, i); \
+    TREE_GET_BIT(probs, i); \
+    TREE_GET_BIT(probs, i); \
+    TREE_GET_BIT(probs, i); \
+    i -= 0x40; }
+#endif
+
+#define NORMAL_LITER_DEC TREE_GET_BIT(prob, symbol)
+
+#define NORMALIZE_CHECK if (range < kTopValue) { return 0; }
+
+#define IF_BIT_0_CHECK(p) ttt = *(p); NORMALIZE_CHECK; bound = (range >> kNumBitModelTotalBits) * ttt; if (code < bound)
+#define UPDATE_0_CHECK range = bound;
+#define UPDATE_1_CHECK range -= bound; code -= bound;
+#define GET_BIT2_CHECK(p, i, A0, A1) IF_BIT_0_CHECK(p) \
+    { UPDATE_0_CHECK; i = (i + i); A0; } else \
+    { UPDATE_1_CHECK; i = (i + i) + 1; A1; }
+#define GET_BIT_CHECK(p, i) GET_BIT2_CHECK(p, i, ; , ;)
+#define TREE_DECODE_CHECK(probs, limit, i) \
+    { i = 1; do { GET_BIT_CHECK(probs + i, i) } while (i < limit); i -= limit; }
+
+#define REV_BIT_CHECK(p, i, m) IF_BIT_0_CHECK(p + i) \
+    { UPDATE_0_CHECK; i += m; m += m; } else \
+    { UPDATE_1_CHECK; m += m; i += m; }
+
+BYTE
+#ifdef LZMA_ENGINE_PROB16
+LZMA_tryDummy16
+#else
+LZMA_tryDummy
+#endif
+(const LZMA2_DCtx *const p)
+{
+    const LZMA2_prob *probs = GET_PROBS;
+	unsigned state = p->state;
+	U32 range = p->range;
+	U32 code = p->code;
+
+    const LZMA2_prob *prob;
+    U32 bound;
+    unsigned ttt;
+    unsigned pos_state = CALC_POS_STATE(p->processed_pos, (1 << p->prop.pb) - 1);
+
+    prob = probs + IsMatch + COMBINED_PS_STATE;
+    IF_BIT_0_CHECK(prob)
+    {
+        UPDATE_0_CHECK
+
+            prob = probs + Literal;
+        if (p->check_dic_size != 0 || p->processed_pos != 0)
+            prob += ((U32)kLzmaLitSize *
+            ((((p->processed_pos) & ((1 << (p->prop.lp)) - 1)) << p->prop.lc) +
+                (p->dic[(p->dic_pos == 0 ? p->dic_buf_size : p->dic_pos) - 1] >> (8 - p->prop.lc))));
+
+        if (state < kNumLitStates)
+        {
+            unsigned symbol = 1;
+            do { GET_BIT_CHECK(prob + symbol, symbol) } while (symbol < 0x100);
+        }
+        else
+        {
+            unsigned match_byte = p->dic[p->dic_pos - p->reps[0] +
+                (p->dic_pos < p->reps[0] ? p->dic_buf_size : 0)];
+            unsigned offs = 0x100;
+            unsigned symbol = 1;
+            do
+            {
+                unsigned bit;
+                const LZMA2_prob *prob_lit;
+                match_byte += match_byte;
+                bit = offs;
+                offs &= match_byte;
+                prob_lit = prob + (offs + bit + symbol);
+                GET_BIT2_CHECK(prob_lit, symbol, offs ^= bit; , ; )
+            } while (symbol < 0x100);
+        }
+    }
+    else
+    {
+        unsigned len;
+        UPDATE_1_CHECK;
+
+        prob = probs + IsRep + state;
+        IF_BIT_0_CHECK(prob)
+        {
+            UPDATE_0_CHECK;
+            state = 0;
+            prob = probs + LenCoder;
+        }
+        else
+        {
+            UPDATE_1_CHECK;
+            prob = probs + IsRepG0 + state;
+            IF_BIT_0_CHECK(prob)
+            {
+                UPDATE_0_CHECK;
+                prob = probs + IsRep0Long + COMBINED_PS_STATE;
+                IF_BIT_0_CHECK(prob)
+                {
+                    UPDATE_0_CHECK;
+                    NORMALIZE_CHECK;
+                    return 1;
+                }
+                else
+                {
+                    UPDATE_1_CHECK;
+                }
+            }
+            else
+            {
+                UPDATE_1_CHECK;
+                prob = probs + IsRepG1 + state;
+                IF_BIT_0_CHECK(prob)
+                {
+                    UPDATE_0_CHECK;
+                }
+                else
+                {
+                    UPDATE_1_CHECK;
+                    prob = probs + IsRepG2 + state;
+                    IF_BIT_0_CHECK(prob)
+                    {
+                        UPDATE_0_CHECK;
+                    }
+                    else
+                    {
+                        UPDATE_1_CHECK;
+                    }
+                }
+            }
+            state = kNumStates;
+            prob = probs + RepLenCoder;
+        }
+        {
+            unsigned limit, offset;
+            const LZMA2_prob *prob_len = prob + LenChoice;
+            IF_BIT_0_CHECK(prob_len)
+            {
+                UPDATE_0_CHECK;
+                prob_len = prob + LenLow + GET_LEN_STATE;
+                offset = 0;
+                limit = 1 << kLenNumLowBits;
+            }
+            else
+            {
+                UPDATE_1_CHECK;
+                prob_len = prob + LenChoice2;
+                IF_BIT_0_CHECK(prob_len)
+                {
+                    UPDATE_0_CHECK;
+                    prob_len = prob + LenLow + GET_LEN_STATE + (1 << kLenNumLowBits);
+                    offset = kLenNumLowSymbols;
+                    limit = 1 << kLenNumLowBits;
+                }
+                else
+                {
+                  UPDATE_1_CHECK;
+                  prob_len = prob + LenHigh;
+                  offset = kLenNumLowSymbols * 2;
+                  limit = 1 << kLenNumHighBits;
+                }
+            }
+            TREE_DECODE_CHECK(prob_len, limit, len);
+            len += offset;
+        }
+
+        if (state < 4)
+        {
+            unsigned pos_slot;
+            prob = probs + PosSlot +
+                ((len < kNumLenToPosStates - 1 ? len : kNumLenToPosStates - 1) <<
+                    kNumPosSlotBits);
+            TREE_DECODE_CHECK(prob, 1 << kNumPosSlotBits, pos_slot);
+            if (pos_slot >= kStartPosModelIndex)
+            {
+                unsigned num_direct_bits = ((pos_slot >> 1) - 1);
+
+                if (pos_slot < kEndPosModelIndex)
+                {
+                    prob = probs + SpecPos + ((2 | (pos_slot & 1)) << num_direct_bits);
+                }
+                else
+                {
+                    num_direct_bits -= kNumAlignBits;
+                    do
+                    {
+                        NORMALIZE_CHECK;
+                        range >>= 1;
+                        code -= range & (((code - range) >> 31) - 1);
+                        /* if (code >= range) code -= range; */
+                    } while (--num_direct_bits != 0);
+                    prob = probs + Align;
+                    num_direct_bits = kNumAlignBits;
+                }
+                {
+                    unsigned i = 1;
+                    unsigned m = 1;
+                    do
+                    {
+                        REV_BIT_CHECK(prob, i, m);
+                    } while (--num_direct_bits != 0);
+                }
+            }
+        }
+    }
+    NORMALIZE_CHECK;
+    return 1;
+}
+
+/* First LZMA-symbol is always decoded.
+And it decodes new LZMA-symbols while (buf < buf_limit), but "buf" is without last normalization
+Out:
+  Result:
+    0 - OK
+    1 - Error
+*/
+
+/* LZMA2_DEC_OPT builds use the asm versions of both variants */
+#ifndef LZMA2_DEC_OPT
+
+int
+#ifdef LZMA_ENGINE_PROB16
+LZMA_decodeReal16_3
+#else
+LZMA_decodeReal_3
+#endif
+(LZMA2_DCtx *p, size_t limit, const BYTE *buf_limit)
+{
+    LZMA2_prob *const probs = GET_PROBS;
+
+    unsigned state = p->state;
+    U32 rep0 = p->reps[0], rep1 = p->reps[1], rep2 = p->reps[2], rep3 = p->reps[3];
+    unsigned const pb_mask = ((unsigned)1 << (p->prop.pb)) - 1;
+    unsigned const lc = p->prop.lc;
+    unsigned const lp_mask = ((unsigned)0x100 << p->prop.lp) - ((unsigned)0x100 >> lc);
+
+    BYTE *const dic = p->dic;
+    size_t const dic_buf_size = p->dic_buf_size;
+    size_t dic_pos = p->dic_pos;
+
+    U32 processed_pos = p->processed_pos;
+    U32 const check_dic_size = p->check_dic_size;
+    unsigned len = 0;
+
+    const BYTE *buf = p->buf;
+    U32 range = p->range;
+    U32 code = p->code;
+
+    do
+    {
+        LZMA2_prob *prob;
+        U32 bound;
+        unsigned ttt;
+        unsigned pos_state = CALC_POS_STATE(processed_pos, pb_mask);
+
+        prob = probs + IsMatch + COMBINED_PS_STATE;
+        IF_BIT_0(prob)
+        {
+            unsigned symbol;
+            UPDATE_0(prob);
+            prob = probs + Literal;
+            if (processed_pos != 0 || check_dic_size != 0)
+                prob += (U32)3 * ((((processed_pos << 8) + dic[(dic_pos == 0 ? dic_buf_size : dic_pos) - 1]) & lp_mask) << lc);
+            processed_pos++;
+
+            if (state < kNumLitStates)
+            {
+                state -= (state < 4) ? state : 3;
+                symbol = 1;
+#ifdef LZMA_SIZE_OPT
+                do { NORMAL_LITER_DEC } while (symbol < 0x100);
+#else
+                NORMAL_LITER_DEC
+                    NORMAL_LITER_DEC
+                    NORMAL_LITER_DEC
+                    NORMAL_LITER_DEC
+                    NORMAL_LITER_DEC
+                    NORMAL_LITER_DEC
+                    NORMAL_LITER_DEC
+                    NORMAL_LITER_DEC
+#endif
+            }
+            else
+            {
+                unsigned match_byte = dic[dic_pos - rep0 + (dic_pos < rep0 ? dic_buf_size : 0)];
+                unsigned offs = 0x100;
+                state -= (state < 10) ? 3 : 6;
+                symbol = 1;
+#ifdef LZMA_SIZE_OPT
+                do
+                {
+                    unsigned bit;
+                    LZMA2_prob *prob_lit;
+                    MATCHED_LITER_DEC
+                } while (symbol < 0x100);
+#else
+                {
+                    unsigned bit;
+                    LZMA2_prob *prob_lit;
+                    MATCHED_LITER_DEC
+                    MATCHED_LITER_DEC
+                    MATCHED_LITER_DEC
+                    MATCHED_LITER_DEC
+                    MATCHED_LITER_DEC
+                    MATCHED_LITER_DEC
+                    MATCHED_LITER_DEC
+                    MATCHED_LITER_DEC
+                }
+#endif
+            }
+
+            dic[dic_pos++] = (BYTE)symbol;
+            continue;
+        }
+
+        UPDATE_1(prob);
+        prob = probs + IsRep + state;
+        IF_BIT_0(prob)
+        {
+            UPDATE_0(prob);
+            state += kNumStates;
+            prob = probs + LenCoder;
+        }
+        else
+        {
+            UPDATE_1(prob);
+            /*
+            that case was checked before with kBadRepCode:
+            if (check_dic_size == 0 && processed_pos == 0)
+            return 1;
+            */
+            prob = probs + IsRepG0 + state;
+            IF_BIT_0(prob)
+            {
+                UPDATE_0(prob);
+                prob = probs + IsRep0Long + COMBINED_PS_STATE;
+                IF_BIT_0(prob)
+                {
+                      UPDATE_0(prob);
+                      dic[dic_pos] = dic[dic_pos - rep0 + (dic_pos < rep0 ? dic_buf_size : 0)];
+                      dic_pos++;
+                      processed_pos++;
+                      state = state < kNumLitStates ? 9 : 11;
+                      continue;
+                }
+                UPDATE_1(prob);
+            }
+            else
+            {
+                U32 distance;
+                UPDATE_1(prob);
+                prob = probs + IsRepG1 + state;
+                IF_BIT_0(prob)
+                {
+                    UPDATE_0(prob);
+                    distance = rep1;
+                }
+                else
+                {
+                    UPDATE_1(prob);
+                    prob = probs + IsRepG2 + state;
+#ifdef USE_CMOV
+                    PREP_BIT(prob);
+                    UPDATE_PREP_0;
+                    UPDATE_PREP_1;
+                    UPDATE_COND(prob);
+                    distance = code < bound ? rep2 : rep3;
+                    rep3 = code < bound ? rep3 : rep2;
+                    UPDATE_CODE;
+#else
+                    IF_BIT_0(prob)
+                    {
+                        UPDATE_0(prob);
+                        distance = rep2;
+                    }
+                    else
+                    {
+                        UPDATE_1(prob);
+                        distance = rep3;
+                        rep3 = rep2;
+                    }
+#endif
+                    rep2 = rep1;
+                }
+                rep1 = rep0;
+                rep0 = distance;
+            }
+            state = state < kNumLitStates ? 8 : 11;
+            prob = probs + RepLenCoder;
+        }
+
+#ifdef LZMA_SIZE_OPT
+        unsigned lim, offset;
+        LZMA2_prob *prob_len = prob + LenChoice;
+        IF_BIT_0(prob_len)
+        {
+              UPDATE_0(prob_len);
+              prob_len = prob + LenLow + GET_LEN_STATE;
+              offset = 0;
+              lim = (1 << kLenNumLowBits);
+        }
+        else
+        {
+            UPDATE_1(prob_len);
+            prob_len = prob + LenChoice2;
+            IF_BIT_0(prob_len)
+            {
+                UPDATE_0(prob_len);
+                prob_len = prob + LenLow + GET_LEN_STATE + (1 << kLenNumLowBits);
+                offset = kLenNumLowSymbols;
+                lim = (1 << kLenNumLowBits);
+            }
+            else
+            {
+                UPDATE_1(prob_len);
+                prob_len = prob + LenHigh;
+                offset = kLenNumLowSymbols * 2;
+                lim = (1 << kLenNumHighBits);
+            }
+        }
+        TREE_DECODE(prob_len, lim, len);
+        len += offset;
+#else
+        LZMA2_prob *prob_len = prob + LenChoice;
+        IF_BIT_0(prob_len)
+        {
+              UPDATE_0(prob_len);
+              prob_len = prob + LenLow + GET_LEN_STATE;
+              len = 1;
+              TREE_GET_BIT(prob_len, len);
+              TREE_GET_BIT(prob_len, len);
+              TREE_GET_BIT(prob_len, len);
+              len -= 8;
+        }
+        else
+        {
+            UPDATE_1(prob_len);
+            prob_len = prob + LenChoice2;
+            IF_BIT_0(prob_len)
+            {
+                UPDATE_0(prob_len);
+                prob_len = prob + LenLow + GET_LEN_STATE + (1 << kLenNumLowBits);
+                len = 1;
+                TREE_GET_BIT(prob_len, len);
+                TREE_GET_BIT(prob_len, len);
+                TREE_GET_BIT(prob_len, len);
+            }
+            else
+            {
+                UPDATE_1(prob_len);
+                prob_len = prob + LenHigh;
+                TREE_DECODE(prob_len, (1 << kLenNumHighBits), len);
+                len += kLenNumLowSymbols * 2;
+            }
+        }
+#endif
+
+        if (state >= kNumStates)
+        {
+            U32 distance;
+            prob = probs + PosSlot +
+                ((len < kNumLenToPosStates ? len : kNumLenToPosStates - 1) << kNumPosSlotBits);
+            TREE_6_DECODE(prob, distance);
+            if (distance >= kStartPosModelIndex)
+            {
+                unsigned pos_slot = (unsigned)distance;
+                unsigned num_direct_bits = (unsigned)(((distance >> 1) - 1));
+                distance = (2 | (distance & 1));
+                if (pos_slot < kEndPosModelIndex)
+                {
+                    distance <<= num_direct_bits;
+                    prob = probs + SpecPos;
+                    {
+                        U32 m = 1;
+                        distance++;
+                        do
+                        {
+                            REV_BIT_VAR(prob, distance, m);
+                        } while (--num_direct_bits);
+                        distance -= m;
+                    }
+                }
+                else
+                {
+                    num_direct_bits -= kNumAlignBits;
+                    do
+                    {
+                        NORMALIZE
+                        range >>= 1;
+
+                        U32 t;
+                        code -= range;
+                        t = (0 - ((U32)code >> 31));
+                        distance = (distance << 1) + (t + 1);
+                        code += range & t;
+                    } while (--num_direct_bits != 0);
+                    prob = probs + Align;
+                    distance <<= kNumAlignBits;
+                    {
+                        U32 i = 1;
+                        REV_BIT_CONST(prob, i, 1);
+                        REV_BIT_CONST(prob, i, 2);
+                        REV_BIT_CONST(prob, i, 4);
+                        REV_BIT_LAST(prob, i, 8);
+                        distance |= i;
+                    }
+                }
+            }
+
+            rep3 = rep2;
+            rep2 = rep1;
+            rep1 = rep0;
+            rep0 = distance + 1;
+            if (distance >= (check_dic_size == 0 ? processed_pos : check_dic_size))
+            {
+                p->dic_pos = dic_pos;
+                return 1;
+            }
+            state = (state < kNumStates + kNumLitStates) ? kNumLitStates : kNumLitStates + 3;
+        }
+
+        len += kMatchMinLen;
+
+        size_t rem = limit - dic_pos;
+        if (rem == 0)
+        {
+            p->dic_pos = dic_pos;
+            return 1;
+        }
+
+        unsigned cur_len = ((rem < len) ? (unsigned)rem : len);
+        size_t pos = dic_pos - rep0 + (dic_pos < rep0 ? dic_buf_size : 0);
+
+        processed_pos += cur_len;
+
+        len -= cur_len;
+        if (cur_len <= dic_buf_size - pos)
+        {
+            BYTE *dest = dic + dic_pos;
+            ptrdiff_t src = (ptrdiff_t)pos - (ptrdiff_t)dic_pos;
+            const BYTE *end = dest + cur_len;
+            dic_pos += cur_len;
+            do
+                *(dest) = (BYTE)*(dest + src);
+            while (++dest != end);
+        }
+        else
+        {
+            do
+            {
+                dic[dic_pos++] = dic[pos];
+                if (++pos == dic_buf_size)
+                    pos = 0;
+            } while (--cur_len != 0);
+        }
+    } while (dic_pos < limit && buf < buf_limit);
+
+    NORMALIZE;
+
+    p->buf = buf;
+    p->range = range;
+    p->code = code;
+    p->remain_len = len;
+    p->dic_pos = dic_pos;
+    p->processed_pos = processed_pos;
+    p->reps[0] = rep0;
+    p->reps[1] = rep1;
+    p->reps[2] = rep2;
+    p->reps[3] = rep3;
+    p->state = state;
+
+    return 0;
+}
+
+#endif /* LZMA2_DEC_OPT */
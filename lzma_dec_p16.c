@@ -0,0 +1,10 @@
+/* lzma_dec_p16.c -- LZMA decoder loop for 16-bit probabilities
+Based upon LzmaDec.c 2018-02-28 : Igor Pavlov : Public domain
+Modified for FL2 by Conor McCarthy */
+
+#include "lzma2_dec.h"
+#include "platform.h"
+
+#define LZMA_ENGINE_PROB16
+
+#include "lzma_dec_engine.h"
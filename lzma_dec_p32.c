@@ -0,0 +1,8 @@
+/* lzma_dec_p32.c -- LZMA decoder loop for 32-bit probabilities
+Based upon LzmaDec.c 2018-02-28 : Igor Pavlov : Public domain
+Modified for FL2 by Conor McCarthy */
+
+#include "lzma2_dec.h"
+#include "platform.h"
+
+#include "lzma_dec_engine.h"
@@ -112,7 +112,7 @@ endm
 
 ; _LZMA_SIZE_OPT  equ 1
 
-; _LZMA_PROB16 equ 1
+; lzma_dec_x86_64_p16.asm defines _LZMA_PROB16 to build LZMA_decodeReal16_3()
 
 ifdef _LZMA_PROB16
         PSHIFT  equ 1
@@ -680,7 +680,11 @@ PARAM_bufLimit  equ REG_PARAM_2
 
 _TEXT$LZMADECOPT SEGMENT ALIGN(64) 'CODE'
 
+ifdef _LZMA_PROB16
+LZMA_decodeReal16_3 PROC
+else
 LZMA_decodeReal_3 PROC
+endif
 MY_PUSH_PRESERVED_REGS
 
 ; RSP is (16x + 8) bytes aligned in WIN64-x64
@@ -1278,7 +1282,11 @@ fin:
 
 		MY_POP_PRESERVED_REGS
 		ret
+ifdef _LZMA_PROB16
+LZMA_decodeReal16_3 ENDP
+else
 LZMA_decodeReal_3 ENDP
+endif
 
 _TEXT$LZMADECOPT ENDS
 
@@ -0,0 +1,6 @@
+; lzma_dec_x86_64_p16.asm -- ASM version of LZMA_decodeReal16_3() function,
+; for 16-bit probabilities. Public domain.
+
+_LZMA_PROB16 equ 1
+
+include lzma_dec_x86_64.asm
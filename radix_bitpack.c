@@ -55,4 +55,15 @@ void RMF_bitpackLimitLengths(FL2_matchTable* const tbl, size_t const pos)
     }
 }
 
+/* Remove links to positions before min_pos from the table entries in [start, end) */
+void RMF_bitpackLimitDistances(FL2_matchTable* const tbl, size_t const min_pos, size_t const start, size_t const end)
+{
+    DEBUGLOG(5, "RMF_limitDistances : min pos %u, start %u, end %u", (U32)min_pos, (U32)start, (U32)end);
+    for (size_t pos = start; pos < end; ++pos) {
+        U32 const link = tbl->table[pos];
+        if (link != RADIX_NULL_LINK && (link & RADIX_LINK_MASK) < min_pos)
+            SetNull(pos);
+    }
+}
+
 #include "radix_engine.h"
\ No newline at end of file
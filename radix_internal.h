@@ -126,6 +126,8 @@ int RMF_bitpackIntegrityCheck(const struct FL2_matchTable_s* const tbl, const BY
 int RMF_structuredIntegrityCheck(const struct FL2_matchTable_s* const tbl, const BYTE* const data, size_t pos, size_t const end, unsigned max_depth);
 void RMF_bitpackLimitLengths(struct FL2_matchTable_s* const tbl, size_t const pos);
 void RMF_structuredLimitLengths(struct FL2_matchTable_s* const tbl, size_t const pos);
+void RMF_bitpackLimitDistances(struct FL2_matchTable_s* const tbl, size_t const min_pos, size_t const start, size_t const end);
+void RMF_structuredLimitDistances(struct FL2_matchTable_s* const tbl, size_t const min_pos, size_t const start, size_t const end);
 BYTE* RMF_bitpackAsOutputBuffer(struct FL2_matchTable_s* const tbl, size_t const pos);
 BYTE* RMF_structuredAsOutputBuffer(struct FL2_matchTable_s* const tbl, size_t const pos);
 size_t RMF_bitpackGetMatch(const struct FL2_matchTable_s* const tbl,
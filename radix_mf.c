@@ -719,6 +719,14 @@ void RMF_limitLengths(FL2_matchTable* const tbl, size_t const pos)
         RMF_bitpackLimitLengths(tbl, pos);
 }
 
+void RMF_limitDistances(FL2_matchTable* const tbl, size_t const min_pos, size_t const start, size_t const end)
+{
+    if (tbl->is_struct)
+        RMF_structuredLimitDistances(tbl, min_pos, start, end);
+    else
+        RMF_bitpackLimitDistances(tbl, min_pos, start, end);
+}
+
 BYTE* RMF_getTableAsOutputBuffer(FL2_matchTable* const tbl, size_t const pos)
 {
     if (tbl->is_struct)
@@ -51,6 +51,7 @@ void RMF_cancelBuild(FL2_matchTable* const tbl);
 void RMF_resetIncompleteBuild(FL2_matchTable* const tbl);
 int RMF_integrityCheck(const FL2_matchTable* const tbl, const BYTE* const data, size_t const pos, size_t const end, unsigned const max_depth);
 void RMF_limitLengths(FL2_matchTable* const tbl, size_t const pos);
+void RMF_limitDistances(FL2_matchTable* const tbl, size_t const min_pos, size_t const start, size_t const end);
 BYTE* RMF_getTableAsOutputBuffer(FL2_matchTable* const tbl, size_t const pos);
 size_t RMF_memoryUsage(size_t const dict_size, unsigned const buffer_resize, unsigned const thread_count);
 
@@ -57,4 +57,15 @@ void RMF_structuredLimitLengths(FL2_matchTable* const tbl, size_t const pos)
     }
 }
 
+/* Remove links to positions before min_pos from the table entries in [start, end) */
+void RMF_structuredLimitDistances(FL2_matchTable* const tbl, size_t const min_pos, size_t const start, size_t const end)
+{
+    DEBUGLOG(5, "RMF_limitDistances : min pos %u, start %u, end %u", (U32)min_pos, (U32)start, (U32)end);
+    for (size_t pos = start; pos < end; ++pos) {
+        U32 const link = GetMatchLink(pos);
+        if (link != RADIX_NULL_LINK && link < min_pos)
+            SetNull(pos);
+    }
+}
+
 #include "radix_engine.h"
\ No newline at end of file